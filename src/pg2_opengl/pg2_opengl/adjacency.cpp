@@ -0,0 +1,343 @@
+#include "pch.h"
+#include "adjacency.h"
+#include "parallel.h"
+
+static const uint32_t kNoHalfEdge = std::numeric_limits<uint32_t>::max();
+static const uint64_t kEmptyKey = std::numeric_limits<uint64_t>::max();
+
+/* undirected edge (a, b) */
+static inline uint64_t EdgeKey(const int a, const int b)
+{
+	return (a < b) ? (uint64_t(uint32_t(a)) << 32) | uint32_t(b) : (uint64_t(uint32_t(b)) << 32) | uint32_t(a);
+}
+
+/* splitmix64 finalizer, the high bits select the partition and the low bits the slot */
+static inline uint64_t HashEdge(uint64_t key)
+{
+	key ^= key >> 30;
+	key *= 0xbf58476d1ce4e5b9ull;
+	key ^= key >> 27;
+	key *= 0x94d049bb133111ebull;
+	key ^= key >> 31;
+
+	return key;
+}
+
+int BuildAdjacencyParallel(Mesh& mesh, AdjacencyStatistics* statistics, int no_threads)
+{
+	const auto t0 = std::chrono::high_resolution_clock::now();
+
+	std::vector<Face3i*> faces;
+
+	faces.reserve(mesh.size());
+	for (auto& patch : mesh.patches())
+	{
+		for (Face3i& face : patch.second)
+		{
+			faces.push_back(&face);
+		}
+	}
+
+	if (faces.size() * 3 >= kNoHalfEdge)
+	{
+		return S_FALSE;
+	}
+
+	if (no_threads < 1)
+	{
+		no_threads = std::max(1, int(std::thread::hardware_concurrency()));
+	}
+	no_threads = int(std::max<size_t>(1, std::min<size_t>(no_threads, faces.size() / 16384 + 1)));
+
+	// a few partitions per thread balance the uneven partition sizes, small partitions keep their hash tables in the cache
+	int partition_bits = 0;
+	while ((1 << partition_bits) < no_threads * 4 || (faces.size() * 3 >> partition_bits) > 16384)
+	{
+		++partition_bits;
+	}
+	const int no_partitions = 1 << partition_bits;
+	auto partition = [partition_bits](const uint64_t hash) { return int(partition_bits > 0 ? hash >> (64 - partition_bits) : 0); };
+
+	std::vector<AdjacencyStatistics> thread_statistics(no_threads);
+
+	// 1) count the half-edges of every partition per thread
+	std::vector<size_t> offsets(size_t(no_threads) * no_partitions, 0);
+
+	ParallelFor(no_threads, faces.size(), [&](const int t, const size_t first, const size_t last) {
+		size_t* counts = &offsets[size_t(t) * no_partitions];
+
+		for (size_t f = first; f < last; ++f)
+		{
+			const Face3i& face = *faces[f];
+
+			for (int i = 0; i < 3; ++i)
+			{
+				const int a = face.vertices[i].position_index;
+				const int b = face.vertices[(i + 1) % 3].position_index;
+
+				if (a == b)
+				{
+					++thread_statistics[t].no_degenerate_edges;
+					continue;
+				}
+				++counts[partition(HashEdge(EdgeKey(a, b)))];
+			}
+		}
+	});
+
+	// partitions are stored one after another, within each partition the threads write one after another
+	std::vector<size_t> partition_begin(no_partitions + 1, 0);
+	size_t no_half_edges = 0;
+
+	for (int p = 0; p < no_partitions; ++p)
+	{
+		partition_begin[p] = no_half_edges;
+
+		for (int t = 0; t < no_threads; ++t)
+		{
+			const size_t count = offsets[size_t(t) * no_partitions + p];
+			offsets[size_t(t) * no_partitions + p] = no_half_edges;
+			no_half_edges += count;
+		}
+	}
+	partition_begin[no_partitions] = no_half_edges;
+
+	// 2) scatter the half-edges into their partitions together with the vertex opposite to them, so that matching does not touch the faces
+	std::vector<uint64_t> keys(no_half_edges);
+	std::vector<uint32_t> half_edges(no_half_edges); // 3 * face + edge
+	std::vector<int> opposite_vertices(no_half_edges);
+
+	ParallelFor(no_threads, faces.size(), [&](const int t, const size_t first, const size_t last) {
+		size_t* positions = &offsets[size_t(t) * no_partitions];
+
+		for (size_t f = first; f < last; ++f)
+		{
+			const Face3i& face = *faces[f];
+
+			for (int i = 0; i < 3; ++i)
+			{
+				const int a = face.vertices[i].position_index;
+				const int b = face.vertices[(i + 1) % 3].position_index;
+
+				if (a != b)
+				{
+					const uint64_t key = EdgeKey(a, b);
+					const size_t position = positions[partition(HashEdge(key))]++;
+
+					keys[position] = key;
+					half_edges[position] = uint32_t(f * 3 + i);
+					opposite_vertices[position] = face.vertices[(i + 2) % 3].position_index;
+				}
+			}
+		}
+	});
+
+	// 3) match the half-edges of each partition in its own hash table, every half-edge is written by exactly one partition
+	std::vector<int> adjacent_vertices(faces.size() * 3, -1);
+	std::atomic<int> next_partition{ 0 };
+
+	auto pair = [&](const size_t j0, const size_t j1) {
+		adjacent_vertices[half_edges[j0]] = opposite_vertices[j1];
+		adjacent_vertices[half_edges[j1]] = opposite_vertices[j0];
+	};
+	auto first_vertex = [&faces](const uint32_t half_edge) {
+		return faces[half_edge / 3]->vertices[half_edge % 3].position_index;
+	};
+
+	ParallelFor(no_threads, no_threads, [&](const int t, const size_t, const size_t) {
+		struct Slot
+		{
+			uint64_t key;
+			uint32_t head; // first half-edge of the edge, the rest is chained through next
+			uint32_t count;
+		};
+
+		std::vector<Slot> table;
+		std::vector<uint32_t> next;
+		std::vector<uint32_t> shared; // half-edges of one non-manifold edge
+		AdjacencyStatistics& stats = thread_statistics[t];
+
+		for (int p = next_partition++; p < no_partitions; p = next_partition++)
+		{
+			const size_t begin = partition_begin[p];
+			const size_t n = partition_begin[p + 1] - begin;
+
+			size_t table_size = 16;
+			while (table_size < n * 2)
+			{
+				table_size *= 2;
+			}
+			const size_t mask = table_size - 1;
+
+			table.assign(table_size, { kEmptyKey, kNoHalfEdge, 0 });
+			next.resize(n);
+
+			for (size_t j = 0; j < n; ++j)
+			{
+				const uint64_t key = keys[begin + j];
+
+				for (size_t slot = HashEdge(key) & mask; ; slot = (slot + 1) & mask)
+				{
+					if (table[slot].key == kEmptyKey)
+					{
+						table[slot] = { key, uint32_t(j), 1 };
+						next[j] = kNoHalfEdge;
+						break;
+					}
+					if (table[slot].key == key)
+					{
+						next[j] = table[slot].head;
+						table[slot].head = uint32_t(j);
+						++table[slot].count;
+						break;
+					}
+				}
+			}
+
+			for (const Slot& slot : table)
+			{
+				if (slot.key == kEmptyKey)
+				{
+					continue;
+				}
+				++stats.no_edges;
+
+				if (slot.count == 1)
+				{
+					++stats.no_boundary_edges;
+				}
+				else if (slot.count == 2)
+				{
+					pair(begin + slot.head, begin + next[slot.head]);
+				}
+				else
+				{
+					// pair every half-edge with an unpaired one of the opposite direction, the remaining ones stay open
+					++stats.no_non_manifold_edges;
+
+					shared.clear();
+					for (uint32_t j = slot.head; j != kNoHalfEdge; j = next[j])
+					{
+						shared.push_back(uint32_t(begin + j));
+					}
+
+					for (size_t k = 0; k < shared.size(); ++k)
+					{
+						if (shared[k] == kNoHalfEdge)
+						{
+							continue;
+						}
+
+						for (size_t l = k + 1; l < shared.size(); ++l)
+						{
+							if (shared[l] != kNoHalfEdge && first_vertex(half_edges[shared[k]]) != first_vertex(half_edges[shared[l]]))
+							{
+								pair(shared[k], shared[l]);
+								shared[l] = kNoHalfEdge;
+								break;
+							}
+						}
+						shared[k] = kNoHalfEdge;
+					}
+				}
+			}
+		}
+	});
+
+	// 4) copy the result to the faces in their order
+	ParallelFor(no_threads, faces.size(), [&](const int, const size_t first, const size_t last) {
+		for (size_t f = first; f < last; ++f)
+		{
+			for (int i = 0; i < 3; ++i)
+			{
+				faces[f]->adjacent_vertices[i] = adjacent_vertices[f * 3 + i];
+			}
+		}
+	});
+
+	AdjacencyStatistics total;
+
+	for (const AdjacencyStatistics& stats : thread_statistics)
+	{
+		total.no_edges += stats.no_edges;
+		total.no_boundary_edges += stats.no_boundary_edges;
+		total.no_non_manifold_edges += stats.no_non_manifold_edges;
+		total.no_degenerate_edges += stats.no_degenerate_edges;
+	}
+
+	const auto t1 = std::chrono::high_resolution_clock::now();
+
+	total.time = std::chrono::duration<double>(t1 - t0).count();
+
+	if (statistics)
+	{
+		*statistics = total;
+	}
+
+	return S_OK;
+}
+
+size_t BuildEdgeList(const GLuint* indices, const size_t no_indices, const Vector3* positions, std::vector<GLuint>& edge_indices)
+{
+	// the pool splits a position into several vertices with different attributes, edges are matched by the first vertex of each position
+	struct PositionHash
+	{
+		size_t operator()(const std::array<uint32_t, 3>& key) const {
+			return size_t(HashEdge((uint64_t(key[0]) << 32 | key[1]) ^ (uint64_t(key[2]) * 0x9e3779b97f4a7c15ull)));
+		}
+	};
+	std::unordered_map<std::array<uint32_t, 3>, GLuint, PositionHash> position_ids;
+	std::unordered_map<GLuint, GLuint> vertex_ids;
+
+	auto position_id = [&](const GLuint vertex) {
+		const auto known = vertex_ids.find(vertex);
+
+		if (known != vertex_ids.end())
+		{
+			return known->second;
+		}
+
+		std::array<uint32_t, 3> key;
+		memcpy(key.data(), &positions[vertex].x, sizeof(key));
+
+		const GLuint id = position_ids.emplace(key, vertex).first->second;
+		vertex_ids.emplace(vertex, id);
+
+		return id;
+	};
+
+	std::unordered_set<uint64_t> edges;
+	const size_t first_edge_index = edge_indices.size();
+
+	edges.reserve(no_indices / 4);
+	vertex_ids.reserve(no_indices / 6);
+	position_ids.reserve(no_indices / 6);
+
+	for (size_t i = 0; i + 6 <= no_indices; i += 6)
+	{
+		const GLuint* primitive = indices + i;
+
+		for (int k = 0; k < 3; ++k)
+		{
+			const GLuint a = primitive[2 * k];
+			const GLuint b = primitive[(2 * k + 2) % 6];
+			const GLuint opposite = primitive[(2 * k + 4) % 6];
+			const GLuint adjacent = primitive[2 * k + 1];
+
+			const int id_a = int(position_id(a));
+			const int id_b = int(position_id(b));
+
+			if (id_a == id_b || !edges.insert(EdgeKey(id_a, id_b)).second)
+			{
+				continue; // degenerate or already added from the other triangle
+			}
+
+			edge_indices.push_back(opposite);
+			edge_indices.push_back(a);
+			edge_indices.push_back(b);
+			edge_indices.push_back(adjacent);
+		}
+	}
+
+	return (edge_indices.size() - first_edge_index) / 4;
+}
@@ -0,0 +1,25 @@
+#ifndef ADJACENCY_H_
+#define ADJACENCY_H_
+
+#include "pch.h"
+#include "objloader.h"
+
+/* edge counts collected while building the adjacency */
+struct AdjacencyStatistics
+{
+	size_t no_edges{ 0 }; /* unique undirected edges */
+	size_t no_boundary_edges{ 0 }; /* edges of a single face, their adjacent vertex stays -1 */
+	size_t no_non_manifold_edges{ 0 }; /* edges shared by more than two faces, paired by opposite direction where possible */
+	size_t no_degenerate_edges{ 0 }; /* edges with both end points at the same position */
+	double time{ 0.0 }; /* build time in seconds */
+};
+
+/* replacement of Mesh::BuildAdjacency, fills Face3i::adjacent_vertices of all patches with the position index of the vertex opposite to each edge
+in the neighbouring face, edges are matched in an open-addressing hash table keyed by the sorted position indices and partitioned across no_threads workers (0 - all cores) */
+int BuildAdjacencyParallel(Mesh& mesh, AdjacencyStatistics* statistics = nullptr, int no_threads = 0);
+
+/* appends one GL_LINES_ADJACENCY primitive (o1, a, b, o2) per unique edge of the GL_TRIANGLES_ADJACENCY indices, a -> b is the edge in the winding
+of the triangle (a, b, o1) and o2 is the vertex opposite to it in the neighbouring triangle (or the null vertex), returns the number of edges */
+size_t BuildEdgeList(const GLuint* indices, const size_t no_indices, const Vector3* positions, std::vector<GLuint>& edge_indices);
+
+#endif
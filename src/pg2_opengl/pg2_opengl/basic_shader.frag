@@ -7,12 +7,57 @@ in vec3 position_ws;
 in vec3 unified_normal_ws;
 in vec2 m_tex_coords;
 in vec3 view_from_ws;
-in vec3 m_color;
 flat in uint out_index_material;
 
+// material table, GpuMaterial on the CPU side
+struct Material
+{
+	vec3 diffuse;
+	float shininess;
+	vec3 specular;
+	float roughness;
+	vec3 emission;
+	float metallic;
+	vec3 ambient;
+	float ior;
+};
+
+layout ( std430, binding = 0 ) readonly buffer MaterialTable
+{
+	Material materials[];
+};
+
 // uniforms
-//uniform float amb_int;
+uniform float amb_int; // intensity of the ambient light
+uniform bool ambient_pass = false; // the emission and the ambient term only, added once per frame
 uniform vec3 light_position; 
+uniform float light_range; // radius of influence, infinity for an unbounded light
+uniform float light_intensity = 1.0f;
+
+// stencil of the layered shadow volumes, one layer per batched light
+layout ( binding = 9 ) uniform usampler2DMSArray shadow_masks;
+uniform int shadow_layer = -1; // layer of the light, -1 - unshadowed or masked by the stencil test
+uniform int no_mask_samples = 1;
+
+// z-fail counts of stencil_count.frag, one per pixel and batched light
+layout ( binding = 15 ) uniform isampler2DArray shadow_counts;
+uniform int count_lane = -1; // light of the counts, -1 - not counted
+uniform bool packed_counts = false; // 8 bit lanes in layer 0, the sum of all lanes in layer 1
+layout ( binding = 0, offset = 0 ) uniform atomic_uint no_count_overflows; // packed texels whose lanes carried, see Rasterizer::checkCountOverflows
+
+// all lights in one pass, the shadowed ones read their layer of the resolved shadow masks
+const int kMaxBatchedLights = 32;
+
+layout ( std140, binding = 1 ) uniform BatchedLights
+{
+	vec4 batched_positions[kMaxBatchedLights]; // xyz, w - range
+	vec4 batched_params[kMaxBatchedLights]; // x - intensity, y - mask slot or -1
+	int no_batched_lights;
+};
+
+layout ( binding = 13 ) uniform sampler2DArray light_masks; // lit fraction per pixel
+uniform bool batched = false;
+uniform bool receiver = true; // masks apply to shadow receivers only
 
 vec3 tone_mapping(vec3 color, float gamma, float exposure){
 	color *= exposure;
@@ -20,20 +65,83 @@ vec3 tone_mapping(vec3 color, float gamma, float exposure){
 	color = pow(color, vec3(1.0f / gamma));
 	return color;
 }
-void main( void ){	
-	vec3 omega_o = normalize((view_from_ws - position_ws));
-	vec3 omega_i = normalize(reflect( -omega_o, unified_normal_ws ));
-	float cos_theta_o = dot(omega_o, unified_normal_ws);
-	
+// lane of the packed counts, -1 (shadowed) and counted in no_count_overflows if a lane of the texel has carried into the next one
+int packed_count( ivec2 pixel, int lane ) {
+	int lanes = texelFetch( shadow_counts, ivec3( pixel, 0 ), 0 ).r;
+	int total = texelFetch( shadow_counts, ivec3( pixel, 1 ), 0 ).r;
+	if ( ( lanes & 0xFF ) + ( ( lanes >> 8 ) & 0xFF ) + ( ( lanes >> 16 ) & 0xFF ) + ( ( lanes >> 24 ) & 0xFF ) != total ) {
+		atomicCounterIncrement( no_count_overflows );
+		return -1;
+	}
+	return ( lanes >> ( 8 * lane ) ) & 0xFF;
+}
+
+// z-fail count of the light of count_lane at the pixel
+int shadow_count( ivec2 pixel ) {
+	if ( packed_counts ) {
+		return packed_count( pixel, count_lane );
+	}
+	return texelFetch( shadow_counts, ivec3( pixel, count_lane ), 0 ).r;
+}
+
+// fraction of the samples of the pixel outside of all volumes of the light
+float lit_fraction() {
+	if ( count_lane >= 0 ) {
+		return shadow_count( ivec2( gl_FragCoord.xy ) ) == 0 ? 1.0f : 0.0f;
+	}
+	if ( shadow_layer < 0 ) {
+		return 1.0f;
+	}
+
+	int no_lit = 0;
+	for ( int i = 0; i < no_mask_samples; ++i ) {
+		no_lit += texelFetch( shadow_masks, ivec3( gl_FragCoord.xy, shadow_layer ), i ).r == 0u ? 1 : 0;
+	}
+	return float( no_lit ) / float( no_mask_samples );
+}
+
+// diffuse and specular term of one light
+vec3 direct_light( const Material material, vec3 omega_o, vec3 light_position, float light_range ) {
 	// diffuse element
 	vec3 lightDir = normalize(light_position - position_ws);  
 	float diff = max(dot(unified_normal_ws, lightDir), 0.0);
 
 	// specular element
-	float specularStrength = 0.5;
 	vec3 reflectDir = reflect(-lightDir, unified_normal_ws);  
-	float spec = pow(max(dot(omega_o, reflectDir), 0.0), 32);
-	float specular = specularStrength * spec;  
+	float spec = pow(max(dot(omega_o, reflectDir), 0.0), max(material.shininess, 1.0f));
+	vec3 specular = material.specular * spec;  
+
+	// smooth window reaching zero at the range, so the scissor and depth bounds of the light cut off nothing lit
+	float d = length(light_position - position_ws) / light_range;
+	float window = pow(clamp(1.0f - pow(d, 4.0f), 0.0f, 1.0f), 2.0f);
+
+	return window * (diff * material.diffuse + specular);
+}
+
+void main( void ){	
+	const Material material = materials[out_index_material];
 
-	FragColor = vec4( (specular + diff) * m_color, 1.0f ); // amb_int
-}
\ No newline at end of file
+	vec3 omega_o = normalize((view_from_ws - position_ws));
+	vec3 omega_i = normalize(reflect( -omega_o, unified_normal_ws ));
+	float cos_theta_o = dot(omega_o, unified_normal_ws);
+
+	if ( ambient_pass ) {
+		FragColor = vec4( material.emission + amb_int * material.ambient * material.diffuse, 1.0f );
+		return;
+	}
+
+	vec3 color = vec3( 0.0f );
+
+	if ( batched ) {
+		for ( int i = 0; i < no_batched_lights; ++i ) {
+			int slot = int( batched_params[i].y );
+			float lit = receiver && slot >= 0 ? texelFetch( light_masks, ivec3( gl_FragCoord.xy, slot ), 0 ).r : 1.0f;
+			color += batched_params[i].x * lit * direct_light( material, omega_o, batched_positions[i].xyz, batched_positions[i].w );
+		}
+	}
+	else {
+		color += light_intensity * lit_fraction() * direct_light( material, omega_o, light_position, light_range );
+	}
+
+	FragColor = vec4( color, 1.0f );
+}
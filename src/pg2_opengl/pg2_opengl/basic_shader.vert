@@ -3,10 +3,8 @@
 // vertex attributes
 layout ( location = 0 ) in vec4 in_position_ms;
 layout ( location = 1 ) in vec3 in_normal_ms;
-layout ( location = 2 ) in vec3 in_tangent_ms;
 layout ( location = 3 ) in vec2 tex_coords;
-layout ( location = 4 ) in vec3 in_color;
-layout ( location = 5 ) in int index_material;
+layout ( location = 4 ) in int index_material;
 
 // uniform variables
 uniform mat4 MN; // Model normal matrix 
@@ -14,30 +12,42 @@ uniform mat4 MVP; // Model View Projection Matrix
 uniform vec3 view_from_position; // view position of camera
 uniform mat4 mlp;
 uniform mat4 M;
+uniform mat4 object_transform; // object to world space
+uniform mat4 normal_transform; // inverse transpose of object_transform, see Scene::UpdateNormalTransforms
+uniform bool compact_vertices; // normals arrive octahedral encoded in xy, see CompactVertexAttributes
 
 // output variables
 out vec3 unified_normal_ws;
 out vec3 position_ws;
 out vec2 m_tex_coords;
 out vec3 view_from_ws;
-out vec3 m_color;
 flat out uint out_index_material;
 
+vec3 oct_decode( vec2 e )
+{
+	vec3 v = vec3( e.xy, 1.0f - abs( e.x ) - abs( e.y ) );
+	float t = max( -v.z, 0.0f );
+	v.x += ( v.x >= 0.0f ) ? -t : t;
+	v.y += ( v.y >= 0.0f ) ? -t : t;
+	return normalize( v );
+}
+
 void main( void )
 {
+	vec3 normal_ms = compact_vertices ? oct_decode( in_normal_ms.xy ) : in_normal_ms;
+
 	// normal_ms to normal_ws
-	vec4 tmp_normal = MN * vec4( in_normal_ms.xyz, 1.0f );
+	vec4 tmp_normal = MN * vec4( mat3( normal_transform ) * normal_ms, 1.0f );
 	unified_normal_ws = normalize( tmp_normal.xyz / tmp_normal.w );
 
 	m_tex_coords = vec2( tex_coords.x, 1.0f - tex_coords.y);
 	
 	out_index_material = index_material;
 	view_from_ws = view_from_position;
-	m_color = in_color;
 
 	// position_ms to position_ws
-	vec4 tmp_position = M * vec4( in_position_ms.xyz, 1.0f );
+	vec4 tmp_position = M * object_transform * vec4( in_position_ms.xyz, 1.0f );
 	position_ws = tmp_position.xyz / tmp_position.w;
 
-	gl_Position = MVP * in_position_ms;
+	gl_Position = MVP * object_transform * in_position_ms;
 }
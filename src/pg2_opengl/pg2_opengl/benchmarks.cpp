@@ -0,0 +1,349 @@
+#include "pch.h"
+#include "benchmarks.h"
+#include "objloader.h"
+#include "objparser.h"
+#include "utils.h"
+#include "volume_culling.h"
+
+/* index of the first differing element of two attribute arrays, -1 if they are equal */
+static long long FirstMismatch(const std::vector<Vector3>& a, const std::vector<Vector3>& b)
+{
+	for (size_t i = 0; i < std::min(a.size(), b.size()); ++i)
+	{
+		if (a[i].x != b[i].x || a[i].y != b[i].y || a[i].z != b[i].z)
+		{
+			return (long long)(i);
+		}
+	}
+
+	return (a.size() == b.size()) ? -1 : (long long)(std::min(a.size(), b.size()));
+}
+
+/* compares materials, meshes, patches, index and vertex buffers of two scenes element by element, reports the first mismatch */
+static bool CompareScenes(SceneGraph& scene_a, MaterialLibrary& materials_a, SceneGraph& scene_b, MaterialLibrary& materials_b)
+{
+	if (scene_a.size() != scene_b.size() || materials_a.size() != materials_b.size())
+	{
+		printf("Scene mismatch: %zu/%zu nodes, %zu/%zu materials\n", scene_a.size(), scene_b.size(), materials_a.size(), materials_b.size());
+
+		return false;
+	}
+
+	for (auto iter_a = materials_a.begin(), iter_b = materials_b.begin(); iter_a != materials_a.end(); ++iter_a, ++iter_b)
+	{
+		if (iter_a->first != iter_b->first)
+		{
+			printf("Scene mismatch: material '%s' vs '%s'\n", iter_a->first.c_str(), iter_b->first.c_str());
+
+			return false;
+		}
+
+		Material& a = *iter_a->second;
+		Material& b = *iter_b->second;
+		const char* parameter = nullptr;
+
+		if (a.ambient_.data != b.ambient_.data) parameter = "ambient";
+		else if (a.emission_.data != b.emission_.data) parameter = "emission";
+		else if (a.attenuation_.data != b.attenuation_.data) parameter = "attenuation";
+		else if (a.shininess(nullptr) != b.shininess(nullptr)) parameter = "shininess";
+		else if (a.roughness_ != b.roughness_) parameter = "roughness";
+		else if (a.metallic_ != b.metallic_) parameter = "metallic";
+		else if (a.reflectivity != b.reflectivity) parameter = "reflectivity";
+		else if (a.ior != b.ior) parameter = "ior";
+		else if (a.shader() != b.shader()) parameter = "shader";
+
+		for (int map = 0; !parameter && map < int(Map::kMapsCount); ++map)
+		{
+			if (a.value(Map(map)).data != b.value(Map(map)).data) parameter = "map value";
+			else if (!a.texture(Map(map)) != !b.texture(Map(map))) parameter = "map texture";
+		}
+
+		if (parameter)
+		{
+			printf("Scene mismatch: material '%s', %s\n", iter_a->first.c_str(), parameter);
+
+			return false;
+		}
+	}
+
+	for (auto iter_a = scene_a.begin(), iter_b = scene_b.begin(); iter_a != scene_a.end(); ++iter_a, ++iter_b)
+	{
+		if (iter_a->first != iter_b->first)
+		{
+			printf("Scene mismatch: node '%s' vs '%s'\n", iter_a->first.c_str(), iter_b->first.c_str());
+
+			return false;
+		}
+
+		const auto mesh_a = std::static_pointer_cast<Mesh>(iter_a->second);
+		const auto mesh_b = std::static_pointer_cast<Mesh>(iter_b->second);
+
+		const VertexBuffer4f& buffer_a = mesh_a->vertex_buffer();
+		const VertexBuffer4f& buffer_b = mesh_b->vertex_buffer();
+
+		const std::pair<const char*, const std::vector<Vector3>*> attributes[] = {
+			{ "position", &buffer_a.positions }, { "texture coordinate", &buffer_a.texture_coords },
+			{ "normal", &buffer_a.normals }, { "tangent", &buffer_a.tangents } };
+		const std::vector<Vector3>* attributes_b[] = { &buffer_b.positions, &buffer_b.texture_coords, &buffer_b.normals, &buffer_b.tangents };
+
+		for (int k = 0; k < 4; ++k)
+		{
+			const long long mismatch = FirstMismatch(*attributes[k].second, *attributes_b[k]);
+
+			if (mismatch >= 0)
+			{
+				printf("Scene mismatch: mesh '%s', %s %lld of %zu/%zu\n", iter_a->first.c_str(), attributes[k].first, mismatch,
+					attributes[k].second->size(), attributes_b[k]->size());
+
+				return false;
+			}
+		}
+
+		// patches are keyed by material pointers, compare them by material name instead
+		std::map<std::string, const Patch*> patches_a, patches_b;
+
+		for (auto& patch : mesh_a->patches()) patches_a[patch.first->name()] = &patch.second;
+		for (auto& patch : mesh_b->patches()) patches_b[patch.first->name()] = &patch.second;
+
+		if (patches_a.size() != patches_b.size())
+		{
+			printf("Scene mismatch: mesh '%s' has %zu/%zu patches\n", iter_a->first.c_str(), patches_a.size(), patches_b.size());
+
+			return false;
+		}
+
+		for (auto patch_a = patches_a.begin(), patch_b = patches_b.begin(); patch_a != patches_a.end(); ++patch_a, ++patch_b)
+		{
+			if (patch_a->first != patch_b->first || patch_a->second->size() != patch_b->second->size())
+			{
+				printf("Scene mismatch: mesh '%s', material '%s' vs '%s', %zu/%zu faces\n", iter_a->first.c_str(), patch_a->first.c_str(),
+					patch_b->first.c_str(), patch_a->second->size(), patch_b->second->size());
+
+				return false;
+			}
+
+			for (size_t f = 0; f < patch_a->second->size(); ++f)
+			{
+				const Face3i& face_a = (*patch_a->second)[f];
+				const Face3i& face_b = (*patch_b->second)[f];
+
+				for (int i = 0; i < 3; ++i)
+				{
+					const Vertex3i& a = face_a.vertices[i];
+					const Vertex3i& b = face_b.vertices[i];
+
+					if (a.position_index != b.position_index || a.texture_coord_index != b.texture_coord_index || a.normal_index != b.normal_index ||
+						face_a.adjacent_vertices[i] != face_b.adjacent_vertices[i])
+					{
+						printf("Scene mismatch: mesh '%s', material '%s', face %zu, vertex %d: indices %d/%d/%d vs %d/%d/%d, adjacent %d vs %d\n",
+							iter_a->first.c_str(), patch_a->first.c_str(), f, i, a.position_index, a.texture_coord_index, a.normal_index,
+							b.position_index, b.texture_coord_index, b.normal_index, face_a.adjacent_vertices[i], face_b.adjacent_vertices[i]);
+
+						return false;
+					}
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+int benchmark_obj_loader(const std::string& file_name, const int no_repetitions)
+{
+	const double file_size = GetFileSize64(file_name.c_str()) / (1024.0 * 1024.0);
+
+	if (file_size <= 0.0)
+	{
+		printf("IO error: File '%s' not found.\n", file_name.c_str());
+
+		return S_FALSE;
+	}
+
+	// reference
+	SceneGraph reference_scene;
+	MaterialLibrary reference_materials;
+
+	auto t0 = std::chrono::high_resolution_clock::now();
+	LoadOBJ(file_name, reference_scene, reference_materials, false);
+	auto t1 = std::chrono::high_resolution_clock::now();
+	const double reference_time = std::chrono::duration<double>(t1 - t0).count();
+
+	printf("\nLoadOBJ: %.3f s, %.1f MB/s\n\n", reference_time, file_size / reference_time);
+	printf("threads\ttime [s]\tMB/s\tspeedup\tidentical\n");
+
+	const int max_threads = std::max(1, int(std::thread::hardware_concurrency()));
+
+	for (int no_threads = 1; ; no_threads = std::min(no_threads * 2, max_threads))
+	{
+		double best_time = std::numeric_limits<double>::max();
+		bool identical = true;
+
+		for (int i = 0; i < no_repetitions; ++i)
+		{
+			SceneGraph scene;
+			MaterialLibrary materials;
+
+			t0 = std::chrono::high_resolution_clock::now();
+			LoadOBJParallel(file_name, scene, materials, false, no_threads);
+			t1 = std::chrono::high_resolution_clock::now();
+			best_time = std::min(best_time, std::chrono::duration<double>(t1 - t0).count());
+
+			if (i == 0)
+			{
+				identical = CompareScenes(scene, materials, reference_scene, reference_materials);
+			}
+		}
+
+		printf("%d\t%.3f\t\t%.1f\t%.2fx\t%s\n", no_threads, best_time, file_size / best_time, reference_time / best_time, identical ? "yes" : "NO");
+
+		if (no_threads == max_threads)
+		{
+			break;
+		}
+	}
+
+	return S_OK;
+}
+/* loads every file with LoadOBJ and LoadOBJParallel, returns S_FALSE if any of the scenes differ */
+int compare_obj_loaders(const std::vector<std::string>& file_names)
+{
+	int result = S_OK;
+
+	for (const std::string& file_name : file_names)
+	{
+		SceneGraph reference_scene, scene;
+		MaterialLibrary reference_materials, materials;
+
+		if (LoadOBJ(file_name, reference_scene, reference_materials, false) != S_OK ||
+			LoadOBJParallel(file_name, scene, materials, false) != S_OK)
+		{
+			result = S_FALSE;
+
+			continue;
+		}
+
+		const bool identical = CompareScenes(scene, materials, reference_scene, reference_materials);
+
+		printf("%s: %s\n", file_name.c_str(), identical ? "identical" : "DIFFERENT");
+		if (!identical)
+		{
+			result = S_FALSE;
+		}
+	}
+
+	return result;
+}
+/* true if a point sampled on the sphere or on its extrusion away from the light lies inside of all planes, i.e. the sphere must not be culled,
+the points are sampled in double precision and count only when clearly inside so that rounding of the tested function does not matter */
+static bool SampledVisible(const float planes[4][4], const Vector3& light_position, const double center[3], const double radius)
+{
+	const int no_directions = 64;
+	const double extrusions[] = { 0.0, 0.25, 0.5, 1.0, 2.0, 4.0, 8.0, 16.0, 64.0, 256.0, 4096.0 };
+	const double golden_angle = M_PI * (3.0 - sqrt(5.0));
+
+	auto inside = [&planes](const double q[3], const double w) {
+		// w = 1 for a point, w = 0 for a direction, i.e. the point at infinity
+		const double scale = sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2]) + w;
+
+		for (int p = 0; p < 4; ++p)
+		{
+			if (planes[p][0] * q[0] + planes[p][1] * q[1] + planes[p][2] * q[2] + planes[p][3] * w < 1e-5 * scale)
+			{
+				return false;
+			}
+		}
+		return true;
+	};
+
+	// the center and a Fibonacci spiral of points on the surface
+	for (int i = -1; i < no_directions; ++i)
+	{
+		double p[3] = { center[0], center[1], center[2] };
+
+		if (i >= 0)
+		{
+			const double z = 1.0 - (2.0 * i + 1.0) / no_directions;
+			const double r = sqrt(1.0 - z * z);
+			p[0] += radius * r * cos(golden_angle * i);
+			p[1] += radius * r * sin(golden_angle * i);
+			p[2] += radius * z;
+		}
+
+		const double direction[3] = { p[0] - light_position.x, p[1] - light_position.y, p[2] - light_position.z };
+
+		for (const double t : extrusions)
+		{
+			const double q[3] = { p[0] + t * direction[0], p[1] + t * direction[1], p[2] + t * direction[2] };
+
+			if (inside(q, 1.0))
+			{
+				return true;
+			}
+		}
+
+		if (inside(direction, 0.0))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* random spheres around a view down -z with a 90 degree field of view, CullExtrudedSpheres must never cull a sphere that a point sampled on it or
+on its extrusion proves visible */
+int benchmark_volume_culling(const size_t no_spheres, const int no_repetitions)
+{
+	std::mt19937 generator(12345);
+	std::uniform_real_distribution<float> coordinate(-100.0f, 100.0f);
+	std::uniform_real_distribution<float> radius(0.1f, 5.0f);
+
+	SphereBatch spheres;
+	spheres.Resize(no_spheres);
+
+	for (size_t i = 0; i < no_spheres; ++i)
+	{
+		spheres.x[i] = coordinate(generator);
+		spheres.y[i] = coordinate(generator);
+		spheres.z[i] = coordinate(generator);
+		spheres.r[i] = radius(generator);
+	}
+
+	// left, right, bottom and top side of the view, normalized as ExtractSidePlanes leaves them
+	const float s = 1.0f / sqrtf(2.0f);
+	const float planes[4][4] = { { s, 0.0f, -s, 0.0f }, { -s, 0.0f, -s, 0.0f }, { 0.0f, s, -s, 0.0f }, { 0.0f, -s, -s, 0.0f } };
+	const Vector3 light_position(30.0f, 80.0f, 20.0f);
+
+	std::vector<uint8_t> visible(no_spheres);
+	double best_time = std::numeric_limits<double>::max();
+
+	for (int i = 0; i < no_repetitions; ++i)
+	{
+		const auto t0 = std::chrono::high_resolution_clock::now();
+		CullExtrudedSpheres(planes, light_position, spheres, visible.data());
+		const auto t1 = std::chrono::high_resolution_clock::now();
+		best_time = std::min(best_time, std::chrono::duration<double, std::milli>(t1 - t0).count());
+	}
+
+	// reference, culling a sphere with a sampled point inside of the view is an error, keeping one without is only a missed opportunity
+	size_t no_culled = 0;
+	size_t no_wrongly_culled = 0;
+	size_t no_kept_unseen = 0;
+
+	for (size_t i = 0; i < no_spheres; ++i)
+	{
+		const double center[3] = { spheres.x[i], spheres.y[i], spheres.z[i] };
+		const bool sampled_visible = SampledVisible(planes, light_position, center, spheres.r[i]);
+
+		no_culled += visible[i] ? 0 : 1;
+		no_wrongly_culled += (!visible[i] && sampled_visible) ? 1 : 0;
+		no_kept_unseen += (visible[i] && !sampled_visible) ? 1 : 0;
+	}
+
+	printf("CullExtrudedSpheres: %zu spheres in %.4f ms (best of %d, %s 1 ms), %zu culled\n",
+		no_spheres, best_time, no_repetitions, best_time < 1.0 ? "under" : "OVER", no_culled);
+	printf("Sampled reference: %zu culled although visible, %zu kept without a visible sample\n", no_wrongly_culled, no_kept_unseen);
+
+	return no_wrongly_culled == 0 ? S_OK : S_FALSE;
+}
@@ -0,0 +1,13 @@
+#ifndef BENCHMARKS_H_
+#define BENCHMARKS_H_
+
+/* parses the OBJ file with LoadOBJParallel for 1, 2, 4, ... threads, prints throughput in MB/s and checks the scene against LoadOBJ */
+int benchmark_obj_loader( const std::string & file_name, const int no_repetitions = 3 );
+
+/* loads each file with LoadOBJ and LoadOBJParallel and checks that both give the same meshes, S_FALSE on any difference */
+int compare_obj_loaders( const std::vector<std::string> & file_names );
+
+/* times CullExtrudedSpheres on random spheres and checks it against the scalar plane test, S_FALSE on any difference */
+int benchmark_volume_culling( const size_t no_spheres = 10000, const int no_repetitions = 100 );
+
+#endif
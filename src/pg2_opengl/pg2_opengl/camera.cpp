@@ -30,6 +30,25 @@ Vector3 Camera::getViewFrom() {
 	return view_from_;
 }
 
+void Camera::getNearPlaneCorners(Vector3* corners) {
+	// the same basis as in buildViewMatrix
+	Vector3 z_e = view_from_ - view_at_;
+	z_e.Normalize();
+	Vector3 x_e = up_.CrossProduct(z_e);
+	x_e.Normalize();
+	Vector3 y_e = z_e.CrossProduct(x_e);
+	y_e.Normalize();
+
+	const float half_h = n * tanf(fov_y_ / 2.0f);
+	const float half_w = half_h * (float)width_ / (float)height_;
+	const Vector3 center = view_from_ - z_e * n;
+
+	corners[0] = center - x_e * half_w - y_e * half_h;
+	corners[1] = center + x_e * half_w - y_e * half_h;
+	corners[2] = center + x_e * half_w + y_e * half_h;
+	corners[3] = center - x_e * half_w + y_e * half_h;
+}
+
 Matrix4x4 Camera::buildMVP(Matrix4x4 M, Matrix4x4 P) {
 	return P * V * M; 
 }
@@ -22,6 +22,7 @@ public:
 	Matrix4x4 buildMVP(Matrix4x4 M, Matrix4x4 P);
 	Matrix4x4 buildMN(Matrix4x4 M);
 	Vector3 getViewFrom();
+	void getNearPlaneCorners(Vector3* corners); // world space, counter-clockwise from the bottom left
 
 	void Inputs(GLFWwindow* window);
 	void moveCameraAngle(float yaw, float pitch);
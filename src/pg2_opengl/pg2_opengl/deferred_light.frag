@@ -0,0 +1,159 @@
+#version 460 core
+
+layout ( location = 0 ) out vec4 FragColor;
+
+// G-buffer of gbuffer.frag, read per sample so that the stencil and the edges keep their samples
+layout ( binding = 10 ) uniform sampler2DMS gbuffer_normals;
+layout ( binding = 11 ) uniform usampler2DMS gbuffer_materials;
+layout ( binding = 12 ) uniform sampler2DMS gbuffer_depths;
+
+// stencil of the layered shadow volumes, one layer per batched light
+layout ( binding = 9 ) uniform usampler2DMSArray shadow_masks;
+
+// z-fail counts of stencil_count.frag, one per pixel and batched light
+layout ( binding = 15 ) uniform isampler2DArray shadow_counts;
+uniform int count_lane = -1; // light of the counts, -1 - not counted
+uniform bool packed_counts = false; // 8 bit lanes in layer 0, the sum of all lanes in layer 1
+layout ( binding = 0, offset = 0 ) uniform atomic_uint no_count_overflows; // packed texels whose lanes carried, see Rasterizer::checkCountOverflows
+
+// material table, GpuMaterial on the CPU side
+struct Material
+{
+	vec3 diffuse;
+	float shininess;
+	vec3 specular;
+	float roughness;
+	vec3 emission;
+	float metallic;
+	vec3 ambient;
+	float ior;
+};
+
+layout ( std430, binding = 0 ) readonly buffer MaterialTable
+{
+	Material materials[];
+};
+
+const uint kReceiverBit = 0x80000000u;
+
+// uniforms
+uniform mat4 clip_to_world; // M * inverse(MVP)
+uniform vec2 viewport_size;
+uniform vec3 view_from_position;
+uniform vec3 light_position; 
+uniform float light_range; // radius of influence, infinity for an unbounded light
+uniform float light_intensity = 1.0f;
+uniform float amb_int; // intensity of the ambient light
+uniform bool ambient_pass = false; // the emission and the ambient term only, added once per frame
+uniform int shadow_layer = -1; // layer of the light, -1 - unshadowed or masked by the stencil test
+uniform int receiver_filter = -1; // 1 - receivers only, 0 - the other objects only, -1 - both
+
+// all lights in one pass, the shadowed ones read their layer of the resolved shadow masks
+const int kMaxBatchedLights = 32;
+
+layout ( std140, binding = 1 ) uniform BatchedLights
+{
+	vec4 batched_positions[kMaxBatchedLights]; // xyz, w - range
+	vec4 batched_params[kMaxBatchedLights]; // x - intensity, y - mask slot or -1
+	int no_batched_lights;
+};
+
+layout ( binding = 13 ) uniform sampler2DArray light_masks; // lit fraction per pixel
+uniform bool batched = false;
+
+vec3 position_ws;
+vec3 unified_normal_ws;
+
+// lane of the packed counts, -1 (shadowed) and counted in no_count_overflows if a lane of the texel has carried into the next one
+int packed_count( ivec2 pixel, int lane ) {
+	int lanes = texelFetch( shadow_counts, ivec3( pixel, 0 ), 0 ).r;
+	int total = texelFetch( shadow_counts, ivec3( pixel, 1 ), 0 ).r;
+	if ( ( lanes & 0xFF ) + ( ( lanes >> 8 ) & 0xFF ) + ( ( lanes >> 16 ) & 0xFF ) + ( ( lanes >> 24 ) & 0xFF ) != total ) {
+		atomicCounterIncrement( no_count_overflows );
+		return -1;
+	}
+	return ( lanes >> ( 8 * lane ) ) & 0xFF;
+}
+
+// z-fail count of the light of count_lane at the pixel
+int shadow_count( ivec2 pixel ) {
+	if ( packed_counts ) {
+		return packed_count( pixel, count_lane );
+	}
+	return texelFetch( shadow_counts, ivec3( pixel, count_lane ), 0 ).r;
+}
+
+// normal of the G-buffer, the inverse of oct_encode of gbuffer.frag
+vec3 oct_decode( vec2 e )
+{
+	vec3 v = vec3( e.xy, 1.0f - abs( e.x ) - abs( e.y ) );
+	float t = max( -v.z, 0.0f );
+	v.x += ( v.x >= 0.0f ) ? -t : t;
+	v.y += ( v.y >= 0.0f ) ? -t : t;
+	return normalize( v );
+}
+
+// diffuse and specular term of one light, the same as in basic_shader.frag
+vec3 direct_light( const Material material, vec3 omega_o, vec3 light_position, float light_range ) {
+	// diffuse element
+	vec3 lightDir = normalize( light_position - position_ws );  
+	float diff = max( dot( unified_normal_ws, lightDir ), 0.0 );
+
+	// specular element
+	vec3 reflectDir = reflect( -lightDir, unified_normal_ws );  
+	float spec = pow( max( dot( omega_o, reflectDir ), 0.0 ), max( material.shininess, 1.0f ) );
+	vec3 specular = material.specular * spec;  
+
+	// smooth window reaching zero at the range
+	float d = length( light_position - position_ws ) / light_range;
+	float window = pow( clamp( 1.0f - pow( d, 4.0f ), 0.0f, 1.0f ), 2.0f );
+
+	return window * ( diff * material.diffuse + specular );
+}
+
+void main( void ){
+	const ivec2 pixel = ivec2( gl_FragCoord.xy );
+	const float depth = texelFetch( gbuffer_depths, pixel, gl_SampleID ).r;
+	const uint id = texelFetch( gbuffer_materials, pixel, gl_SampleID ).r;
+
+	if ( depth >= 1.0f || ( receiver_filter >= 0 && ( ( id & kReceiverBit ) != 0u ) != ( receiver_filter == 1 ) ) ) {
+		discard;
+	}
+
+	const Material material = materials[id & ~kReceiverBit];
+	unified_normal_ws = oct_decode( texelFetch( gbuffer_normals, pixel, gl_SampleID ).xy );
+
+	// the depth has been written at the pixel center
+	vec4 position = clip_to_world * vec4( ( floor( gl_FragCoord.xy ) + 0.5f ) / viewport_size * 2.0f - 1.0f, depth * 2.0f - 1.0f, 1.0f );
+	position_ws = position.xyz / position.w;
+
+	if ( ambient_pass ) {
+		FragColor = vec4( material.emission + amb_int * material.ambient * material.diffuse, 1.0f );
+		return;
+	}
+
+	vec3 omega_o = normalize( view_from_position - position_ws );
+	vec3 color = vec3( 0.0f );
+
+	if ( batched ) {
+		const bool receiver = ( id & kReceiverBit ) != 0u;
+
+		for ( int i = 0; i < no_batched_lights; ++i ) {
+			int slot = int( batched_params[i].y );
+			float lit = receiver && slot >= 0 ? texelFetch( light_masks, ivec3( pixel, slot ), 0 ).r : 1.0f;
+			color += batched_params[i].x * lit * direct_light( material, omega_o, batched_positions[i].xyz, batched_positions[i].w );
+		}
+	}
+	else {
+		float lit = 1.0f;
+		if ( shadow_layer >= 0 ) {
+			lit = texelFetch( shadow_masks, ivec3( pixel, shadow_layer ), gl_SampleID ).r == 0u ? 1.0f : 0.0f;
+		}
+		else if ( count_lane >= 0 ) {
+			lit = shadow_count( pixel ) == 0 ? 1.0f : 0.0f; // one count per pixel
+		}
+		color += light_intensity * lit * direct_light( material, omega_o, light_position, light_range );
+	}
+
+	FragColor = vec4( color, 1.0f );
+}
@@ -0,0 +1,29 @@
+#version 460 core
+
+// G-buffer of the deferred path, every sample covered by the fragment gets its values
+layout ( location = 0 ) out vec2 normal_out; // unified_normal_ws as interpolated by basic_shader.vert, octahedral encoded
+layout ( location = 1 ) out uint material_out; // index into the material table | kReceiverBit
+layout ( location = 2 ) out float depth_out; // window depth, the position is reconstructed from it
+
+// inputs
+in vec3 unified_normal_ws;
+flat in uint out_index_material;
+
+// uniforms
+uniform bool receiver; // the object receives shadows
+
+// octahedral encoding of EncodeOctahedral, decoded in deferred_light.frag
+vec2 oct_encode( vec3 v )
+{
+	vec2 e = v.xy / ( abs( v.x ) + abs( v.y ) + abs( v.z ) );
+	if ( v.z < 0.0f ) { // fold the lower hemisphere over the diagonals
+		e = ( 1.0f - abs( e.yx ) ) * vec2( ( e.x >= 0.0f ) ? 1.0f : -1.0f, ( e.y >= 0.0f ) ? 1.0f : -1.0f );
+	}
+	return e;
+}
+
+void main( void ){
+	normal_out = oct_encode( normalize( unified_normal_ws ) );
+	material_out = out_index_material | ( receiver ? 0x80000000u : 0u );
+	depth_out = gl_FragCoord.z;
+}
@@ -16,7 +16,7 @@ void SetInt( const GLuint program, GLint value, const char * int_name )
 	}
 }
 
-void SetFloat(const GLuint program, GLint value, const char* float_name)
+void SetFloat(const GLuint program, GLfloat value, const char* float_name)
 {
 	const GLint location = glGetUniformLocation(program, float_name);
 
@@ -72,6 +72,20 @@ void SetVector3( const GLuint program, const GLfloat * data, const char * vector
 	}
 }
 
+void SetVector4( const GLuint program, const GLfloat * data, const char * vector_name )
+{
+	const GLint location = glGetUniformLocation( program, vector_name );
+
+	if ( location == -1 )
+	{
+		printf( "Vector '%s' not found in active shader.\n", vector_name );
+	}
+	else
+	{
+		glUniform4fv( location, 1, data );
+	}
+}
+
 void SetVector2( const GLuint program, const GLfloat * data, const char * vector_name )
 {
 	const GLint location = glGetUniformLocation( program, vector_name );
@@ -3,11 +3,12 @@
 
 const float PI = 3.14159265359f;
 
-Light::Light(const Vector3 l_position, const float l_intensity, const bool l_move)
+Light::Light(const Vector3 l_position, const float l_intensity, const bool l_move, const float l_range)
 {
 	position = l_position;
 	intensity = l_intensity;
 	move = l_move;
+	range = l_range;
 }
 void Light::Update(float counter) {
 
@@ -12,12 +12,13 @@ class Light
 public:
 	Light() { }
 
-	Light(const Vector3 l_position, const float l_intensity, const bool l_move = true);
+	Light(const Vector3 l_position, const float l_intensity, const bool l_move = true, const float l_range = std::numeric_limits<float>::infinity());
 
 	void Update(float counter);
 
 	Vector3 position;
 	float intensity;
+	float range{ std::numeric_limits<float>::infinity() }; // radius of influence, nothing further away is lit (infinity - unbounded)
 
 private:
 	float radius{ 100.0f };
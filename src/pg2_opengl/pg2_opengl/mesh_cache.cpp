@@ -0,0 +1,483 @@
+#include "pch.h"
+#include "mesh_cache.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* bump whenever the layout of the file or of the stored records changes */
+static const uint32_t kMeshCacheVersion = 5;
+static const char kMeshCacheMagic[8] = { 'S', 'V', 'C', 'A', 'C', 'H', 'E', '\0' };
+
+struct MeshCacheHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t position_size; // sizeof of the stored records, a change of the vertex layout invalidates the cache
+	uint32_t attribute_size;
+	uint32_t no_dependencies;
+	uint64_t no_vertices;
+	uint64_t no_indices;
+	uint64_t no_edge_indices;
+	uint64_t no_materials;
+	uint64_t no_objects;
+	uint64_t dependencies_offset;
+	uint64_t materials_offset;
+	uint64_t objects_offset;
+	uint64_t positions_offset;
+	uint64_t attributes_offset;
+	uint64_t indices_offset;
+	uint64_t edge_indices_offset;
+	uint64_t face_normals_offset; // no_indices / 6 records
+	uint64_t file_size; // guards against truncated files
+};
+
+/* source file the cache was built from */
+struct MeshCacheDependency
+{
+	char file_name[256]; // relative to the directory of the OBJ file, so the cache does not depend on the working directory
+	uint64_t size;
+	int64_t time; // last write time in ticks of the filesystem clock
+	uint64_t hash; // FNV-1a of the content, checked only when the time differs
+};
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+int MappedFile::Open(const std::string& file_name)
+{
+	Close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(file_name.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return S_FALSE;
+	}
+
+	LARGE_INTEGER size;
+
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+	{
+		CloseHandle(file);
+
+		return S_FALSE;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+	if (!mapping)
+	{
+		CloseHandle(file);
+
+		return S_FALSE;
+	}
+
+	data_ = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+
+	if (!data_)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+
+		return S_FALSE;
+	}
+
+	file_ = file;
+	mapping_ = mapping;
+	size_ = size_t(size.QuadPart);
+#else
+	const int file = open(file_name.c_str(), O_RDONLY);
+
+	if (file < 0)
+	{
+		return S_FALSE;
+	}
+
+	struct stat info;
+
+	if (fstat(file, &info) != 0 || info.st_size == 0)
+	{
+		close(file);
+
+		return S_FALSE;
+	}
+
+	void* data = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+
+	if (data == MAP_FAILED)
+	{
+		close(file);
+
+		return S_FALSE;
+	}
+
+	file_ = file;
+	data_ = static_cast<const char*>(data);
+	size_ = size_t(info.st_size);
+#endif
+
+	return S_OK;
+}
+
+void MappedFile::Close()
+{
+#ifdef _WIN32
+	if (data_)
+	{
+		UnmapViewOfFile(data_);
+	}
+	if (mapping_)
+	{
+		CloseHandle(mapping_);
+		mapping_ = nullptr;
+	}
+	if (file_)
+	{
+		CloseHandle(file_);
+		file_ = nullptr;
+	}
+#else
+	if (data_)
+	{
+		munmap(const_cast<char*>(data_), size_);
+	}
+	if (file_ >= 0)
+	{
+		close(file_);
+		file_ = -1;
+	}
+#endif
+	data_ = nullptr;
+	size_ = 0;
+}
+
+static uint64_t HashFNV1a(const char* data, const size_t size)
+{
+	uint64_t hash = 14695981039346656037ull;
+
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= uint8_t(data[i]);
+		hash *= 1099511628211ull;
+	}
+
+	return hash;
+}
+
+/* directory the dependencies of the cache of the OBJ file are stored relative to */
+static std::filesystem::path DependencyDirectory(const std::string& file_name)
+{
+	std::error_code error;
+	const std::filesystem::path directory = std::filesystem::weakly_canonical(std::filesystem::absolute(file_name, error), error).parent_path();
+
+	return error ? std::filesystem::path(file_name).parent_path() : directory;
+}
+
+/* file_name as stored in the cache, relative to directory or absolute if it lies on another root */
+static std::string DependencyName(const std::string& file_name, const std::filesystem::path& directory)
+{
+	std::error_code error;
+	const std::filesystem::path path = std::filesystem::weakly_canonical(std::filesystem::absolute(file_name, error), error);
+	const std::filesystem::path relative = path.lexically_relative(directory);
+
+	return (error ? std::filesystem::path(file_name) : (relative.empty() ? path : relative)).generic_string();
+}
+
+/* size, time and optionally hash of the file at path, stored under file_name */
+static int GetDependency(const std::filesystem::path& path, const std::string& file_name, MeshCacheDependency& dependency, const bool hash)
+{
+	std::error_code error;
+
+	memset(&dependency, 0, sizeof(dependency));
+	strncpy(dependency.file_name, file_name.c_str(), sizeof(dependency.file_name) - 1);
+
+	dependency.size = uint64_t(std::filesystem::file_size(path, error));
+	if (error)
+	{
+		return S_FALSE;
+	}
+
+	dependency.time = int64_t(std::filesystem::last_write_time(path, error).time_since_epoch().count());
+	if (error)
+	{
+		return S_FALSE;
+	}
+
+	if (hash)
+	{
+		MappedFile file;
+
+		if (file.Open(path.string()) != S_OK)
+		{
+			return S_FALSE;
+		}
+		dependency.hash = HashFNV1a(file.data(), file.size());
+	}
+
+	return S_OK;
+}
+
+/* a touched but unchanged source (e.g. after a checkout) only costs one hash */
+static bool IsUpToDate(const MeshCacheDependency& dependency, const std::filesystem::path& directory)
+{
+	const std::filesystem::path path = directory / std::filesystem::path(dependency.file_name); // an absolute name replaces the directory
+	MeshCacheDependency current;
+
+	if (GetDependency(path, dependency.file_name, current, false) != S_OK || current.size != dependency.size)
+	{
+		return false;
+	}
+
+	if (current.time == dependency.time)
+	{
+		return true;
+	}
+
+	return GetDependency(path, dependency.file_name, current, true) == S_OK && current.hash == dependency.hash;
+}
+
+static uint64_t Align(const uint64_t offset)
+{
+	return (offset + 15) & ~uint64_t(15);
+}
+
+/* count records of stride bytes at offset lie within the file, aligned as written by SaveMeshCache and without overflowing the arithmetic */
+static bool IsInFile(const uint64_t offset, const uint64_t count, const uint64_t stride, const size_t file_size)
+{
+	return offset % 16 == 0 && offset <= file_size && count <= (file_size - offset) / stride;
+}
+
+/* the names of the records are read as C strings */
+static bool IsTerminated(const char* name, const size_t size)
+{
+	return memchr(name, '\0', size) != nullptr;
+}
+
+std::string MeshCacheFileName(const std::string& file_name)
+{
+	return file_name + ".svcache";
+}
+
+int LoadMeshCache(const std::string& file_name, const size_t attribute_size, MeshCache& cache)
+{
+	const std::string cache_file_name = MeshCacheFileName(file_name);
+
+	if (cache.file.Open(cache_file_name) != S_OK)
+	{
+		return S_FALSE;
+	}
+
+	const char* data = cache.file.data();
+	const MeshCacheHeader& header = *reinterpret_cast<const MeshCacheHeader*>(data);
+
+	const bool valid = cache.file.size() >= sizeof(MeshCacheHeader) && memcmp(header.magic, kMeshCacheMagic, sizeof(kMeshCacheMagic)) == 0 &&
+		header.version == kMeshCacheVersion && header.position_size == sizeof(Vector3) && header.attribute_size == attribute_size &&
+		header.file_size == cache.file.size();
+
+	if (!valid)
+	{
+		printf("Mesh cache '%s' is of another version or vertex layout, rebuilding.\n", cache_file_name.c_str());
+		cache.file.Close();
+
+		return S_FALSE;
+	}
+
+	// a corrupt header or truncated sections must not send the views out of the mapping
+	const size_t file_size = cache.file.size();
+	bool consistent = IsInFile(header.dependencies_offset, header.no_dependencies, sizeof(MeshCacheDependency), file_size) &&
+		IsInFile(header.materials_offset, header.no_materials, sizeof(MeshCacheMaterial), file_size) &&
+		IsInFile(header.objects_offset, header.no_objects, sizeof(MeshCacheObject), file_size) &&
+		IsInFile(header.positions_offset, header.no_vertices, sizeof(Vector3), file_size) &&
+		IsInFile(header.attributes_offset, header.no_vertices, attribute_size, file_size) &&
+		IsInFile(header.indices_offset, header.no_indices, sizeof(GLuint), file_size) &&
+		IsInFile(header.edge_indices_offset, header.no_edge_indices, sizeof(GLuint), file_size) &&
+		IsInFile(header.face_normals_offset, header.no_indices / 6, sizeof(Vector3), file_size) &&
+		header.no_indices % 6 == 0 && header.no_edge_indices % 4 == 0;
+
+	const MeshCacheDependency* dependencies = reinterpret_cast<const MeshCacheDependency*>(data + header.dependencies_offset);
+	const MeshCacheMaterial* materials = reinterpret_cast<const MeshCacheMaterial*>(data + header.materials_offset);
+	const MeshCacheObject* objects = reinterpret_cast<const MeshCacheObject*>(data + header.objects_offset);
+
+	for (uint64_t i = 0; consistent && i < header.no_dependencies; ++i)
+	{
+		consistent = IsTerminated(dependencies[i].file_name, sizeof(dependencies[i].file_name));
+	}
+	for (uint64_t i = 0; consistent && i < header.no_materials; ++i)
+	{
+		consistent = IsTerminated(materials[i].name, sizeof(materials[i].name));
+	}
+	for (uint64_t i = 0; consistent && i < header.no_objects; ++i)
+	{
+		consistent = IsTerminated(objects[i].name, sizeof(objects[i].name)) && objects[i].first_index <= header.no_indices &&
+			objects[i].no_indices <= header.no_indices - objects[i].first_index && objects[i].first_edge_index <= header.no_edge_indices &&
+			objects[i].no_edge_indices <= header.no_edge_indices - objects[i].first_edge_index;
+	}
+
+	if (!consistent)
+	{
+		printf("Mesh cache '%s' is corrupt, rebuilding.\n", cache_file_name.c_str());
+		cache.file.Close();
+
+		return S_FALSE;
+	}
+
+	const std::filesystem::path directory = DependencyDirectory(file_name);
+
+	for (uint32_t i = 0; i < header.no_dependencies; ++i)
+	{
+		if (!IsUpToDate(dependencies[i], directory))
+		{
+			printf("Mesh cache '%s' is out of date (%s changed), rebuilding.\n", cache_file_name.c_str(), dependencies[i].file_name);
+			cache.file.Close();
+
+			return S_FALSE;
+		}
+	}
+
+	cache.positions = reinterpret_cast<const Vector3*>(data + header.positions_offset);
+	cache.attributes = data + header.attributes_offset;
+	cache.no_vertices = size_t(header.no_vertices);
+	cache.indices = reinterpret_cast<const GLuint*>(data + header.indices_offset);
+	cache.no_indices = size_t(header.no_indices);
+	cache.edge_indices = reinterpret_cast<const GLuint*>(data + header.edge_indices_offset);
+	cache.no_edge_indices = size_t(header.no_edge_indices);
+	cache.face_normals = reinterpret_cast<const Vector3*>(data + header.face_normals_offset);
+	cache.materials = materials;
+	cache.no_materials = size_t(header.no_materials);
+	cache.objects = objects;
+	cache.no_objects = size_t(header.no_objects);
+
+	return S_OK;
+}
+
+int SaveMeshCache(const std::string& file_name, const std::vector<std::string>& material_libraries,
+	const Vector3* positions, const void* attributes, const size_t attribute_size, const size_t no_vertices,
+	const GLuint* indices, const size_t no_indices, const GLuint* edge_indices, const size_t no_edge_indices, const Vector3* face_normals,
+	const MaterialLibrary& materials, const std::vector<MeshCacheObject>& objects)
+{
+	const std::filesystem::path directory = DependencyDirectory(file_name);
+	std::vector<MeshCacheDependency> dependencies(1 + material_libraries.size());
+
+	for (size_t i = 0; i < dependencies.size(); ++i)
+	{
+		const std::string& dependency = (i == 0) ? file_name : material_libraries[i - 1];
+
+		if (GetDependency(dependency, DependencyName(dependency, directory), dependencies[i], true) != S_OK)
+		{
+			return S_FALSE;
+		}
+	}
+
+	std::vector<MeshCacheMaterial> cache_materials;
+
+	for (const auto& material : materials)
+	{
+		MeshCacheMaterial record;
+		const Material& src = *material.second;
+
+		memset(&record, 0, sizeof(record));
+		strncpy(record.name, material.first.c_str(), sizeof(record.name) - 1);
+
+		for (int i = 0; i < 3; ++i)
+		{
+			record.ambient[i] = src.ambient_.data[i];
+			record.diffuse[i] = src.value(Map::kDiffuse).data[i];
+			record.specular[i] = src.value(Map::kSpecular).data[i];
+			record.emission[i] = src.emission_.data[i];
+		}
+		record.shininess = src.shininess(nullptr);
+		record.ior = src.ior;
+		record.roughness = src.roughness_;
+		record.metallic = src.metallic_;
+
+		cache_materials.push_back(record);
+	}
+
+	MeshCacheHeader header;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, kMeshCacheMagic, sizeof(kMeshCacheMagic));
+	header.version = kMeshCacheVersion;
+	header.position_size = uint32_t(sizeof(Vector3));
+	header.attribute_size = uint32_t(attribute_size);
+	header.no_dependencies = uint32_t(dependencies.size());
+	header.no_vertices = no_vertices;
+	header.no_indices = no_indices;
+	header.no_edge_indices = no_edge_indices;
+	header.no_materials = cache_materials.size();
+	header.no_objects = objects.size();
+	header.dependencies_offset = Align(sizeof(MeshCacheHeader));
+	header.materials_offset = Align(header.dependencies_offset + dependencies.size() * sizeof(MeshCacheDependency));
+	header.objects_offset = Align(header.materials_offset + cache_materials.size() * sizeof(MeshCacheMaterial));
+	header.positions_offset = Align(header.objects_offset + objects.size() * sizeof(MeshCacheObject));
+	header.attributes_offset = Align(header.positions_offset + no_vertices * sizeof(Vector3));
+	header.indices_offset = Align(header.attributes_offset + no_vertices * attribute_size);
+	header.edge_indices_offset = Align(header.indices_offset + no_indices * sizeof(GLuint));
+	header.face_normals_offset = Align(header.edge_indices_offset + no_edge_indices * sizeof(GLuint));
+	header.file_size = header.face_normals_offset + no_indices / 6 * sizeof(Vector3);
+
+	// written under a temporary name first so that an interrupted run never leaves a truncated cache behind
+	const std::string cache_file_name = MeshCacheFileName(file_name);
+	const std::string tmp_file_name = cache_file_name + ".tmp";
+
+	FILE* file = fopen(tmp_file_name.c_str(), "wb");
+
+	if (!file)
+	{
+		printf("IO error: Unable to write mesh cache '%s'.\n", cache_file_name.c_str());
+
+		return S_FALSE;
+	}
+
+	// the position is counted instead of asked for, ftell is 32 bit on Windows and the caches may exceed 2 GB
+	uint64_t position = 0;
+
+	auto write_at = [file, &position](const uint64_t offset, const void* data, const size_t size) {
+		static const char zeros[16] = { 0 };
+
+		fwrite(zeros, 1, size_t(offset - position), file); // padding
+		position = offset + size;
+		return size == 0 || fwrite(data, size, 1, file) == 1;
+	};
+
+	bool ok = write_at(0, &header, sizeof(header));
+	ok = ok && write_at(header.dependencies_offset, dependencies.data(), dependencies.size() * sizeof(MeshCacheDependency));
+	ok = ok && write_at(header.materials_offset, cache_materials.data(), cache_materials.size() * sizeof(MeshCacheMaterial));
+	ok = ok && write_at(header.objects_offset, objects.data(), objects.size() * sizeof(MeshCacheObject));
+	ok = ok && write_at(header.positions_offset, positions, no_vertices * sizeof(Vector3));
+	ok = ok && write_at(header.attributes_offset, attributes, no_vertices * attribute_size);
+	ok = ok && write_at(header.indices_offset, indices, no_indices * sizeof(GLuint));
+	ok = ok && write_at(header.edge_indices_offset, edge_indices, no_edge_indices * sizeof(GLuint));
+	ok = ok && write_at(header.face_normals_offset, face_normals, no_indices / 6 * sizeof(Vector3));
+
+	fclose(file);
+	file = nullptr;
+
+	std::error_code error;
+
+	if (ok)
+	{
+		std::filesystem::rename(tmp_file_name, cache_file_name, error);
+	}
+
+	if (!ok || error)
+	{
+		std::filesystem::remove(tmp_file_name, error);
+		printf("IO error: Unable to write mesh cache '%s'.\n", cache_file_name.c_str());
+
+		return S_FALSE;
+	}
+
+	printf("Mesh cache '%s' written (%.2f MB).\n", cache_file_name.c_str(), header.file_size / (1024.0 * 1024.0));
+
+	return S_OK;
+}
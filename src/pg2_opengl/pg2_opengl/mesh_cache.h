@@ -0,0 +1,96 @@
+#ifndef MESH_CACHE_H_
+#define MESH_CACHE_H_
+
+#include "pch.h"
+#include "vector3.h"
+#include "objloader.h"
+
+/* read-only memory mapping of a whole file */
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	int Open(const std::string& file_name);
+	void Close();
+
+	const char* data() const { return data_; }
+	size_t size() const { return size_; }
+
+private:
+	const char* data_{ nullptr };
+	size_t size_{ 0 };
+#ifdef _WIN32
+	void* file_{ nullptr }; // HANDLE
+	void* mapping_{ nullptr }; // HANDLE
+#else
+	int file_{ -1 };
+#endif
+};
+
+/* material record of the cache, enough to rebuild the material library without the MTL file */
+struct MeshCacheMaterial
+{
+	char name[128];
+	float ambient[3];
+	float diffuse[3];
+	float specular[3];
+	float emission[3];
+	float shininess;
+	float ior;
+	float roughness;
+	float metallic;
+};
+
+/* scene object record of the cache */
+struct MeshCacheObject
+{
+	char name[128];
+	uint32_t first_index;
+	uint32_t no_indices;
+	uint32_t first_edge_index; // range of the edge indices
+	uint32_t no_edge_indices;
+	int32_t material_id;
+	uint32_t flags;
+	float bounds_min[3];
+	float bounds_max[3];
+	float sphere[4]; // center and radius
+};
+
+/* views into a mapped cache file, valid as long as the file stays open */
+struct MeshCache
+{
+	MappedFile file;
+
+	const Vector3* positions{ nullptr };
+	const void* attributes{ nullptr }; // attribute_size bytes per vertex
+	size_t no_vertices{ 0 };
+	const GLuint* indices{ nullptr };
+	size_t no_indices{ 0 };
+	const GLuint* edge_indices{ nullptr }; // 4 per unique edge of every object
+	size_t no_edge_indices{ 0 };
+	const Vector3* face_normals{ nullptr }; // one per 6 indices
+	const MeshCacheMaterial* materials{ nullptr };
+	size_t no_materials{ 0 };
+	const MeshCacheObject* objects{ nullptr };
+	size_t no_objects{ 0 };
+};
+
+/* file name of the cache of the given OBJ file */
+std::string MeshCacheFileName(const std::string& file_name);
+
+/* maps the cache of the OBJ file, fails if it is missing, of another version or vertex layout, or older than the OBJ and MTL files it was built from,
+the vertex indices are not range checked here but while they are copied */
+int LoadMeshCache(const std::string& file_name, const size_t attribute_size, MeshCache& cache);
+
+/* writes the vertex pool, adjacency and edge indices, face normals, materials and objects built from the OBJ file and its MTL files next to the OBJ file */
+int SaveMeshCache(const std::string& file_name, const std::vector<std::string>& material_libraries,
+	const Vector3* positions, const void* attributes, const size_t attribute_size, const size_t no_vertices,
+	const GLuint* indices, const size_t no_indices, const GLuint* edge_indices, const size_t no_edge_indices, const Vector3* face_normals,
+	const MaterialLibrary& materials, const std::vector<MeshCacheObject>& objects);
+
+#endif
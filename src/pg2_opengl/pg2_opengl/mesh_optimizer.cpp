@@ -0,0 +1,222 @@
+#include "pch.h"
+#include "mesh_optimizer.h"
+
+static const GLuint kNoVertex = std::numeric_limits<GLuint>::max();
+
+VertexCacheStatistics AnalyzeVertexCache(const GLuint* indices, const size_t no_indices, const size_t no_vertices, const int cache_size)
+{
+	VertexCacheStatistics statistics;
+	const size_t no_primitives = no_indices / kAdjacencyPrimitiveSize;
+
+	if (no_primitives == 0)
+	{
+		return statistics;
+	}
+
+	// timestamp of the insertion into the cache, a vertex is cached if it was inserted less than cache_size misses ago
+	std::vector<size_t> cache_time(no_vertices, 0);
+	std::vector<bool> referenced(no_vertices, false);
+	size_t time = size_t(cache_size) + 1;
+	size_t no_transforms = 0;
+	size_t no_referenced = 0;
+
+	for (size_t i = 0; i < no_primitives * kAdjacencyPrimitiveSize; ++i)
+	{
+		const GLuint v = indices[i];
+
+		if (time - cache_time[v] > size_t(cache_size))
+		{
+			cache_time[v] = time++;
+			++no_transforms;
+		}
+
+		if (!referenced[v])
+		{
+			referenced[v] = true;
+			++no_referenced;
+		}
+	}
+
+	statistics.acmr = double(no_transforms) / no_primitives;
+	statistics.atvr = double(no_transforms) / no_referenced;
+
+	return statistics;
+}
+
+/* Tipsify over indices in [0, no_vertices) */
+static void OptimizeLocalVertexCache(GLuint* indices, const size_t no_indices, const size_t no_vertices, const int cache_size)
+{
+	const size_t no_primitives = no_indices / kAdjacencyPrimitiveSize;
+
+	if (no_primitives == 0)
+	{
+		return;
+	}
+
+	// primitives using each vertex (CSR), a primitive is listed once per occurrence of the vertex
+	std::vector<GLuint> live_count(no_vertices, 0);
+
+	for (size_t i = 0; i < no_primitives * kAdjacencyPrimitiveSize; ++i)
+	{
+		++live_count[indices[i]];
+	}
+
+	std::vector<size_t> first_primitive(no_vertices + 1, 0);
+
+	for (size_t v = 0; v < no_vertices; ++v)
+	{
+		first_primitive[v + 1] = first_primitive[v] + live_count[v];
+	}
+
+	std::vector<GLuint> vertex_primitives(first_primitive[no_vertices]);
+	std::vector<size_t> fill(first_primitive.begin(), first_primitive.end() - 1);
+
+	for (size_t i = 0; i < no_primitives * kAdjacencyPrimitiveSize; ++i)
+	{
+		vertex_primitives[fill[indices[i]]++] = GLuint(i / kAdjacencyPrimitiveSize);
+	}
+
+	std::vector<size_t> cache_time(no_vertices, 0);
+	std::vector<bool> emitted(no_primitives, false);
+	std::vector<GLuint> dead_end; // recently used vertices to continue from
+	std::vector<GLuint> candidates; // vertices of the primitives emitted around the current fanning vertex
+	std::vector<GLuint> output;
+
+	output.reserve(no_primitives * kAdjacencyPrimitiveSize);
+
+	size_t time = size_t(cache_size) + 1;
+	size_t cursor = 0; // next vertex in input order to look at when the dead-end stack is exhausted
+	GLuint fanning_vertex = indices[0];
+
+	while (fanning_vertex != kNoVertex)
+	{
+		candidates.clear();
+
+		// emit all remaining primitives around the fanning vertex
+		for (size_t k = first_primitive[fanning_vertex]; k < first_primitive[fanning_vertex + 1]; ++k)
+		{
+			const GLuint primitive = vertex_primitives[k];
+
+			if (emitted[primitive])
+			{
+				continue;
+			}
+			emitted[primitive] = true;
+
+			for (int j = 0; j < kAdjacencyPrimitiveSize; ++j)
+			{
+				const GLuint v = indices[size_t(primitive) * kAdjacencyPrimitiveSize + j];
+
+				output.push_back(v);
+				dead_end.push_back(v);
+				candidates.push_back(v);
+				--live_count[v];
+
+				if (time - cache_time[v] > size_t(cache_size))
+				{
+					cache_time[v] = time++;
+				}
+			}
+		}
+
+		// the candidate that is still in the cache after its remaining primitives are emitted and is the oldest one
+		fanning_vertex = kNoVertex;
+		size_t best_priority = 0;
+		bool found = false;
+
+		for (const GLuint v : candidates)
+		{
+			if (live_count[v] == 0)
+			{
+				continue;
+			}
+
+			size_t priority = 0;
+
+			if (time - cache_time[v] + 2 * size_t(live_count[v]) <= size_t(cache_size))
+			{
+				priority = time - cache_time[v];
+			}
+
+			if (!found || priority > best_priority)
+			{
+				best_priority = priority;
+				fanning_vertex = v;
+				found = true;
+			}
+		}
+
+		if (!found)
+		{
+			// dead end, continue from a recently used vertex or from the next unprocessed one in input order
+			while (!dead_end.empty() && fanning_vertex == kNoVertex)
+			{
+				const GLuint v = dead_end.back();
+				dead_end.pop_back();
+
+				if (live_count[v] > 0)
+				{
+					fanning_vertex = v;
+				}
+			}
+
+			while (fanning_vertex == kNoVertex && cursor < no_primitives * kAdjacencyPrimitiveSize)
+			{
+				const GLuint v = indices[cursor++];
+
+				if (live_count[v] > 0)
+				{
+					fanning_vertex = v;
+				}
+			}
+		}
+	}
+
+	// well ordered inputs (e.g. regular grids) may already beat the greedy order
+	if (AnalyzeVertexCache(output.data(), output.size(), no_vertices, cache_size).acmr < AnalyzeVertexCache(indices, no_indices, no_vertices, cache_size).acmr)
+	{
+		std::copy(output.begin(), output.end(), indices);
+	}
+}
+
+void OptimizeVertexCache(GLuint* indices, const size_t no_indices, const int cache_size)
+{
+	const size_t no_range_indices = no_indices - no_indices % kAdjacencyPrimitiveSize;
+
+	// the vertices of the range are numbered densely, so the scratch arrays are sized by the range and not by the pool
+	std::vector<GLuint> vertices(indices, indices + no_range_indices);
+
+	std::sort(vertices.begin(), vertices.end());
+	vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+
+	for (size_t i = 0; i < no_range_indices; ++i)
+	{
+		indices[i] = GLuint(std::lower_bound(vertices.begin(), vertices.end(), indices[i]) - vertices.begin());
+	}
+
+	OptimizeLocalVertexCache(indices, no_range_indices, vertices.size(), cache_size);
+
+	for (size_t i = 0; i < no_range_indices; ++i)
+	{
+		indices[i] = vertices[indices[i]];
+	}
+}
+
+std::vector<GLuint> OptimizeVertexFetch(GLuint* indices, const size_t no_indices, const size_t no_vertices)
+{
+	std::vector<GLuint> remap(no_vertices, kNoVertex);
+	GLuint next_vertex = 0;
+
+	for (size_t i = 0; i < no_indices; ++i)
+	{
+		GLuint& index = indices[i];
+
+		if (remap[index] == kNoVertex)
+		{
+			remap[index] = next_vertex++;
+		}
+		index = remap[index];
+	}
+
+	return remap;
+}
@@ -0,0 +1,49 @@
+#ifndef MESH_OPTIMIZER_H_
+#define MESH_OPTIMIZER_H_
+
+#include "pch.h"
+
+/* the geometry shader reads all six vertices of an adjacency primitive, so all of them go through the post-transform cache */
+static const int kAdjacencyPrimitiveSize = 6;
+
+/* size of the simulated post-transform vertex cache */
+static const int kVertexCacheSize = 16;
+
+struct VertexCacheStatistics
+{
+	double acmr{ 0.0 }; /* average cache miss ratio, vertex shader invocations per primitive */
+	double atvr{ 0.0 }; /* average transform to vertex ratio, vertex shader invocations per referenced vertex (1.0 is optimal) */
+};
+
+/* simulates a FIFO post-transform cache over the GL_TRIANGLES_ADJACENCY primitives of the given indices */
+VertexCacheStatistics AnalyzeVertexCache(const GLuint* indices, const size_t no_indices, const size_t no_vertices, const int cache_size = kVertexCacheSize);
+
+/* reorders the primitives of the given range for post-transform cache locality (Tipsify, Sander et al. 2007), the primitives stay intact and the input order is kept if it is better,
+the work and memory depend on the range only and not on the size of the vertex pool it indexes */
+void OptimizeVertexCache(GLuint* indices, const size_t no_indices, const int cache_size = kVertexCacheSize);
+
+/* renumbers the vertices in the order of their first use, returns the new index of every old vertex (-1 for unused ones) */
+std::vector<GLuint> OptimizeVertexFetch(GLuint* indices, const size_t no_indices, const size_t no_vertices);
+
+/* moves the vertices of the array to their new positions given by OptimizeVertexFetch, unused vertices are dropped */
+template<typename T> void RemapVertices(std::vector<T>& vertices, const std::vector<GLuint>& remap)
+{
+	std::vector<T> remapped;
+
+	remapped.reserve(vertices.size());
+	for (size_t i = 0; i < vertices.size(); ++i)
+	{
+		if (remap[i] != std::numeric_limits<GLuint>::max())
+		{
+			if (remapped.size() <= remap[i])
+			{
+				remapped.resize(size_t(remap[i]) + 1);
+			}
+			remapped[remap[i]] = vertices[i];
+		}
+	}
+
+	vertices.swap(remapped);
+}
+
+#endif
@@ -0,0 +1,706 @@
+#include "pch.h"
+#include "objparser.h"
+#include "utils.h"
+#include "adjacency.h"
+
+/* statement that changes the parser state between two faces */
+struct ObjStatement
+{
+	enum class Type { kObject, kMaterial, kMaterialLibrary };
+
+	Type type;
+	size_t face; /* number of faces of the chunk preceding the statement */
+	std::string name;
+};
+
+/* triangle of a chunk, a polygon is stored as a fan of these */
+struct ObjFace
+{
+	int indices[3][3]; /* position, texture coordinate and normal index of each corner, -1 if missing */
+	int relative; /* bit (3 * corner + attribute) is set if the index is relative to the first vertex of the chunk */
+};
+
+/* part of the file between two line boundaries and everything parsed from it */
+struct ObjChunk
+{
+	const char* begin{ nullptr };
+	const char* end{ nullptr };
+
+	std::vector<Vector3> positions;
+	std::vector<Vector3> texture_coords;
+	std::vector<Vector3> normals;
+	std::vector<ObjFace> faces;
+	std::vector<ObjStatement> statements;
+};
+
+static const char* SkipSpaces(const char* p, const char* end)
+{
+	while (p < end && (*p == ' ' || *p == '\t'))
+	{
+		++p;
+	}
+
+	return p;
+}
+
+/* from_chars is locale independent and does not allocate, unlike strtof or streams */
+static const char* ParseFloat(const char* p, const char* end, float& value)
+{
+	p = SkipSpaces(p, end);
+
+	if (p < end && *p == '+')
+	{
+		++p;
+	}
+
+	const std::from_chars_result result = std::from_chars(p, end, value);
+
+	if (result.ec != std::errc())
+	{
+		value = 0.0f;
+
+		return (result.ptr == p) ? end : result.ptr; // skip the rest of a malformed line
+	}
+
+	return result.ptr;
+}
+
+static const char* ParseVector(const char* p, const char* end, Vector3& v, const int no_components)
+{
+	float values[3] = { 0.0f, 0.0f, 0.0f };
+
+	for (int i = 0; i < no_components; ++i)
+	{
+		const char* q = SkipSpaces(p, end);
+
+		if (q == end)
+		{
+			break; // e.g. 2D texture coordinates
+		}
+		p = ParseFloat(q, end, values[i]);
+	}
+	v = Vector3(values[0], values[1], values[2]);
+
+	return p;
+}
+
+static const char* ParseIndex(const char* p, const char* end, int& value)
+{
+	bool negative = false;
+
+	if (p < end && *p == '-')
+	{
+		negative = true;
+		++p;
+	}
+
+	value = 0;
+	while (p < end && *p >= '0' && *p <= '9')
+	{
+		value = value * 10 + (*p - '0');
+		++p;
+	}
+
+	if (negative)
+	{
+		value = -value;
+	}
+
+	return p;
+}
+
+/* resolves one OBJ index into zero based global index or chunk relative index */
+static int ResolveIndex(const int index, const size_t no_chunk_items, int& relative, const int bit)
+{
+	if (index > 0)
+	{
+		return index - 1;
+	}
+	if (index < 0)
+	{
+		relative |= 1 << bit;
+
+		return int(no_chunk_items) + index;
+	}
+
+	return -1; // not present
+}
+
+static std::string ParseName(const char* p, const char* end)
+{
+	p = SkipSpaces(p, end);
+
+	while (end > p && (end[-1] == ' ' || end[-1] == '\t'))
+	{
+		--end;
+	}
+
+	return std::string(p, end);
+}
+
+static bool IsKeyword(const char* p, const char* end, const char* keyword)
+{
+	const size_t length = strlen(keyword);
+
+	return size_t(end - p) > length && strncmp(p, keyword, length) == 0 && (p[length] == ' ' || p[length] == '\t');
+}
+
+static void ParseFace(const char* p, const char* end, ObjChunk& chunk)
+{
+	const int max_corners = 64;
+	int corners[max_corners][3];
+	int relative[max_corners];
+	int no_corners = 0;
+
+	p = SkipSpaces(p, end);
+
+	while (p < end && no_corners < max_corners)
+	{
+		int raw[3] = { 0, 0, 0 };
+
+		p = ParseIndex(p, end, raw[0]);
+		if (p < end && *p == '/')
+		{
+			++p;
+			if (p < end && *p != '/')
+			{
+				p = ParseIndex(p, end, raw[1]);
+			}
+			if (p < end && *p == '/')
+			{
+				++p;
+				p = ParseIndex(p, end, raw[2]);
+			}
+		}
+
+		if (raw[0] == 0)
+		{
+			break; // malformed corner
+		}
+
+		relative[no_corners] = 0;
+		corners[no_corners][0] = ResolveIndex(raw[0], chunk.positions.size(), relative[no_corners], 0);
+		corners[no_corners][1] = ResolveIndex(raw[1], chunk.texture_coords.size(), relative[no_corners], 1);
+		corners[no_corners][2] = ResolveIndex(raw[2], chunk.normals.size(), relative[no_corners], 2);
+		++no_corners;
+
+		p = SkipSpaces(p, end);
+	}
+
+	// triangle fan
+	for (int i = 1; i + 1 < no_corners; ++i)
+	{
+		const int fan[3] = { 0, i, i + 1 };
+
+		ObjFace face;
+		face.relative = 0;
+
+		for (int j = 0; j < 3; ++j)
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				face.indices[j][k] = corners[fan[j]][k];
+			}
+			face.relative |= relative[fan[j]] << (3 * j);
+		}
+
+		chunk.faces.push_back(face);
+	}
+}
+
+static void ParseChunk(ObjChunk& chunk)
+{
+	const char* p = chunk.begin;
+
+	while (p < chunk.end)
+	{
+		const char* line_end = static_cast<const char*>(memchr(p, '\n', chunk.end - p));
+
+		if (!line_end)
+		{
+			line_end = chunk.end;
+		}
+
+		const char* end = line_end;
+
+		if (end > p && end[-1] == '\r')
+		{
+			--end;
+		}
+
+		const char* q = SkipSpaces(p, end);
+
+		if (IsKeyword(q, end, "v"))
+		{
+			Vector3 position;
+			ParseVector(q + 1, end, position, 3);
+			chunk.positions.push_back(position);
+		}
+		else if (IsKeyword(q, end, "vt"))
+		{
+			Vector3 texture_coord;
+			ParseVector(q + 2, end, texture_coord, 3);
+			chunk.texture_coords.push_back(texture_coord);
+		}
+		else if (IsKeyword(q, end, "vn"))
+		{
+			Vector3 normal;
+			ParseVector(q + 2, end, normal, 3);
+			chunk.normals.push_back(normal);
+		}
+		else if (IsKeyword(q, end, "f"))
+		{
+			ParseFace(q + 1, end, chunk);
+		}
+		else if (IsKeyword(q, end, "o") || IsKeyword(q, end, "g"))
+		{
+			chunk.statements.push_back({ ObjStatement::Type::kObject, chunk.faces.size(), ParseName(q + 1, end) });
+		}
+		else if (IsKeyword(q, end, "usemtl"))
+		{
+			chunk.statements.push_back({ ObjStatement::Type::kMaterial, chunk.faces.size(), ParseName(q + 6, end) });
+		}
+		else if (IsKeyword(q, end, "mtllib"))
+		{
+			chunk.statements.push_back({ ObjStatement::Type::kMaterialLibrary, chunk.faces.size(), ParseName(q + 6, end) });
+		}
+		// comments, smoothing groups, lines and points are skipped
+
+		p = line_end + 1;
+	}
+}
+
+int LoadMTL(const std::string& file_name, MaterialLibrary& materials)
+{
+	std::ifstream file(file_name, std::ios::in);
+
+	if (!file)
+	{
+		printf("IO error: File '%s' not found.\n", file_name.c_str());
+
+		return S_FALSE;
+	}
+
+	const std::filesystem::path directory = std::filesystem::path(file_name).parent_path();
+
+	std::shared_ptr<Material> material;
+	std::string line;
+
+	while (std::getline(file, line))
+	{
+		const char* p = line.c_str();
+		const char* end = p + line.size();
+
+		if (end > p && end[-1] == '\r')
+		{
+			--end;
+		}
+		p = SkipSpaces(p, end);
+
+		if (IsKeyword(p, end, "newmtl"))
+		{
+			const std::string name = ParseName(p + 6, end);
+			const auto existing = materials.find(name);
+
+			material = (existing != materials.end()) ? existing->second : std::make_shared<Material>(name);
+			materials[name] = material;
+			continue;
+		}
+		if (!material)
+		{
+			continue;
+		}
+
+		Vector3 v;
+		float value = 0.0f;
+
+		if (IsKeyword(p, end, "Ka"))
+		{
+			ParseVector(p + 2, end, v, 3);
+			material->ambient_ = Color3f({ v.x, v.y, v.z });
+		}
+		else if (IsKeyword(p, end, "Kd"))
+		{
+			ParseVector(p + 2, end, v, 3);
+			material->set_value(Map::kDiffuse, Color3f({ v.x, v.y, v.z }));
+		}
+		else if (IsKeyword(p, end, "Ks"))
+		{
+			ParseVector(p + 2, end, v, 3);
+			material->set_value(Map::kSpecular, Color3f({ v.x, v.y, v.z }));
+		}
+		else if (IsKeyword(p, end, "Ke"))
+		{
+			ParseVector(p + 2, end, v, 3);
+			material->emission_ = Color3f({ v.x, v.y, v.z });
+		}
+		else if (IsKeyword(p, end, "Ns"))
+		{
+			ParseFloat(p + 2, end, value);
+			material->set_shininess(value);
+		}
+		else if (IsKeyword(p, end, "Ni"))
+		{
+			ParseFloat(p + 2, end, value);
+			material->ior = value;
+		}
+		else if (IsKeyword(p, end, "Pr"))
+		{
+			ParseFloat(p + 2, end, value);
+			material->roughness_ = value;
+		}
+		else if (IsKeyword(p, end, "Pm"))
+		{
+			ParseFloat(p + 2, end, value);
+			material->metallic_ = value;
+		}
+		else if (IsKeyword(p, end, "map_Kd"))
+		{
+			material->set_texture(Map::kDiffuse, std::make_shared<Texture3u>((directory / ParseName(p + 6, end)).string()));
+		}
+		else if (IsKeyword(p, end, "map_bump") || IsKeyword(p, end, "norm"))
+		{
+			const size_t keyword_length = (*p == 'n') ? 4 : 8;
+			material->set_texture(Map::kNormal, std::make_shared<Texture3u>((directory / ParseName(p + keyword_length, end)).string()));
+		}
+	}
+
+	return S_OK;
+}
+
+int LoadOBJParallel(const std::string& file_name, SceneGraph& scene, MaterialLibrary& materials, const bool build_adjacency, int no_threads,
+	std::vector<std::string>* material_libraries)
+{
+	const auto t0 = std::chrono::high_resolution_clock::now();
+
+	FILE* file = fopen(file_name.c_str(), "rb");
+
+	if (!file)
+	{
+		printf("IO error: File '%s' not found.\n", file_name.c_str());
+
+		return S_FALSE;
+	}
+
+	const size_t file_size = static_cast<size_t>(GetFileSize64(file_name.c_str()));
+	std::vector<char> buffer(file_size);
+	const size_t bytes = fread(buffer.data(), sizeof(char), file_size, file);
+
+	fclose(file);
+	file = nullptr;
+
+	if (bytes != file_size)
+	{
+		printf("IO error: Unexpected end of file '%s' encountered.\n", file_name.c_str());
+
+		return S_FALSE;
+	}
+
+	if (no_threads < 1)
+	{
+		no_threads = std::max(1, int(std::thread::hardware_concurrency()));
+	}
+	no_threads = int(std::max<size_t>(1, std::min<size_t>(no_threads, file_size / 4096 + 1))); // tiny files are not worth splitting
+
+	// split the file at line boundaries
+	std::vector<ObjChunk> chunks(no_threads);
+	const char* const data_end = buffer.data() + file_size;
+	const char* chunk_begin = buffer.data();
+
+	for (int i = 0; i < no_threads; ++i)
+	{
+		const char* chunk_end = (i + 1 == no_threads) ? data_end : buffer.data() + file_size * (i + 1) / no_threads;
+
+		chunk_end = std::max(chunk_end, chunk_begin);
+		while (chunk_end < data_end && chunk_end[-1] != '\n')
+		{
+			++chunk_end;
+		}
+
+		chunks[i].begin = chunk_begin;
+		chunks[i].end = chunk_end;
+		chunk_begin = chunk_end;
+	}
+
+	std::vector<std::thread> workers;
+
+	for (int i = 1; i < no_threads; ++i)
+	{
+		workers.emplace_back(ParseChunk, std::ref(chunks[i]));
+	}
+	ParseChunk(chunks[0]);
+
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+
+	const auto t1 = std::chrono::high_resolution_clock::now();
+
+	// global index of the first position, texture coordinate and normal of every chunk
+	std::vector<std::array<int, 3>> offsets(no_threads);
+	std::array<int, 3> totals = { 0, 0, 0 };
+
+	for (int i = 0; i < no_threads; ++i)
+	{
+		offsets[i] = totals;
+		totals[0] += int(chunks[i].positions.size());
+		totals[1] += int(chunks[i].texture_coords.size());
+		totals[2] += int(chunks[i].normals.size());
+	}
+
+	// positions are global in the OBJ file but each mesh has its own vertex buffer, the attributes are copied into every mesh that uses them,
+	// once per mesh even if its o/g blocks are interleaved with those of other meshes
+	struct MeshState
+	{
+		std::shared_ptr<Mesh> mesh;
+		int default_texture_coord{ -1 };
+		std::array<std::unordered_map<int, int>, 3> local_indices; // global index -> index in the mesh per attribute
+	};
+
+	std::map<std::string, MeshState> meshes;
+	MeshState* mesh_state = nullptr;
+	std::shared_ptr<Material> material;
+
+	// the local index in the mesh that used the attribute last, saves the map lookups within one o/g block
+	std::array<std::vector<int>, 3> local_indices;
+	std::array<std::vector<Mesh*>, 3> owners;
+
+	for (int k = 0; k < 3; ++k)
+	{
+		local_indices[k].resize(totals[k], -1);
+		owners[k].resize(totals[k], nullptr);
+	}
+
+	auto global_item = [&chunks, &offsets](const int attribute, const int index) -> const Vector3& {
+		// find the chunk containing the global index, chunks are few so a linear search is fine
+		size_t chunk = offsets.size() - 1;
+		while (offsets[chunk][attribute] > index)
+		{
+			--chunk;
+		}
+		const int local = index - offsets[chunk][attribute];
+
+		switch (attribute)
+		{
+		case 0: return chunks[chunk].positions[local];
+		case 1: return chunks[chunk].texture_coords[local];
+		default: return chunks[chunk].normals[local];
+		}
+	};
+
+	auto select_mesh = [&](const std::string& name) {
+		MeshState& state = meshes[name];
+
+		if (!state.mesh)
+		{
+			state.mesh = std::make_shared<Mesh>(name);
+			scene[name] = state.mesh;
+		}
+		mesh_state = &state;
+	};
+
+	auto select_material = [&](const std::string& name) {
+		const auto existing = materials.find(name);
+
+		if (existing != materials.end())
+		{
+			material = existing->second;
+		}
+		else
+		{
+			material = std::make_shared<Material>(name);
+			materials[name] = material;
+		}
+	};
+
+	const std::filesystem::path directory = std::filesystem::path(file_name).parent_path();
+
+	// the merge is kept serial, o/g/usemtl state carries over chunk boundaries and the mesh local indices are assigned in the order of first use,
+	// which is what makes the result identical to LoadOBJ
+	for (int i = 0; i < no_threads; ++i)
+	{
+		ObjChunk& chunk = chunks[i];
+		size_t next_statement = 0;
+
+		for (size_t f = 0; f <= chunk.faces.size(); ++f)
+		{
+			// statements preceding this face
+			while (next_statement < chunk.statements.size() && chunk.statements[next_statement].face == f)
+			{
+				const ObjStatement& statement = chunk.statements[next_statement++];
+
+				switch (statement.type)
+				{
+				case ObjStatement::Type::kObject: select_mesh(statement.name); break;
+				case ObjStatement::Type::kMaterial: select_material(statement.name); break;
+				case ObjStatement::Type::kMaterialLibrary:
+				{
+					const std::string library_name = (directory / statement.name).string();
+
+					if (LoadMTL(library_name, materials) == S_OK && material_libraries)
+					{
+						material_libraries->push_back(library_name);
+					}
+					break;
+				}
+				}
+			}
+
+			if (f == chunk.faces.size())
+			{
+				break;
+			}
+
+			if (!mesh_state)
+			{
+				select_mesh("default");
+			}
+			if (!material)
+			{
+				select_material("default");
+			}
+
+			const ObjFace& src_face = chunk.faces[f];
+			Mesh* mesh = mesh_state->mesh.get();
+			Face3i face;
+			bool missing_normal = false;
+
+			for (int j = 0; j < 3; ++j)
+			{
+				int resolved[3];
+
+				for (int k = 0; k < 3; ++k)
+				{
+					int index = src_face.indices[j][k];
+
+					if (src_face.relative & (1 << (3 * j + k)))
+					{
+						index += offsets[i][k];
+					}
+					if (index < 0 || index >= totals[k])
+					{
+						resolved[k] = -1;
+						continue;
+					}
+
+					if (owners[k][index] != mesh)
+					{
+						const auto inserted = mesh_state->local_indices[k].emplace(index, -1);
+
+						if (inserted.second)
+						{
+							const Vector3& item = global_item(k, index);
+
+							switch (k)
+							{
+							case 0: inserted.first->second = int(mesh->push_back_position(item)); break;
+							case 1: inserted.first->second = int(mesh->push_back_texture_coord(item)); break;
+							default: inserted.first->second = int(mesh->push_back_normal(item)); break;
+							}
+						}
+						local_indices[k][index] = inserted.first->second;
+						owners[k][index] = mesh;
+					}
+					resolved[k] = local_indices[k][index];
+				}
+
+				if (resolved[1] < 0)
+				{
+					if (mesh_state->default_texture_coord < 0)
+					{
+						mesh_state->default_texture_coord = int(mesh->push_back_texture_coord(Vector3()));
+					}
+					resolved[1] = mesh_state->default_texture_coord;
+				}
+				missing_normal |= (resolved[2] < 0);
+
+				face.vertices[j].position_index = resolved[0];
+				face.vertices[j].texture_coord_index = resolved[1];
+				face.vertices[j].normal_index = resolved[2];
+			}
+
+			if (face.vertices[0].position_index < 0 || face.vertices[1].position_index < 0 || face.vertices[2].position_index < 0)
+			{
+				continue; // reference to an undefined position
+			}
+
+			if (missing_normal) // flat normal of the face
+			{
+				const auto& positions = mesh->vertex_buffer().positions;
+				const Vector3& p0 = positions[face.vertices[0].position_index];
+				Vector3 normal = (positions[face.vertices[1].position_index] - p0).CrossProduct(positions[face.vertices[2].position_index] - p0);
+				normal.Normalize();
+
+				const int normal_index = int(mesh->push_back_normal(normal));
+
+				for (int j = 0; j < 3; ++j)
+				{
+					if (face.vertices[j].normal_index < 0)
+					{
+						face.vertices[j].normal_index = normal_index;
+					}
+				}
+			}
+
+			mesh->patch(material).push_back(face);
+		}
+	}
+
+	// tangents only touch their own mesh, build them in parallel
+	std::vector<Mesh*> mesh_list;
+	std::atomic<size_t> next_mesh{ 0 };
+
+	for (auto& mesh : meshes)
+	{
+		mesh_list.push_back(mesh.second.mesh.get());
+	}
+
+	auto build_tangents = [&mesh_list, &next_mesh]() {
+		for (size_t m = next_mesh++; m < mesh_list.size(); m = next_mesh++)
+		{
+			mesh_list[m]->BuildTangents();
+		}
+	};
+
+	workers.clear();
+	for (size_t i = 1; i < std::min(size_t(no_threads), mesh_list.size()); ++i)
+	{
+		workers.emplace_back(build_tangents);
+	}
+	build_tangents();
+
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+
+	// the adjacency is built by all threads mesh after mesh
+	for (auto& mesh : meshes)
+	{
+		if (build_adjacency)
+		{
+			AdjacencyStatistics statistics;
+
+			if (BuildAdjacencyParallel(*mesh.second.mesh, &statistics) != S_OK)
+			{
+				printf("Adjacency of mesh '%s' not built, too many triangles.\n", mesh.first.c_str());
+			}
+			else if (statistics.no_boundary_edges > 0 || statistics.no_non_manifold_edges > 0 || statistics.no_degenerate_edges > 0)
+			{
+				// open or non-manifold casters produce incorrect shadow volumes
+				printf("Warning: mesh '%s' is not closed, %zu of %zu edges are boundary, %zu non-manifold, %zu degenerate.\n", mesh.first.c_str(),
+					statistics.no_boundary_edges, statistics.no_edges, statistics.no_non_manifold_edges, statistics.no_degenerate_edges);
+			}
+		}
+	}
+
+	const auto t2 = std::chrono::high_resolution_clock::now();
+	const double parse_time = std::chrono::duration<double>(t1 - t0).count();
+	const double total_time = std::chrono::duration<double>(t2 - t0).count();
+
+	printf("OBJ file '%s' (%.1f MB) parsed by %d threads in %.3f s (%.1f MB/s), %.3f s in total.\n", file_name.c_str(),
+		file_size / (1024.0 * 1024.0), no_threads, parse_time, file_size / (1024.0 * 1024.0) / parse_time, total_time);
+
+	return S_OK;
+}
@@ -0,0 +1,15 @@
+#ifndef OBJ_PARSER_H_
+#define OBJ_PARSER_H_
+
+#include "pch.h"
+#include "objloader.h"
+
+/* parallel replacement of LoadOBJ, the file is split at line boundaries and the chunks are parsed by no_threads workers (0 - all cores),
+paths of the loaded MTL files are appended to material_libraries if given */
+int LoadOBJParallel(const std::string& file_name, SceneGraph& scene, MaterialLibrary& materials, const bool build_adjacency = true, int no_threads = 0,
+	std::vector<std::string>* material_libraries = nullptr);
+
+/* loads materials from the given MTL file into the library, existing materials of the same name are updated */
+int LoadMTL(const std::string& file_name, MaterialLibrary& materials);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+#include "pch.h"
+
+/* runs task(thread, first, last) for no_threads equally sized ranges of [0, n) */
+inline void ParallelFor(const int no_threads, const size_t n, const std::function<void(int, size_t, size_t)>& task)
+{
+	std::vector<std::thread> workers;
+
+	for (int t = 1; t < no_threads; ++t)
+	{
+		workers.emplace_back(task, t, n * t / no_threads, n * (t + 1) / no_threads);
+	}
+	task(0, 0, n / no_threads);
+
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+#endif
@@ -10,7 +10,10 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
 #include <array>
+#include <algorithm>
 #include <random>
 #define _USE_MATH_DEFINES
 #include <math.h>
@@ -21,6 +24,10 @@
 #include <streambuf>
 #include <string>
 #include <filesystem>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <charconv>
 
 // Glad - multi-Language GL/GLES/EGL/GLX/WGL loader-generator based on the official specs
 #include <glad/glad.h>
@@ -1,9 +1,37 @@
 #include "pch.h"
 #include "tutorials.h"
+#include "benchmarks.h"
 
-int main()
+int main(int argc, char* argv[])
 {
 	printf("OpenGL, Milan Krivanek\n\n");
 
-	return tutorial_1(1280, 940);
+	// pg2_opengl --benchmark-obj file.obj
+	if (argc > 2 && std::string(argv[1]) == "--benchmark-obj")
+	{
+		return benchmark_obj_loader(argv[2]);
+	}
+
+	// pg2_opengl --benchmark-culling [no_spheres]
+	if (argc > 1 && std::string(argv[1]) == "--benchmark-culling")
+	{
+		return benchmark_volume_culling(argc > 2 ? size_t(std::stoul(argv[2])) : 10000);
+	}
+
+	// pg2_opengl --compare-obj [file.obj ...], the models of the repository by default
+	if (argc > 1 && std::string(argv[1]) == "--compare-obj")
+	{
+		std::vector<std::string> file_names(argv + 2, argv + argc);
+
+		if (file_names.empty())
+		{
+			file_names = { "../../../data/geosphere.obj", "../../../data/panda_test.obj", "../../../data/deer2.obj", "../../../data/donut.obj",
+				"../../../data/test.obj", "../../../data/shadow_volume_test.obj" };
+		}
+
+		return compare_obj_loaders(file_names);
+	}
+
+	// pg2_opengl --compare-layouts, full vs compact vertex attributes of the first frame
+	return tutorial_1(1280, 940, argc > 1 && std::string(argv[1]) == "--compare-layouts");
 }
@@ -8,6 +8,158 @@
 #include "color.h"
 #include "texture.h"
 #include "objloader.h"
+#include "objparser.h"
+#include "mesh_cache.h"
+#include "mesh_optimizer.h"
+#include "triangle_view.h"
+#include "adjacency.h"
+#include "parallel.h"
+
+/* converts float to IEEE 754 half float, rounds to nearest even */
+static GLushort FloatToHalf(const float value)
+{
+	const uint32_t f32_infinity = 255u << 23;
+	const uint32_t f16_max = (127u + 16u) << 23;
+	const uint32_t denormal_magic_bits = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+
+	float denormal_magic;
+	memcpy(&denormal_magic, &denormal_magic_bits, sizeof(float));
+
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(float));
+
+	const uint32_t sign = bits & 0x80000000u;
+	bits ^= sign;
+
+	uint32_t half;
+
+	if (bits >= f16_max) // overflow to infinity, NaN stays NaN
+	{
+		half = (bits > f32_infinity) ? 0x7E00 : 0x7C00;
+	}
+	else if (bits < (113u << 23)) // denormal half, let the FPU do the rounding
+	{
+		float tmp;
+		memcpy(&tmp, &bits, sizeof(float));
+		tmp += denormal_magic;
+		memcpy(&bits, &tmp, sizeof(float));
+
+		half = bits - denormal_magic_bits;
+	}
+	else
+	{
+		const uint32_t mantissa_odd = (bits >> 13) & 1;
+		bits += 0xC8000FFFu + mantissa_odd; // rebias the exponent and round
+		half = bits >> 13;
+	}
+
+	return GLushort(half | (sign >> 16));
+}
+
+/* octahedral encoding of a unit vector into two snorm16 values, decoded in basic_shader.vert */
+static void EncodeOctahedral(const Vector3& v, GLshort encoded[2])
+{
+	const float l1_norm = fabsf(v.x) + fabsf(v.y) + fabsf(v.z);
+
+	float x = (l1_norm > 0.0f) ? v.x / l1_norm : 0.0f;
+	float y = (l1_norm > 0.0f) ? v.y / l1_norm : 0.0f;
+
+	if (v.z < 0.0f) // fold the lower hemisphere over the diagonals
+	{
+		const float folded_x = (1.0f - fabsf(y)) * ((x >= 0.0f) ? 1.0f : -1.0f);
+		const float folded_y = (1.0f - fabsf(x)) * ((y >= 0.0f) ? 1.0f : -1.0f);
+		x = folded_x;
+		y = folded_y;
+	}
+
+	encoded[0] = GLshort(roundf(std::max(-1.0f, std::min(1.0f, x)) * 32767.0f));
+	encoded[1] = GLshort(roundf(std::max(-1.0f, std::min(1.0f, y)) * 32767.0f));
+}
+
+/* affine transform of a point */
+static Vector3 TransformPoint(const Matrix4x4& T, const Vector3& p)
+{
+	return Vector3(T.get(0, 0) * p.x + T.get(0, 1) * p.y + T.get(0, 2) * p.z + T.get(0, 3),
+		T.get(1, 0) * p.x + T.get(1, 1) * p.y + T.get(1, 2) * p.z + T.get(1, 3),
+		T.get(2, 0) * p.x + T.get(2, 1) * p.y + T.get(2, 2) * p.z + T.get(2, 3));
+}
+
+/* length of the longest axis of the linear part, scales the radius of a bounding sphere */
+static float MaxScale(const Matrix4x4& T)
+{
+	float scale_sqr = 0.0f;
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		scale_sqr = std::max(scale_sqr, T.get(0, axis) * T.get(0, axis) + T.get(1, axis) * T.get(1, axis) + T.get(2, axis) * T.get(2, axis));
+	}
+
+	return sqrtf(scale_sqr);
+}
+
+/* general inverse by Gauss-Jordan elimination with partial pivoting in double precision, the identity for a singular matrix */
+static Matrix4x4 Inverse(const Matrix4x4& T)
+{
+	double a[4][8];
+
+	for (int r = 0; r < 4; ++r)
+	{
+		for (int c = 0; c < 4; ++c)
+		{
+			a[r][c] = T.get(r, c);
+			a[r][c + 4] = r == c ? 1.0 : 0.0;
+		}
+	}
+
+	for (int c = 0; c < 4; ++c)
+	{
+		int pivot = c;
+		for (int r = c + 1; r < 4; ++r)
+		{
+			if (fabs(a[r][c]) > fabs(a[pivot][c]))
+			{
+				pivot = r;
+			}
+		}
+		if (a[pivot][c] == 0.0)
+		{
+			return Matrix4x4();
+		}
+		for (int k = 0; k < 8; ++k)
+		{
+			std::swap(a[c][k], a[pivot][k]);
+		}
+
+		const double scale = 1.0 / a[c][c];
+		for (int k = 0; k < 8; ++k)
+		{
+			a[c][k] *= scale;
+		}
+		for (int r = 0; r < 4; ++r)
+		{
+			if (r != c && a[r][c] != 0.0)
+			{
+				const double factor = a[r][c];
+				for (int k = 0; k < 8; ++k)
+				{
+					a[r][k] -= factor * a[c][k];
+				}
+			}
+		}
+	}
+
+	Matrix4x4 inverse;
+
+	for (int r = 0; r < 4; ++r)
+	{
+		for (int c = 0; c < 4; ++c)
+		{
+			inverse.set(r, c, float(a[r][c + 4]));
+		}
+	}
+
+	return inverse;
+}
 
 Rasterizer::Rasterizer() {}
 
@@ -37,6 +189,17 @@ int Rasterizer::mainLoop() {
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 	glViewport(0, 0, camera.getWidth(), camera.getHeight());
 
+	bool volume_key_down = false;
+	bool stencil_key_down = false;
+	bool cc_key_down = false;
+	bool hierarchical_key_down = false;
+	bool layered_key_down = false;
+	bool deferred_key_down = false;
+	bool batched_key_down = false;
+	bool counting_key_down = false;
+	bool light_key_down = false;
+	std::string title;
+
 	// main loop
 	while (!glfwWindowShouldClose(window))
 	{
@@ -46,116 +209,117 @@ int Rasterizer::mainLoop() {
 		camera.Update();
 		camera.Inputs(window);
 
-		light.Update(counter);
-
-		Vector3 view_from = camera.getViewFrom();
-		std::vector<float> view_from_v = { view_from.x, view_from.y, view_from.z };
-		std::vector<float> light_position_ws = { light.position.x, light.position.y, light.position.z };
-		
-		glStencilMask(0xFF);
-		glDepthMask(GL_TRUE);
-		glDisable(GL_STENCIL_TEST);
-
-		// clear the scene
-		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-		
-		// --- DEPTH PASS ---
-		glUseProgram(shadow_program_);
-
-		SetMatrix4x4(shadow_program_, camera.MVP.data(), "mlp");
+		// V cycles the geometry shader, compute shader, CPU and edge based volumes
+		const bool volume_key = glfwGetKey(window, GLFW_KEY_V) == GLFW_PRESS;
+		if (volume_key && !volume_key_down)
+		{
+			static const char* path_names[] = { "geometry shader", "compute shader", "CPU", "edges" };
 
-		glBindVertexArray(vao);
-		glDrawArrays(GL_TRIANGLES_ADJACENCY, 0, loaded_triangles.size() * 6);
-		glBindVertexArray(0);
+			shadow_volume_path = ShadowVolumePath((int(shadow_volume_path) + 1) % 4);
+			printf("Shadow volumes: %s\n", path_names[int(shadow_volume_path)]);
+		}
+		volume_key_down = volume_key;
 
-		if (map_loaded) {
+		// C toggles the CC shadow volumes
+		const bool cc_key = glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS;
+		if (cc_key && !cc_key_down)
+		{
+			cc_volumes = !cc_volumes;
+			printf("CC shadow volumes: %s\n", cc_volumes ? "on" : "off");
+		}
+		cc_key_down = cc_key;
 
-			// --- ENVIRONMENT PASS ---
-			glUseProgram(env_program);
+		// H toggles the tile classification of the compute path
+		const bool hierarchical_key = glfwGetKey(window, GLFW_KEY_H) == GLFW_PRESS;
+		if (hierarchical_key && !hierarchical_key_down)
+		{
+			hierarchical_volumes = !hierarchical_volumes;
+			printf("Hierarchical shadow volumes: %s\n", hierarchical_volumes ? "on (compute shader path)" : "off");
+		}
+		hierarchical_key_down = hierarchical_key;
 
-			glEnable(GL_DEPTH_CLAMP);
-			glDepthFunc(GL_LEQUAL);
-			glDisable(GL_CULL_FACE);
+		// G toggles the layered volumes of the shadowed lights
+		const bool layered_key = glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS;
+		if (layered_key && !layered_key_down)
+		{
+			layered_volumes = !layered_volumes && layered_supported;
+			printf("Layered shadow volumes: %s\n", layered_volumes ? "on" : (layered_supported ? "off" : "not supported"));
+		}
+		layered_key_down = layered_key;
 
-			SetMatrix4x4(env_program, camera.MVP.data(), "MVP");
-			SetEnvMap();
+		// F toggles the deferred shading (D moves the camera)
+		const bool deferred_key = glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS;
+		if (deferred_key && !deferred_key_down)
+		{
+			deferred_shading = !deferred_shading && deferred_supported;
+			printf("Deferred shading: %s\n", deferred_shading ? "on" : (deferred_supported ? "off" : "not supported"));
+		}
+		deferred_key_down = deferred_key;
 
-			glBindVertexArray(vao_env);
-			glDrawArrays(GL_TRIANGLES, 0, loadedVerticesMap.size());
-			glBindVertexArray(0);
+		// M toggles the shadow masks and the batched shading of all lights
+		const bool batched_key = glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS;
+		if (batched_key && !batched_key_down)
+		{
+			batched_shading = !batched_shading && masks_supported;
+			for (LightStats& stats : light_stats)
+			{
+				stats.mask_valid = false; // not kept up to date while off
+			}
+			printf("Shadow masks and batched shading: %s\n", batched_shading ? "on" : (masks_supported ? "off" : "not supported"));
+		}
+		batched_key_down = batched_key;
 
-			glDisable(GL_DEPTH_CLAMP);
-			glDepthFunc(GL_LESS);
-			glEnable(GL_CULL_FACE);
+		// K cycles the stencil, the 32 bit image counts and the 8 bit lanes of the batched volumes
+		const bool counting_key = glfwGetKey(window, GLFW_KEY_K) == GLFW_PRESS;
+		if (counting_key && !counting_key_down)
+		{
+			if (!counting_supported)
+			{
+				printf("Atomic shadow volume counting: not supported\n");
+			}
+			else
+			{
+				packed_counts = atomic_counting && !packed_counts;
+				atomic_counting = !atomic_counting || packed_counts;
+				printf("Atomic shadow volume counting: %s\n", atomic_counting ? (packed_counts ? "8 bit lanes" : "32 bit") : "off");
+			}
 		}
-		
-		// --- SHADOW PASS ---
-		glUseProgram(stencil_program);
-		
-		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-		glDepthMask(GL_FALSE); 
-		glEnable(GL_DEPTH_CLAMP); 
-		glDisable(GL_CULL_FACE); 
-		glFrontFace(GL_CCW);
-		glEnable(GL_STENCIL_TEST);
-		glDepthFunc(GL_LESS);
-		glStencilMask(0xFF);
-		glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_DECR_WRAP, GL_KEEP); 
-		glStencilOpSeparate(GL_BACK, GL_KEEP, GL_INCR_WRAP, GL_KEEP); 
-		glStencilFunc(GL_ALWAYS, 0, 0xFF); 
-		
-		SetMatrix4x4(stencil_program, camera.MVP.data(), "MVP");
-		SetVector3(stencil_program, light_position_ws.data(), "light_position");
+		counting_key_down = counting_key;
 
-		glBindVertexArray(vao);
-		glDrawArrays(GL_TRIANGLES_ADJACENCY, 0, loaded_triangles.size()* 6);
-		glBindVertexArray(0);
-		
-		// --- LIGHTNING PASS ---
-		glUseProgram(shader_program);
-		
-		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-		glDepthMask(GL_TRUE);
-		glDisable(GL_DEPTH_CLAMP);
-		glDepthFunc(GL_LEQUAL);
-		glEnable(GL_CULL_FACE); 
-		glCullFace(GL_BACK);
-		glEnable(GL_STENCIL_TEST);
-		glStencilMask(0);
-		glStencilOpSeparate(GL_FRONT_AND_BACK, GL_KEEP, GL_KEEP, GL_KEEP);
-		glStencilFunc(GL_EQUAL, 0, 0xFF);
+		// Z cycles the automatic, z-fail and ZP+ stencil modes
+		const bool stencil_key = glfwGetKey(window, GLFW_KEY_Z) == GLFW_PRESS;
+		if (stencil_key && !stencil_key_down)
+		{
+			stencil_mode = StencilMode((int(stencil_mode) + 1) % 3);
+		}
+		stencil_key_down = stencil_key;
 
-		//amb_int = 1.0f;
+		// L prints the scheduler state and the GPU times per light
+		const bool light_key = glfwGetKey(window, GLFW_KEY_L) == GLFW_PRESS;
+		if (light_key && !light_key_down)
+		{
+			printLightStats();
+		}
+		light_key_down = light_key;
 
-		SetMatrix4x4(shader_program, camera.MVP.data(), "MVP");
-		SetMatrix4x4(shader_program, camera.MN.data(), "MN");
-		SetVector3(shader_program, view_from_v.data(), "view_from_position");
-		SetMatrix4x4(shader_program, camera.M.data(), "M");
-		//SetFloat(shader_program, amb_int, "amb_int");
-		SetVector3(shader_program, light_position_ws.data(), "light_position");
+		for (Light& light : lights)
+		{
+			light.Update(counter);
+		}
 
-		glBindVertexArray(vao);
-		glDrawArrays(GL_TRIANGLES_ADJACENCY, 0, loaded_triangles.size() * 6);
-		glBindVertexArray(0);
-		
-		// -- AMBIENT PASS --
-		glUseProgram(shader_program);
-		
-		//amb_int = 1.0f;
-		
-		//SetFloat(shader_program, amb_int, "amb_int");
+		renderFrame();
 
-		glDisable(GL_STENCIL_TEST);
-		glEnable(GL_BLEND);
-		glBlendEquation(GL_FUNC_ADD);
-		glBlendFunc(GL_ONE, GL_ONE);
+		// casters of the last shadowed light per stencil counting method
+		static const char* mode_names[] = { "automatic", "z-fail", "ZP+" };
+		char new_title[200];
+		snprintf(new_title, sizeof(new_title), "OpenGL - stencil shadows - %s - lights %zu/%zu shadowed - z-pass %zu, z-fail %zu, culled %zu (CC %zu) casters",
+			mode_names[int(stencil_mode)], no_shadowed_lights, light_order.size(), no_zpass_casters, no_zfail_casters, no_culled_casters, no_cc_culled_casters);
+		if (title != new_title)
+		{
+			title = new_title;
+			glfwSetWindowTitle(window, title.c_str());
+		}
 
-		glBindVertexArray(vao);
-		glDrawArrays(GL_TRIANGLES_ADJACENCY, 0, loaded_triangles.size() * 6);
-		glBindVertexArray(0);
-		
-		
 		glfwSwapBuffers(window); 
 		glfwPollEvents(); 
 	}
@@ -170,14 +334,89 @@ int Rasterizer::mainLoop() {
 	glDeleteShader(vertex_shader_stencil);
 	glDeleteShader(vertex_shader_shadow);
 	glDeleteShader(fragment_shader_shadow);
+	glDeleteShader(geometry_shader_edges);
+	glDeleteShader(vertex_shader_caps);
+	glDeleteShader(vertex_shader_near_caps);
+	glDeleteShader(compute_shader_volume);
+	glDeleteShader(vertex_shader_volume);
+	glDeleteShader(compute_shader_depth_tiles);
+	glDeleteShader(compute_shader_volume_tiles);
+	glDeleteShader(vertex_shader_tile_mark);
+	glDeleteShader(fragment_shader_tile_mark);
+	glDeleteShader(geometry_shader_layered);
+	glDeleteShader(fragment_shader_count);
+	glDeleteShader(fragment_shader_gbuffer);
+	glDeleteShader(fragment_shader_deferred);
+	glDeleteShader(fragment_shader_resolve_mask);
 
 	glDeleteProgram(shader_program);
 	glDeleteProgram(shadow_program_);
 	glDeleteProgram(env_program);
 	glDeleteProgram(stencil_program);
+	glDeleteProgram(edges_program);
+	glDeleteProgram(caps_program);
+	glDeleteProgram(near_caps_program);
+	glDeleteProgram(volume_compute_program);
+	glDeleteProgram(volume_program);
+	glDeleteProgram(depth_tiles_program);
+	glDeleteProgram(volume_tiles_program);
+	glDeleteProgram(tile_mark_program);
+	glDeleteProgram(layered_program);
+	glDeleteProgram(count_program);
+	glDeleteProgram(gbuffer_program);
+	glDeleteProgram(deferred_program);
+	glDeleteProgram(resolve_mask_program);
 
 	glDeleteBuffers(1, &vbo);
+	glDeleteBuffers(1, &vbo_positions);
+	glDeleteBuffers(1, &ebo);
+	glDeleteBuffers(1, &ebo_edges);
+	glDeleteVertexArrays(1, &vao_edges);
+	glDeleteBuffers(1, &ssbo_face_normals);
+	glDeleteVertexArrays(1, &vao_caps);
+	glDeleteBuffers(1, &ssbo_materials);
+	glDeleteBuffers(1, &ssbo_volume_vertices);
+	glDeleteBuffers(1, &ssbo_volume_indices);
+	glDeleteBuffers(1, &volume_command);
+	glDeleteVertexArrays(1, &vao_volumes);
+	glDeleteFramebuffers(1, &fbo_tile_depth);
+	glDeleteTextures(1, &tex_tile_depth);
+	glDeleteTextures(1, &tex_depth_tiles);
+	glDeleteBuffers(1, &ssbo_tiles);
+	glDeleteFramebuffers(1, &fbo_layered);
+	glDeleteFramebuffers(1, &fbo_layered_copy);
+	glDeleteTextures(1, &tex_layered_depth_stencil);
+	glDeleteBuffers(1, &ubo_layered_lights);
+	glDeleteQueries(1, &layered_query);
+	glDeleteFramebuffers(1, &fbo_count);
+	glDeleteTextures(1, &tex_count_depth);
+	glDeleteTextures(1, &tex_shadow_counts);
+	glDeleteBuffers(1, &acb_count_overflows);
+	glDeleteFramebuffers(1, &fbo_gbuffer);
+	glDeleteFramebuffers(1, &fbo_deferred);
+	glDeleteTextures(1, &tex_gbuffer_normals);
+	glDeleteTextures(1, &tex_gbuffer_materials);
+	glDeleteTextures(1, &tex_gbuffer_depths);
+	glDeleteTextures(1, &tex_deferred_color);
+	glDeleteTextures(1, &tex_deferred_depth_stencil);
+	glDeleteFramebuffers(1, &fbo_shadow_masks);
+	glDeleteFramebuffers(1, &fbo_mask_stencil);
+	glDeleteTextures(1, &tex_shadow_masks);
+	glDeleteTextures(1, &tex_mask_stencil);
+	glDeleteBuffers(1, &ubo_batched_lights);
+	for (LightStats& stats : light_stats)
+	{
+		glDeleteQueries(2, stats.queries);
+	}
+	for (GLsync& fence : volume_fences)
+	{
+		glDeleteSync(fence);
+	}
+	glDeleteBuffers(1, &vbo_volumes_cpu); // deleting a buffer unmaps it
+	glDeleteBuffers(1, &ebo_volumes_cpu);
+	glDeleteVertexArrays(1, &vao_volumes_cpu);
 	glDeleteVertexArrays(1, &vao);
+	glDeleteVertexArrays(1, &vao_positions);
 	glDeleteVertexArrays(1, &vbo_env);
 	glDeleteVertexArrays(1, &vao_env);
 
@@ -185,294 +424,3584 @@ int Rasterizer::mainLoop() {
 
 	return EXIT_SUCCESS;
 }
-int Rasterizer::InitEnvMap(const std::string& file_name)
-{
-	Texture3f env_map = Texture3f(file_name);
+/* renders one frame of the scene for the current camera and lights into the back buffer */
+void Rasterizer::renderFrame() {
+	Vector3 view_from = camera.getViewFrom();
+	std::vector<float> view_from_v = { view_from.x, view_from.y, view_from.z };
+	const bool deferred = deferred_shading && deferred_supported;
+	
+	glStencilMask(0xFF);
+	glDepthMask(GL_TRUE);
+	glDisable(GL_STENCIL_TEST);
 
-	glGenTextures(1, &tex_env_map);
-	glBindTexture(GL_TEXTURE_2D, tex_env_map);
-	if (glIsTexture(tex_env_map))
+	if (deferred)
 	{
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		// --- G-BUFFER PASS ---, the depth and stencil are shared with fbo_deferred
+		renderGBuffer();
 
-		// for HDR images use GL_RGB32F or GL_RGB16F as internal format !!!
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F,
-			env_map.width(), env_map.height(), 0,
-			GL_RGB, GL_FLOAT, env_map.data());
-		//glGenerateMipmap( GL_TEXTURE_2D );
+		frame_fbo = fbo_deferred;
+		glBindFramebuffer(GL_FRAMEBUFFER, frame_fbo);
+		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT);
 	}
-	glBindTexture(GL_TEXTURE_2D, 0);
+	else
+	{
+		frame_fbo = 0;
 
-	return S_OK;
-}
-int Rasterizer::SetEnvMap()
-{
-	glActiveTexture(GL_TEXTURE7);
-	glBindTexture(GL_TEXTURE_2D, tex_env_map);
+		// clear the scene, the stencil only where the light reaches
+		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	
+		// --- DEPTH PASS ---
+		glUseProgram(shadow_program_);
 
-	SetSampler(env_program, 7, "env_map");
+		SetMatrix4x4(shadow_program_, camera.MVP.data(), "mlp");
 
-	return S_OK;
-}
-int Rasterizer::initOpenGl(int width, int height) {
-	glfwSetErrorCallback(glfw_callback);
+		glBindVertexArray(vao_positions);
+		drawObjects(shadow_program_, 0, 0);
+		glBindVertexArray(0);
+	}
 
-	if (!glfwInit())
+	if (map_loaded) {
+
+		// --- ENVIRONMENT PASS ---
+		glUseProgram(env_program);
+
+		glEnable(GL_DEPTH_CLAMP);
+		glDepthFunc(GL_LEQUAL);
+		glDisable(GL_CULL_FACE);
+
+		SetMatrix4x4(env_program, camera.MVP.data(), "MVP");
+		SetEnvMap();
+
+		glBindVertexArray(vao_env);
+		glDrawArrays(GL_TRIANGLES, 0, loadedVerticesMap.size());
+		glBindVertexArray(0);
+
+		glDisable(GL_DEPTH_CLAMP);
+		glDepthFunc(GL_LESS);
+		glEnable(GL_CULL_FACE);
+	}
+	
+	// --- SHADOW AND LIGHTNING PASSES ---
+	scheduleLights();
+
+	// the forward passes redraw the objects, the deferred ones a full screen triangle over the G-buffer
+	const GLuint lighting_program = deferred ? deferred_program : shader_program;
+
+	glUseProgram(lighting_program);
+
+	//amb_int = 1.0f;
+
+	SetVector3(lighting_program, view_from_v.data(), "view_from_position");
+	if (deferred)
 	{
-		return(EXIT_FAILURE);
+		Matrix4x4 clip_to_world = camera.M * Inverse(camera.MVP);
+		const std::vector<float> viewport_size = { float(camera.getWidth()), float(camera.getHeight()) };
+
+		SetMatrix4x4(deferred_program, clip_to_world.data(), "clip_to_world");
+		SetVector2(deferred_program, viewport_size.data(), "viewport_size");
+
+		glActiveTexture(GL_TEXTURE10);
+		glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, tex_gbuffer_normals);
+		glActiveTexture(GL_TEXTURE11);
+		glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, tex_gbuffer_materials);
+		glActiveTexture(GL_TEXTURE12);
+		glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, tex_gbuffer_depths);
+		glActiveTexture(GL_TEXTURE0);
+	}
+	else
+	{
+		SetMatrix4x4(shader_program, camera.MVP.data(), "MVP");
+		SetMatrix4x4(shader_program, camera.MN.data(), "MN");
+		SetMatrix4x4(shader_program, camera.M.data(), "M");
+		//SetFloat(shader_program, amb_int, "amb_int");
+		SetInt(shader_program, vertex_layout == VertexLayout::kCompact, "compact_vertices");
+		SetInt(shader_program, no_depth_samples, "no_mask_samples");
+	}
+	if (atomic_counting && packed_counts)
+	{
+		checkCountOverflows();
 	}
+	SetInt(lighting_program, packed_counts, "packed_counts");
 
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4); // verze
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6); // verze
-	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE); // core profile
-	glfwWindowHint(GLFW_SAMPLES, 8); // anti-aliasing (8 sampl)
-	glfwWindowHint(GLFW_RESIZABLE, GL_TRUE); // zmna velikosti okna za bhu
-	glfwWindowHint(GLFW_DOUBLEBUFFER, GL_TRUE); // na back buffer kreslm, front vidm (pro plynulost)
+	const bool batched = batched_shading && masks_supported;
 
-	window = glfwCreateWindow(width, height, "OpenGL - stencil shadows", nullptr, nullptr);
+	if (batched)
+	{
+		assignShadowMasks();
+	}
 
-	if (!window)
+	// the shadowed lights share one draw of the layered or counted volumes, those beyond its layers or lanes fall back to their own
+	// stencil pass, lights with a current shadow mask need neither
+	std::vector<int> light_layers(lights.size(), -1);
+	std::vector<int> light_lanes(lights.size(), -1);
+	const bool counting = atomic_counting && counting_supported;
+
+	if (layered_volumes || counting)
 	{
-		glfwTerminate();
-		return EXIT_FAILURE;
+		std::vector<int> batch;
+
+		for (const int i : light_order)
+		{
+			if (light_stats[i].shadowed && int(batch.size()) < kMaxLayeredLights && !(batched && shadowMaskCurrent(lights[i], light_stats[i])))
+			{
+				(counting ? light_lanes : light_layers)[i] = int(batch.size());
+				batch.push_back(i);
+			}
+		}
+
+		if (!batch.empty())
+		{
+			const bool timed = !layered_pending;
+			if (timed)
+			{
+				if (layered_query == 0)
+				{
+					glGenQueries(1, &layered_query);
+				}
+				glBeginQuery(GL_TIME_ELAPSED, layered_query);
+			}
+			if (counting)
+			{
+				renderCountingPass(batch);
+			}
+			else
+			{
+				renderLayeredShadowPass(batch);
+			}
+			if (timed)
+			{
+				glEndQuery(GL_TIME_ELAPSED);
+				layered_pending = true;
+				layered_timed_lights = batch;
+			}
+		}
 	}
 
-	glfwSetFramebufferSizeCallback(window, framebuffer_resize_callback); // kdy se zmn velikost okna
-	glfwMakeContextCurrent(window); // v OPENGL mu volat jen z vlkna, ve kter jsme to vytvoili
-	// nastavm domovsk current kontext
+	if (batched)
+	{
+		// masks of the shadowed lights whose light or view has changed, the other masks are reused
+		for (const int i : light_order)
+		{
+			const Light& light = lights[i];
+			LightStats& stats = light_stats[i];
+			const int layer = light_layers[i];
+			const int lane = light_lanes[i];
+
+			if (!stats.shadowed || shadowMaskCurrent(light, stats))
+			{
+				continue;
+			}
+
+			setLightBounds(stats.bounds);
+			tiles_marked = false;
+
+			if (layer < 0 && lane < 0)
+			{
+				const std::vector<float> light_position_ws = { light.position.x, light.position.y, light.position.z };
+
+				glStencilMask(0xFF);
+				glClear(GL_STENCIL_BUFFER_BIT);
+
+				const bool timed = beginLightTimer(stats, 0);
+				renderShadowPass(light_position_ws, &stats);
+				if (timed)
+				{
+					endLightTimer(stats, 0);
+				}
+			}
+			resolveShadowMask(stats.mask_slot, layer, lane);
+			clearLightBounds();
+
+			stats.mask_valid = true;
+			stats.mask_light_position = light.position;
+			stats.mask_light_range = light.range;
+			stats.mask_MVP = camera.MVP;
+		}
+
+		drawBatchedLights();
+	}
+	else
+	{
+		// every visible light adds its contribution within its bounds, the stencil is recounted for the shadowed ones only
+		for (const int i : light_order)
+		{
+			const Light& light = lights[i];
+			LightStats& stats = light_stats[i];
+			const int layer = light_layers[i];
+			const int lane = light_lanes[i];
+			const std::vector<float> light_position_ws = { light.position.x, light.position.y, light.position.z };
+
+			setLightBounds(stats.bounds);
+			tiles_marked = false;
+
+			if (stats.shadowed && layer < 0 && lane < 0)
+			{
+				glStencilMask(0xFF);
+				glClear(GL_STENCIL_BUFFER_BIT);
+
+				const bool timed = beginLightTimer(stats, 0);
+				renderShadowPass(light_position_ws, &stats);
+				if (timed)
+				{
+					endLightTimer(stats, 0);
+				}
+			}
+
+			glUseProgram(lighting_program);
+
+			glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+			glDepthMask(GL_TRUE);
+			glDisable(GL_DEPTH_CLAMP);
+			glDepthFunc(GL_LEQUAL);
+			glEnable(GL_CULL_FACE);
+			glCullFace(GL_BACK);
+			glEnable(GL_BLEND);
+			glBlendEquation(GL_FUNC_ADD);
+			glBlendFunc(GL_ONE, GL_ONE);
+			glStencilMask(0);
+			glStencilOpSeparate(GL_FRONT_AND_BACK, GL_KEEP, GL_KEEP, GL_KEEP);
+			glStencilFunc(GL_EQUAL, 0, tiles_marked ? 0xFF & ~kTileMarkBit : 0xFF);
+			if (deferred)
+			{
+				// the full screen triangle only reads the depth, the depth bounds test still applies
+				glDepthMask(GL_FALSE);
+				glDepthFunc(GL_ALWAYS);
+			}
+
+			SetVector3(lighting_program, light_position_ws.data(), "light_position");
+			SetFloat(lighting_program, light.range, "light_range");
+			SetFloat(lighting_program, light.intensity, "light_intensity");
+
+			const bool timed = beginLightTimer(stats, 1);
+			if (stats.shadowed)
+			{
+				// the receivers are masked by the stencil, by the layer or by the counts of the light
+				if (layer < 0 && lane < 0)
+				{
+					glEnable(GL_STENCIL_TEST);
+				}
+				else
+				{
+					glDisable(GL_STENCIL_TEST);
+				}
+				if (deferred)
+				{
+					drawDeferredPass(1, layer, lane);
+				}
+				else
+				{
+					SetInt(shader_program, layer, "shadow_layer");
+					SetInt(shader_program, lane, "count_lane");
+					glBindVertexArray(vao);
+					drawObjects(shader_program, kReceiver, kReceiver);
+				}
+				// objects that do not receive shadows are lit everywhere
+				glDisable(GL_STENCIL_TEST);
+				if (deferred)
+				{
+					drawDeferredPass(0, -1);
+				}
+				else
+				{
+					SetInt(shader_program, -1, "shadow_layer");
+					SetInt(shader_program, -1, "count_lane");
+					drawObjects(shader_program, kReceiver, 0);
+				}
+			}
+			else
+			{
+				glDisable(GL_STENCIL_TEST);
+				if (deferred)
+				{
+					drawDeferredPass(-1, -1);
+				}
+				else
+				{
+					SetInt(shader_program, -1, "shadow_layer");
+					SetInt(shader_program, -1, "count_lane");
+					glBindVertexArray(vao);
+					drawObjects(shader_program, 0, 0);
+				}
+			}
+			glBindVertexArray(0);
+			if (timed)
+			{
+				endLightTimer(stats, 1);
+			}
+
+			clearLightBounds();
+		}
+	}
+	
+	// -- AMBIENT PASS --
+	// the emission and the unshadowed ambient light, the only pass that adds them
+	glUseProgram(lighting_program);
+
+	SetInt(lighting_program, 1, "ambient_pass");
+	SetFloat(lighting_program, ambient_intensity, "amb_int");
+
+	glDisable(GL_STENCIL_TEST);
+	glEnable(GL_BLEND);
+	glBlendEquation(GL_FUNC_ADD);
+	glBlendFunc(GL_ONE, GL_ONE);
+
+	if (deferred)
+	{
+		glDepthMask(GL_FALSE);
+		glDepthFunc(GL_ALWAYS);
+		drawDeferredPass(-1, -1);
+		glDepthMask(GL_TRUE);
+		glDepthFunc(GL_LEQUAL);
+
+		// the color, depth and stencil of the frame as the forward passes leave them
+		const int width = camera.getWidth();
+		const int height = camera.getHeight();
+
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo_deferred);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		frame_fbo = 0;
+	}
+	else
+	{
+		glBindVertexArray(vao);
+		drawObjects(shader_program, 0, 0);
+		glBindVertexArray(0);
+	}
+
+	SetInt(lighting_program, 0, "ambient_pass");
+}
+/* classifies the casters and fills the stencil buffer with the shadow volumes of the current path and stencil mode, the depth buffer has to be filled,
+the stats of the light keep its receiver grid between frames */
+void Rasterizer::renderShadowPass(const std::vector<float>& light_position_ws, LightStats* stats)
+{
+	// the compute and CPU paths merge the volumes of all casters into one draw, so they always count with z-fail
+	const bool per_caster = shadow_volume_path == ShadowVolumePath::kGeometryShader || shadow_volume_path == ShadowVolumePath::kEdges;
+	const Vector3 light_position(light_position_ws[0], light_position_ws[1], light_position_ws[2]);
+	tiles_marked = false;
+	cullCasters(light_position);
+	clampCasters(light_position, stats);
+	classifyCasters(light_position, per_caster ? stencil_mode : StencilMode::kZFail);
+
+	if (shadow_volume_path == ShadowVolumePath::kCompute)
+	{
+		extractShadowVolumes(light_position_ws.data());
+
+		if (hierarchical_volumes)
+		{
+			classifyTiles();
+			markTiles();
+			tiles_marked = true;
+		}
+	}
+	else if (shadow_volume_path == ShadowVolumePath::kCpu)
+	{
+		buildCpuShadowVolumes(light_position, gatherCasters());
+	}
+
+	setStencilPassState();
+
+	if (stencil_mode == StencilMode::kZPassPlus && no_zpass_casters > 0)
+	{
+		drawNearCaps(light_position_ws.data());
+	}
+	
+	if (shadow_volume_path == ShadowVolumePath::kCpu)
+	{
+		glUseProgram(volume_program);
+
+		SetMatrix4x4(volume_program, camera.MVP.data(), "MVP");
+
+		drawCpuShadowVolumes();
+	}
+	else if (shadow_volume_path == ShadowVolumePath::kCompute)
+	{
+		glUseProgram(volume_program);
+
+		SetMatrix4x4(volume_program, camera.MVP.data(), "MVP");
+
+		if (tiles_marked)
+		{
+			// the marked tiles fail the stencil test and keep their bits, the counts wrap within the other bits
+			glStencilFunc(GL_EQUAL, 0, kTileMarkBit);
+			glStencilMask(0xFF & ~kTileMarkBit);
+		}
+
+		glBindVertexArray(vao_volumes);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, volume_command);
+		glEnable(GL_PRIMITIVE_RESTART_FIXED_INDEX);
+		glDrawElementsIndirect(GL_TRIANGLE_STRIP, GL_UNSIGNED_INT, nullptr);
+		glDisable(GL_PRIMITIVE_RESTART_FIXED_INDEX);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		glBindVertexArray(0);
+	}
+	else if (shadow_volume_path == ShadowVolumePath::kEdges)
+	{
+		drawEdgeVolumes(light_position_ws.data());
+	}
+	else
+	{
+		glUseProgram(stencil_program);
+
+		SetMatrix4x4(stencil_program, camera.MVP.data(), "MVP");
+		SetVector3(stencil_program, light_position_ws.data(), "light_position");
+
+		glBindVertexArray(vao_positions);
+		// casters whose volumes cannot contain the near plane need no caps and count where the depth test passes
+		setStencilPassState(true);
+		SetInt(stencil_program, 0, "emit_caps");
+		drawObjects(stencil_program, kCaster | kZFail | kCulled, kCaster);
+		setStencilPassState();
+		SetInt(stencil_program, 1, "emit_caps");
+		drawObjects(stencil_program, kCaster | kZFail | kCulled, kCaster | kZFail);
+		glBindVertexArray(0);
+	}
+}
+/* scissor rectangle of the projected view space AABB of the sphere of influence and the depth range between its nearest and furthest point
+along the view direction, the whole screen for an unbounded light */
+LightBounds Rasterizer::computeLightBounds(const Light& light)
+{
+	const int width = camera.getWidth();
+	const int height = camera.getHeight();
+
+	LightBounds bounds = { 0, 0, width, height, 0.0, 1.0, true };
+
+	if (!std::isfinite(light.range))
+	{
+		return bounds;
+	}
+
+	const Matrix4x4& V = camera.V;
+	const Matrix4x4& P = camera.P;
+	const float r = light.range;
+	float center[3];
+
+	for (int i = 0; i < 3; ++i)
+	{
+		center[i] = V.get(i, 0) * light.position.x + V.get(i, 1) * light.position.y + V.get(i, 2) * light.position.z + V.get(i, 3);
+	}
+
+	// the camera looks along -z in view space
+	if (center[2] - r >= 0.0f)
+	{
+		bounds.visible = false;
+		return bounds;
+	}
+
+	auto window_depth = [&P](const float z) {
+		if (z >= 0.0f)
+		{
+			return 0.0;
+		}
+		const double ndc = (P.get(2, 2) * z + P.get(2, 3)) / (P.get(3, 2) * z + P.get(3, 3));
+		return std::min(std::max(0.5 * ndc + 0.5, 0.0), 1.0);
+	};
+
+	bounds.min_depth = window_depth(center[2] + r);
+	bounds.max_depth = window_depth(center[2] - r);
+
+	// any corner at or behind the eye leaves the rectangle at the whole screen
+	float x_min = 1.0f, y_min = 1.0f, x_max = -1.0f, y_max = -1.0f;
+
+	for (int corner = 0; corner < 8; ++corner)
+	{
+		const float x = center[0] + ((corner & 1) ? r : -r);
+		const float y = center[1] + ((corner & 2) ? r : -r);
+		const float z = center[2] + ((corner & 4) ? r : -r);
+		const float w = P.get(3, 2) * z + P.get(3, 3);
+
+		if (!(w > 1e-6f))
+		{
+			return bounds;
+		}
+
+		const float ndc_x = (P.get(0, 0) * x + P.get(0, 1) * y + P.get(0, 2) * z) / w;
+		const float ndc_y = (P.get(1, 0) * x + P.get(1, 1) * y + P.get(1, 2) * z) / w;
+
+		x_min = std::min(x_min, ndc_x);
+		x_max = std::max(x_max, ndc_x);
+		y_min = std::min(y_min, ndc_y);
+		y_max = std::max(y_max, ndc_y);
+	}
+
+	const int left = std::max(0, int(std::floor((0.5f * x_min + 0.5f) * width)));
+	const int right = std::min(width, int(std::ceil((0.5f * x_max + 0.5f) * width)));
+	const int bottom = std::max(0, int(std::floor((0.5f * y_min + 0.5f) * height)));
+	const int top = std::min(height, int(std::ceil((0.5f * y_max + 0.5f) * height)));
+
+	bounds.x = left;
+	bounds.y = bottom;
+	bounds.width = std::max(0, right - left);
+	bounds.height = std::max(0, top - bottom);
+	bounds.visible = bounds.width > 0 && bounds.height > 0 && bounds.min_depth < bounds.max_depth;
+
+	return bounds;
+}
+/* restricts clears and draws to the pixels the light can reach until clearLightBounds */
+void Rasterizer::setLightBounds(const LightBounds& bounds)
+{
+	glEnable(GL_SCISSOR_TEST);
+	glScissor(bounds.x, bounds.y, bounds.width, bounds.height);
+
+	if (depth_bounds_ext != nullptr)
+	{
+		glEnable(GL_DEPTH_BOUNDS_TEST_EXT);
+		depth_bounds_ext(bounds.min_depth, bounds.max_depth);
+	}
+}
+void Rasterizer::clearLightBounds()
+{
+	glDisable(GL_SCISSOR_TEST);
+
+	if (depth_bounds_ext != nullptr)
+	{
+		glDisable(GL_DEPTH_BOUNDS_TEST_EXT);
+	}
+}
+/* ranks the visible lights by the fraction of the screen they cover times their intensity and gives stencil shadows to the best
+max_shadowed_lights as long as the estimated GPU time of their shadow passes fits into shadow_budget_ms, the first one always gets them,
+the others are lit unshadowed */
+void Rasterizer::scheduleLights()
+{
+	light_stats.resize(lights.size());
+	collectLightTimings();
+
+	const float screen_area = float(camera.getWidth()) * float(camera.getHeight());
+	double measured_ms = 0.0;
+	int no_measured = 0;
+
+	light_order.clear();
+
+	for (int i = 0; i < int(lights.size()); ++i)
+	{
+		LightStats& stats = light_stats[i];
+
+		stats.bounds = computeLightBounds(lights[i]);
+		stats.priority = stats.bounds.visible ? float(stats.bounds.width) * float(stats.bounds.height) / screen_area * lights[i].intensity : 0.0f;
+		stats.shadowed = false;
+
+		if (stats.bounds.visible)
+		{
+			light_order.push_back(i);
+		}
+		if (stats.shadow_ms >= 0.0)
+		{
+			measured_ms += stats.shadow_ms;
+			++no_measured;
+		}
+	}
+
+	std::stable_sort(light_order.begin(), light_order.end(), [&](const int a, const int b) {
+		return light_stats[a].priority > light_stats[b].priority; });
+
+	// lights without a measured shadow pass are expected to cost the average of the others
+	const double default_ms = no_measured > 0 ? measured_ms / no_measured : 0.0;
+	double remaining_ms = shadow_budget_ms;
+
+	no_shadowed_lights = 0;
+
+	for (const int i : light_order)
+	{
+		if (int(no_shadowed_lights) >= max_shadowed_lights)
+		{
+			break;
+		}
+
+		LightStats& stats = light_stats[i];
+		// a shadow mask that is still current costs nothing
+		const double cost_ms = batched_shading && shadowMaskCurrent(lights[i], stats) ? 0.0 : (stats.shadow_ms >= 0.0 ? stats.shadow_ms : default_ms);
+
+		if (no_shadowed_lights > 0 && cost_ms > remaining_ms)
+		{
+			continue; // a cheaper light further down may still fit
+		}
+
+		stats.shadowed = true;
+		remaining_ms -= cost_ms;
+		++no_shadowed_lights;
+	}
+}
+/* reads back the timer queries whose results are available, never waits for the GPU */
+void Rasterizer::collectLightTimings()
+{
+	for (LightStats& stats : light_stats)
+	{
+		for (int pass = 0; pass < 2; ++pass)
+		{
+			if (!stats.pending[pass])
+			{
+				continue;
+			}
+
+			GLuint available = GL_FALSE;
+			glGetQueryObjectuiv(stats.queries[pass], GL_QUERY_RESULT_AVAILABLE, &available);
+
+			if (available == GL_TRUE)
+			{
+				GLuint64 elapsed = 0;
+				glGetQueryObjectui64v(stats.queries[pass], GL_QUERY_RESULT, &elapsed);
+				(pass == 0 ? stats.shadow_ms : stats.lighting_ms) = elapsed * 1e-6;
+				stats.pending[pass] = false;
+			}
+		}
+	}
+
+	if (layered_pending)
+	{
+		GLuint available = GL_FALSE;
+		glGetQueryObjectuiv(layered_query, GL_QUERY_RESULT_AVAILABLE, &available);
+
+		if (available == GL_TRUE)
+		{
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(layered_query, GL_QUERY_RESULT, &elapsed);
+
+			// the lights of one draw cost the same
+			for (const int i : layered_timed_lights)
+			{
+				if (i < int(light_stats.size()))
+				{
+					light_stats[i].shadow_ms = elapsed * 1e-6 / layered_timed_lights.size();
+				}
+			}
+			layered_pending = false;
+		}
+	}
+}
+/* starts the timer of the shadow (0) or lighting (1) pass of a light, false while its previous query is still in flight */
+bool Rasterizer::beginLightTimer(LightStats& stats, const int pass)
+{
+	if (stats.pending[pass])
+	{
+		return false;
+	}
+
+	if (stats.queries[0] == 0)
+	{
+		glGenQueries(2, stats.queries);
+	}
+
+	glBeginQuery(GL_TIME_ELAPSED, stats.queries[pass]);
+
+	return true;
+}
+void Rasterizer::endLightTimer(LightStats& stats, const int pass)
+{
+	glEndQuery(GL_TIME_ELAPSED);
+	stats.pending[pass] = true;
+}
+/* z-fail stencil state of the shadow pass, back faces of the volumes increment and front faces decrement where the depth test fails,
+z-pass counts the other way round where it passes so that both methods can add up in one stencil buffer */
+void Rasterizer::setStencilPassState(const bool z_pass)
+{
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthMask(GL_FALSE); 
+	glEnable(GL_DEPTH_CLAMP); 
+	glDisable(GL_CULL_FACE); 
+	glFrontFace(GL_CCW);
+	glEnable(GL_STENCIL_TEST);
+	glDepthFunc(GL_LESS);
+	glStencilMask(0xFF);
+	if (z_pass)
+	{
+		glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_KEEP, GL_INCR_WRAP);
+		glStencilOpSeparate(GL_BACK, GL_KEEP, GL_KEEP, GL_DECR_WRAP);
+	}
+	else
+	{
+		glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_DECR_WRAP, GL_KEEP); 
+		glStencilOpSeparate(GL_BACK, GL_KEEP, GL_INCR_WRAP, GL_KEEP); 
+	}
+	glStencilFunc(GL_ALWAYS, 0, 0xFF); 
+}
+/* sets kCulled of the casters whose bounding sphere extruded away from the light lies outside of a side plane of the view frustum */
+void Rasterizer::cullCasters(const Vector3& light_position)
+{
+	caster_handles.clear();
+
+	for (ObjectHandle object = 0; object < scene.size(); ++object)
+	{
+		if (scene.flags[object] & kCaster)
+		{
+			caster_handles.push_back(object);
+		}
+	}
+
+	caster_spheres.Resize(caster_handles.size());
+	caster_visibility.resize(caster_handles.size());
+
+	for (size_t i = 0; i < caster_handles.size(); ++i)
+	{
+		const Matrix4x4& T = scene.transforms[caster_handles[i]];
+		const Vector3 c = TransformPoint(T, scene.sphere_centers[caster_handles[i]]);
+
+		caster_spheres.x[i] = c.x;
+		caster_spheres.y[i] = c.y;
+		caster_spheres.z[i] = c.z;
+		caster_spheres.r[i] = scene.sphere_radii[caster_handles[i]] * MaxScale(T) + 0.01f; // the volumes start 0.01 further from the light
+	}
+
+	float planes[4][4];
+	ExtractSidePlanes(camera.MVP, planes);
+	CullExtrudedSpheres(planes, light_position, caster_spheres, caster_visibility.data());
+
+	no_culled_casters = 0;
+
+	for (size_t i = 0; i < caster_handles.size(); ++i)
+	{
+		if (caster_visibility[i])
+		{
+			scene.flags[caster_handles[i]] &= ~kCulled;
+		}
+		else
+		{
+			scene.flags[caster_handles[i]] |= kCulled;
+			++no_culled_casters;
+		}
+	}
+}
+/* CC shadow volumes, sets kCulled of the casters without a receiver behind them and clamps the volumes of the rest at their farthest receiver,
+ZP+ keeps them infinite as its near caps count them up to the near plane */
+void Rasterizer::clampCasters(const Vector3& light_position, LightStats* stats)
+{
+	std::fill(scene.extrusion_distances.begin(), scene.extrusion_distances.end(), 0.0f);
+	no_cc_culled_casters = 0;
+
+	if (!cc_volumes)
+	{
+		return;
+	}
+
+	// the receivers do not move, so like the shadow mask the grid of a light holds until the light or the view changes
+	ReceiverGrid& grid = stats ? stats->receiver_grid : receiver_grid;
+
+	if (!stats || !stats->grid_valid || !(stats->grid_light_position == light_position) || !(stats->grid_MVP == camera.MVP))
+	{
+		buildReceiverGrid(light_position, grid);
+
+		if (stats)
+		{
+			stats->grid_valid = true;
+			stats->grid_light_position = light_position;
+			stats->grid_MVP = camera.MVP;
+		}
+	}
+
+	// caster_spheres of cullCasters, the volume of a caster never reaches closer to the light than the near side of its sphere
+	for (size_t i = 0; i < caster_handles.size(); ++i)
+	{
+		const ObjectHandle object = caster_handles[i];
+
+		if (scene.flags[object] & kCulled)
+		{
+			continue;
+		}
+
+		const Vector3 center(caster_spheres.x[i], caster_spheres.y[i], caster_spheres.z[i]);
+		const float distance = (center - light_position).L2Norm();
+		const float max_distance = grid.MaxDistance(center, caster_spheres.r[i]);
+
+		if (max_distance <= distance - caster_spheres.r[i])
+		{
+			scene.flags[object] |= kCulled;
+			++no_cc_culled_casters;
+			++no_culled_casters;
+		}
+		else if (stencil_mode != StencilMode::kZPassPlus)
+		{
+			// past the caster itself, so that the back cap never cuts through its front cap
+			scene.extrusion_distances[object] = std::max(max_distance, distance + caster_spheres.r[i]) * 1.001f;
+		}
+	}
+}
+/* fills the target grid around the light with the receivers in the view */
+void Rasterizer::buildReceiverGrid(const Vector3& light_position, ReceiverGrid& target)
+{
+	float planes[4][4];
+	ExtractSidePlanes(camera.MVP, planes);
+
+	target.Reset(light_position);
+
+	// receivers that look small from the light are added as spheres, the others per triangle in chunks spread over the threads
+	struct TriangleChunk
+	{
+		ObjectHandle object;
+		GLuint first_index;
+		GLuint no_indices;
+	};
+	static const GLuint kChunkIndices = 6 * 4096;
+	std::vector<TriangleChunk> chunks;
+
+	for (ObjectHandle object = 0; object < scene.size(); ++object)
+	{
+		if (!(scene.flags[object] & kReceiver))
+		{
+			continue;
+		}
+
+		const Vector3 center = TransformPoint(scene.transforms[object], scene.sphere_centers[object]);
+		const float radius = scene.sphere_radii[object] * MaxScale(scene.transforms[object]);
+
+		// shadows on receivers outside of the view are never seen
+		bool outside = false;
+
+		for (int p = 0; p < 4; ++p)
+		{
+			outside |= planes[p][0] * center.x + planes[p][1] * center.y + planes[p][2] * center.z + planes[p][3] < -radius;
+		}
+
+		if (outside)
+		{
+			continue;
+		}
+
+		const float distance = (center - light_position).L2Norm();
+
+		if (radius < distance * sinf(2.0f * target.cell_angle()))
+		{
+			target.AddSphere(center, radius);
+			continue;
+		}
+
+		for (GLuint first = 0; first < scene.no_indices[object]; first += kChunkIndices)
+		{
+			chunks.push_back({ object, scene.first_indices[object] + first, std::min(kChunkIndices, scene.no_indices[object] - first) });
+		}
+	}
+
+	if (!chunks.empty())
+	{
+		const int no_threads = int(std::min(chunks.size(), size_t(std::max(1u, std::thread::hardware_concurrency()))));
+		std::vector<ReceiverGrid> grids(no_threads);
+
+		ParallelFor(no_threads, chunks.size(), [&](const int thread, const size_t first, const size_t last) {
+			ReceiverGrid& grid = grids[thread];
+			grid.Reset(light_position);
+
+			for (size_t i = first; i < last; ++i)
+			{
+				const Matrix4x4& T = scene.transforms[chunks[i].object];
+				const GLuint* indices = adjacency_indices.data() + chunks[i].first_index;
+
+				for (GLuint j = 0; j < chunks[i].no_indices; j += 6)
+				{
+					grid.AddTriangle(TransformPoint(T, pool_positions[indices[j]]), TransformPoint(T, pool_positions[indices[j + 2]]),
+						TransformPoint(T, pool_positions[indices[j + 4]]));
+				}
+			}
+		});
+
+		for (const ReceiverGrid& grid : grids)
+		{
+			target.Merge(grid);
+		}
+	}
+}
+/* sets kZFail of the casters whose world space bounds may intersect the pyramid between the light and the near plane in the automatic mode,
+of all casters for z-fail and of none for ZP+ */
+void Rasterizer::classifyCasters(const Vector3& light_position, const StencilMode mode)
+{
+	Vector3 near_corners[4];
+	camera.getNearPlaneCorners(near_corners);
+
+	no_zpass_casters = no_zfail_casters = 0;
+
+	for (ObjectHandle object = 0; object < scene.size(); ++object)
+	{
+		if ((scene.flags[object] & (kCaster | kCulled)) != kCaster)
+		{
+			continue;
+		}
+
+		bool z_fail = mode != StencilMode::kZPassPlus;
+
+		if (mode == StencilMode::kAutomatic)
+		{
+			Vector3 world_min, world_max;
+			TransformBounds(scene.transforms[object], scene.bounds_min[object], scene.bounds_max[object], world_min, world_max);
+
+			// the volumes start at the geometry shifted 0.01 away from the light
+			const Vector3 margin(0.01f, 0.01f, 0.01f);
+			z_fail = IntersectsOcclusionPyramid(light_position, near_corners, world_min - margin, world_max + margin);
+		}
+
+		if (z_fail)
+		{
+			scene.flags[object] |= kZFail;
+			++no_zfail_casters;
+		}
+		else
+		{
+			scene.flags[object] &= ~kZFail;
+			++no_zpass_casters;
+		}
+	}
+}
+/* adjacency ranges and transforms of the casters, the last ones are cut to max_triangles in total */
+std::vector<VolumeCaster> Rasterizer::gatherCasters(const size_t max_triangles) const
+{
+	std::vector<VolumeCaster> casters;
+	size_t no_triangles = 0;
+
+	for (ObjectHandle object = 0; object < scene.size() && no_triangles < max_triangles; ++object)
+	{
+		if ((scene.flags[object] & (kCaster | kCulled)) != kCaster)
+		{
+			continue;
+		}
+
+		const size_t object_triangles = std::min<size_t>(scene.no_indices[object] / 6, max_triangles - no_triangles);
+
+		casters.push_back({ scene.first_indices[object], GLuint(object_triangles * 6), scene.transforms[object] });
+		no_triangles += object_triangles;
+	}
+
+	return casters;
+}
+/* fills the next region of the mapped buffers once the GPU has finished drawing it */
+void Rasterizer::buildCpuShadowVolumes(const Vector3& light_position, const std::vector<VolumeCaster>& casters, const int no_threads, const SimdLevel level)
+{
+	volume_region = (volume_region + 1) % kVolumeRegions;
+
+	GLsync& fence = volume_fences[volume_region];
+
+	if (fence)
+	{
+		// the region must not be overwritten while the GPU may still read it, however long that takes
+		GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000)); // 1 s
+		while (status == GL_TIMEOUT_EXPIRED)
+		{
+			status = glClientWaitSync(fence, 0, GLuint64(1000000000));
+		}
+		if (status == GL_WAIT_FAILED)
+		{
+			printf("Waiting for the fence of the CPU volume region %d failed.\n", volume_region);
+			glFinish();
+		}
+		glDeleteSync(fence);
+		fence = nullptr;
+	}
+
+	size_t no_vertices = 0;
+
+	volume_builder.Build(adjacency_indices.data(), casters, light_position,
+		[&](const size_t required_vertices, const size_t required_indices, GLfloat*& vertices, GLuint*& indices) {
+			reserveCpuShadowVolumes(required_vertices, required_indices);
+			vertices = mapped_volume_vertices + 4 * volume_vertex_capacity * volume_region;
+			indices = mapped_volume_indices + volume_index_capacity * volume_region;
+		},
+		no_vertices, volume_no_indices, no_threads, level);
+}
+/* (re)allocates the persistently mapped regions of the CPU path once a build needs more than they hold, they are not allocated unless the CPU path is used */
+void Rasterizer::reserveCpuShadowVolumes(const size_t no_vertices, const size_t no_indices)
+{
+	if (vao_volumes_cpu != 0 && no_vertices <= volume_vertex_capacity && no_indices <= volume_index_capacity)
+	{
+		return;
+	}
+
+	// every region moves, so all of them have to be finished by the GPU
+	if (vao_volumes_cpu != 0)
+	{
+		glFinish();
+	}
+	for (GLsync& fence : volume_fences)
+	{
+		glDeleteSync(fence);
+		fence = nullptr;
+	}
+	glDeleteBuffers(1, &vbo_volumes_cpu); // deleting a buffer unmaps it
+	glDeleteBuffers(1, &ebo_volumes_cpu);
+	glDeleteVertexArrays(1, &vao_volumes_cpu);
+
+	// a half more than the current output, so that a moving light does not reallocate every frame
+	volume_vertex_capacity = std::max(volume_vertex_capacity, no_vertices + no_vertices / 2 + kVolumeVerticesPerTriangle);
+	volume_index_capacity = std::max(volume_index_capacity, no_indices + no_indices / 2 + kVolumeIndicesPerTriangle);
+
+	const GLbitfield map_flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	const GLsizeiptr vertices_size = sizeof(GLfloat) * 4 * volume_vertex_capacity * kVolumeRegions;
+	const GLsizeiptr indices_size = sizeof(GLuint) * volume_index_capacity * kVolumeRegions;
+
+	glGenBuffers(1, &vbo_volumes_cpu);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo_volumes_cpu);
+	glBufferStorage(GL_ARRAY_BUFFER, vertices_size, nullptr, map_flags);
+	mapped_volume_vertices = static_cast<GLfloat*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, vertices_size, map_flags));
+
+	glGenBuffers(1, &ebo_volumes_cpu);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo_volumes_cpu);
+	glBufferStorage(GL_ELEMENT_ARRAY_BUFFER, indices_size, nullptr, map_flags);
+	mapped_volume_indices = static_cast<GLuint*>(glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0, indices_size, map_flags));
+
+	glGenVertexArrays(1, &vao_volumes_cpu);
+	glBindVertexArray(vao_volumes_cpu);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo_volumes_cpu);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo_volumes_cpu);
+	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (void*)0);
+	glEnableVertexAttribArray(0);
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	printf("CPU shadow volume buffers: %.2f MB mapped for %d regions of %zu vertices and %zu indices\n",
+		(vertices_size + indices_size) / (1024.0 * 1024.0), kVolumeRegions, volume_vertex_capacity, volume_index_capacity);
+}
+/* draws the region written by the last build, the program has to be in use */
+void Rasterizer::drawCpuShadowVolumes()
+{
+	glBindVertexArray(vao_volumes_cpu);
+	glEnable(GL_PRIMITIVE_RESTART_FIXED_INDEX); // the restart index is compared before the base vertex is added
+	glDrawElementsBaseVertex(GL_TRIANGLE_STRIP, GLsizei(volume_no_indices), GL_UNSIGNED_INT,
+		reinterpret_cast<const void*>(sizeof(GLuint) * volume_index_capacity * volume_region), GLint(volume_vertex_capacity * volume_region));
+	glDisable(GL_PRIMITIVE_RESTART_FIXED_INDEX);
+	glBindVertexArray(0);
+
+	volume_fences[volume_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+int Rasterizer::benchmarkShadowVolumes(const int no_frames)
+{
+	const ShadowVolumePath path = shadow_volume_path;
+	const Light& light = lights[0];
+	const std::vector<float> light_position_ws = { light.position.x, light.position.y, light.position.z };
+
+	// depth buffer of the current view, the volumes are tested against it
+	camera.Update();
+	shadow_volume_path = ShadowVolumePath::kGeometryShader;
+	renderFrame();
+	shadow_volume_path = path;
+
+	// all paths count with z-fail like the CPU path and draw every caster with an infinite volume
+	for (ObjectHandle object = 0; object < scene.size(); ++object)
+	{
+		scene.flags[object] &= ~kCulled;
+		scene.extrusion_distances[object] = 0.0f;
+	}
+	classifyCasters(light.position, StencilMode::kZFail);
+
+	size_t no_caster_triangles = 0;
+
+	for (const VolumeCaster& caster : gatherCasters())
+	{
+		no_caster_triangles += caster.no_indices / 6;
+	}
+
+	const int max_threads = std::max(1, int(std::thread::hardware_concurrency()));
+	const SimdLevel level = DetectSimdLevel();
+	GLuint query = 0;
+
+	glGenQueries(1, &query);
+
+	// GPU time of the draws issued by draw(), the CPU time of prepare() is measured separately
+	auto time_frames = [&](const std::function<void()>& prepare, const std::function<void()>& draw, double& cpu_ms, double& gpu_ms) {
+		cpu_ms = gpu_ms = 0.0;
+
+		for (int frame = 0; frame < no_frames; ++frame)
+		{
+			setStencilPassState();
+			glClear(GL_STENCIL_BUFFER_BIT);
+
+			const auto t0 = std::chrono::high_resolution_clock::now();
+			prepare();
+			const auto t1 = std::chrono::high_resolution_clock::now();
+
+			glBeginQuery(GL_TIME_ELAPSED, query);
+			draw();
+			glEndQuery(GL_TIME_ELAPSED);
+
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed); // waits for the GPU
+
+			cpu_ms += std::chrono::duration<double, std::milli>(t1 - t0).count();
+			gpu_ms += elapsed * 1e-6;
+		}
+
+		cpu_ms /= no_frames;
+		gpu_ms /= no_frames;
+	};
+
+	printf("Shadow volume benchmark, %d frames, CPU path with %s\n", no_frames, SimdLevelName(level));
+	printf("%10s %16s %8s %10s %10s\n", "triangles", "path", "threads", "CPU [ms]", "GPU [ms]");
+
+	for (size_t no_triangles = std::max<size_t>(no_caster_triangles / 8, 1); ; no_triangles = std::min(no_triangles * 2, no_caster_triangles))
+	{
+		const std::vector<VolumeCaster> casters = gatherCasters(no_triangles);
+		double cpu_ms = 0.0, gpu_ms = 0.0;
+
+		time_frames([] {}, [&] {
+			glUseProgram(stencil_program);
+			SetMatrix4x4(stencil_program, camera.MVP.data(), "MVP");
+			SetVector3(stencil_program, light_position_ws.data(), "light_position");
+
+			const GLint transform_location = glGetUniformLocation(stencil_program, "object_transform");
+
+			glBindVertexArray(vao_positions);
+			for (VolumeCaster caster : casters)
+			{
+				glUniformMatrix4fv(transform_location, 1, GL_TRUE, caster.transform.data());
+				glDrawElements(GL_TRIANGLES_ADJACENCY, GLsizei(caster.no_indices), GL_UNSIGNED_INT,
+					reinterpret_cast<const void*>(size_t(caster.first_index) * sizeof(GLuint)));
+			}
+			glBindVertexArray(0);
+		}, cpu_ms, gpu_ms);
+
+		printf("%10zu %16s %8s %10s %10.3f\n", no_triangles, "geometry shader", "-", "-", gpu_ms);
+
+		for (int no_threads = 1; ; no_threads = std::min(no_threads * 2, max_threads))
+		{
+			time_frames([&] { buildCpuShadowVolumes(light.position, casters, no_threads, level); }, [&] {
+				glUseProgram(volume_program);
+				SetMatrix4x4(volume_program, camera.MVP.data(), "MVP");
+				drawCpuShadowVolumes();
+			}, cpu_ms, gpu_ms);
+
+			printf("%10zu %16s %8d %10.3f %10.3f\n", no_triangles, "CPU", no_threads, cpu_ms, gpu_ms);
+
+			if (no_threads == max_threads)
+			{
+				break;
+			}
+		}
+
+		if (no_triangles == no_caster_triangles)
+		{
+			break;
+		}
+	}
+
+	// triangle vs edge based volumes of all casters, every interior edge is tested once instead of twice and the caps need no geometry shader
+	GLuint statistics[2] = { 0, 0 };
+
+	glGenQueries(2, statistics);
+
+	for (const ShadowVolumePath volume_path : { ShadowVolumePath::kGeometryShader, ShadowVolumePath::kEdges })
+	{
+		double cpu_ms = 0.0, gpu_ms = 0.0;
+		GLuint64 invocations = 0, primitives = 0;
+
+		time_frames([] {}, [&] {
+			glBeginQuery(GL_GEOMETRY_SHADER_INVOCATIONS, statistics[0]);
+			glBeginQuery(GL_GEOMETRY_SHADER_PRIMITIVES_EMITTED, statistics[1]);
+
+			if (volume_path == ShadowVolumePath::kEdges)
+			{
+				drawEdgeVolumes(light_position_ws.data());
+			}
+			else
+			{
+				glUseProgram(stencil_program);
+				SetMatrix4x4(stencil_program, camera.MVP.data(), "MVP");
+				SetVector3(stencil_program, light_position_ws.data(), "light_position");
+
+				glBindVertexArray(vao_positions);
+				drawObjects(stencil_program, kCaster, kCaster);
+				glBindVertexArray(0);
+			}
+
+			glEndQuery(GL_GEOMETRY_SHADER_PRIMITIVES_EMITTED);
+			glEndQuery(GL_GEOMETRY_SHADER_INVOCATIONS);
+		}, cpu_ms, gpu_ms);
+
+		glGetQueryObjectui64v(statistics[0], GL_QUERY_RESULT, &invocations);
+		glGetQueryObjectui64v(statistics[1], GL_QUERY_RESULT, &primitives);
+
+		printf("%10zu %16s %8s %10s %10.3f  GS invocations %llu, primitives emitted %llu\n", no_caster_triangles,
+			(volume_path == ShadowVolumePath::kEdges) ? "edges + caps" : "geometry shader", "-", "-", gpu_ms,
+			(unsigned long long)invocations, (unsigned long long)primitives);
+	}
+
+	glDeleteQueries(2, statistics);
+	glDeleteQueries(1, &query);
+
+	return S_OK;
+}
+/* classifies the caster triangles in a compute shader and writes the caps and silhouette quads for the indirect stencil draw */
+void Rasterizer::extractShadowVolumes(const GLfloat* light_position)
+{
+	const VolumeCommand empty_command = { 0, 1, 0, 0, 0, 0 };
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, volume_command);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(VolumeCommand), &empty_command);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glUseProgram(volume_compute_program);
+
+	SetVector3(volume_compute_program, light_position, "light_position");
+
+	const GLint transform_location = glGetUniformLocation(volume_compute_program, "object_transform");
+	const GLint first_index_location = glGetUniformLocation(volume_compute_program, "first_primitive_index");
+	const GLint no_primitives_location = glGetUniformLocation(volume_compute_program, "no_primitives");
+	const GLuint group_size = 64; // local_size_x of shadow_volume.comp
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, vbo_positions);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, ebo);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, ssbo_volume_vertices);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, ssbo_volume_indices);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, volume_command);
+
+	// the slots are reserved with atomics, so the dispatches of all casters may overlap
+	for (ObjectHandle object = 0; object < scene.size(); ++object)
+	{
+		if ((scene.flags[object] & (kCaster | kCulled)) != kCaster)
+		{
+			continue;
+		}
+
+		const GLuint no_primitives = scene.no_indices[object] / 6;
+
+		glUniformMatrix4fv(transform_location, 1, GL_TRUE, scene.transforms[object].data());
+		glUniform1ui(first_index_location, scene.first_indices[object]);
+		glUniform1ui(no_primitives_location, no_primitives);
+		glDispatchCompute((no_primitives + group_size - 1) / group_size, 1, 1);
+	}
+
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_ELEMENT_ARRAY_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+}
+/* z-fail volumes of up to kMaxLayeredLights lights with one draw, invocation k of stencil_layered.geom counts into layer k which holds
+a copy of the depth buffer, the lighting pass reads the layers as shadow masks, the culling and clamping of the casters are per light
+so every caster gets infinite volumes with both caps */
+void Rasterizer::renderLayeredShadowPass(const std::vector<int>& batch)
+{
+	const int width = camera.getWidth();
+	const int height = camera.getHeight();
+
+	uploadLayeredLights(batch);
+
+	// the depth of the view into the used layers, their stencil is cleared afterwards
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, frame_fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo_layered_copy);
+	for (int layer = 0; layer < int(batch.size()); ++layer)
+	{
+		glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, tex_layered_depth_stencil, 0, layer);
+		glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo_layered);
+	glStencilMask(0xFF);
+	glClear(GL_STENCIL_BUFFER_BIT);
+
+	setStencilPassState();
+
+	glUseProgram(layered_program);
+
+	SetMatrix4x4(layered_program, camera.MVP.data(), "MVP");
+
+	glBindVertexArray(vao_positions);
+	drawObjects(layered_program, kCaster, kCaster);
+	glBindVertexArray(0);
+	glBindFramebuffer(GL_FRAMEBUFFER, frame_fbo);
+
+	glActiveTexture(GL_TEXTURE9);
+	glBindTexture(GL_TEXTURE_2D_MULTISAMPLE_ARRAY, tex_layered_depth_stencil);
+	glActiveTexture(GL_TEXTURE0);
+}
+/* the volumes of stencil_layered.geom counted by stencil_count.frag with image atomics instead of the stencil, the inverted depth test
+runs before the shader and passes the fragments that fail the z-fail test, light k counts in layer k of tex_shadow_counts or in
+the 8 bit lane k of layer 0, the counts are per pixel against one sample of the depth */
+void Rasterizer::renderCountingPass(const std::vector<int>& batch)
+{
+	const int width = camera.getWidth();
+	const int height = camera.getHeight();
+
+	uploadLayeredLights(batch);
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, frame_fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo_count);
+	glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo_count);
+
+	const GLint zero = 0;
+	glClearTexSubImage(tex_shadow_counts, 0, 0, 0, 0, width, height, packed_counts ? 2 : GLsizei(batch.size()), GL_RED_INTEGER, GL_INT, &zero);
+
+	setStencilPassState();
+	glDisable(GL_STENCIL_TEST);
+	glDepthFunc(GL_GEQUAL); // passes where GL_LESS of the z-fail state fails
+
+	glUseProgram(count_program);
+
+	SetMatrix4x4(count_program, camera.MVP.data(), "MVP");
+	SetInt(count_program, packed_counts, "packed_counts");
+	glBindImageTexture(1, tex_shadow_counts, 0, GL_TRUE, 0, GL_READ_WRITE, GL_R32I);
+
+	glBindVertexArray(vao_positions);
+	drawObjects(count_program, kCaster, kCaster);
+	glBindVertexArray(0);
+	glBindFramebuffer(GL_FRAMEBUFFER, frame_fbo);
+
+	// the lighting and resolve passes fetch the counts
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+	glActiveTexture(GL_TEXTURE15);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, tex_shadow_counts);
+	glActiveTexture(GL_TEXTURE0);
+}
+/* falls back to 32 bit counts once the readers of the previous frame found packed lanes that carried, a count of 256 or more volumes */
+void Rasterizer::checkCountOverflows()
+{
+	GLuint no_overflows = 0;
+	const GLuint zero = 0;
+
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT); // the increments of the shaders
+	glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, acb_count_overflows);
+	glGetBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(GLuint), &no_overflows);
+	glBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(GLuint), &zero);
+	glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+	glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 0, acb_count_overflows);
+
+	if (no_overflows > 0)
+	{
+		printf("Atomic shadow volume counting: 8 bit lanes overflowed at %u fragments, switching to 32 bit\n", no_overflows);
+		packed_counts = false;
+	}
+}
+/* positions of the lights of a batch in the LayeredLights block read by stencil_layered.geom */
+void Rasterizer::uploadLayeredLights(const std::vector<int>& batch)
+{
+	LayeredLights layered_lights = {};
+
+	for (size_t k = 0; k < batch.size(); ++k)
+	{
+		const Vector3& position = lights[batch[k]].position;
+
+		layered_lights.light_positions[k][0] = position.x;
+		layered_lights.light_positions[k][1] = position.y;
+		layered_lights.light_positions[k][2] = position.z;
+	}
+	layered_lights.no_lights = GLint(batch.size());
+
+	glBindBuffer(GL_UNIFORM_BUFFER, ubo_layered_lights);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(LayeredLights), &layered_lights);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+/* hierarchical shadow volumes, the min/max depth of every tile and the z-fail count of the extracted volume triangles that cover a tile whole
+and lie behind all of its pixels, a tile where a triangle may fail the depth test in only some pixels becomes a boundary tile */
+void Rasterizer::classifyTiles()
+{
+	// the depth pass once more into a texture, depth state of renderFrame
+	const GLboolean depth_test = glIsEnabled(GL_DEPTH_TEST);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo_tile_depth);
+	glEnable(GL_DEPTH_TEST);
+	glDepthMask(GL_TRUE);
+	glDisable(GL_DEPTH_CLAMP);
+	glDepthFunc(GL_LEQUAL);
+	glEnable(GL_CULL_FACE);
+	glCullFace(GL_BACK);
+	glClear(GL_DEPTH_BUFFER_BIT);
+
+	glUseProgram(shadow_program_);
+
+	SetMatrix4x4(shadow_program_, camera.MVP.data(), "mlp");
+
+	glBindVertexArray(vao_positions);
+	drawObjects(shadow_program_, 0, 0);
+	glBindVertexArray(0);
+	glBindFramebuffer(GL_FRAMEBUFFER, frame_fbo);
+	if (!depth_test)
+	{
+		glDisable(GL_DEPTH_TEST);
+	}
+
+	glUseProgram(depth_tiles_program);
+
+	SetInt(depth_tiles_program, no_depth_samples, "no_samples");
+
+	glActiveTexture(GL_TEXTURE8);
+	glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, tex_tile_depth);
+	glBindImageTexture(0, tex_depth_tiles, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG32F);
+	glDispatchCompute(no_tiles_x, no_tiles_y, 1);
+	glActiveTexture(GL_TEXTURE0);
+
+	const GLint zero = 0;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo_tiles);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32I, GL_RED_INTEGER, GL_INT, &zero);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+	glUseProgram(volume_tiles_program);
+
+	const GLint viewport_size[2] = { camera.getWidth(), camera.getHeight() };
+	const GLint no_tiles[2] = { no_tiles_x, no_tiles_y };
+
+	SetMatrix4x4(volume_tiles_program, camera.MVP.data(), "MVP");
+	SetInt(volume_tiles_program, kTileSize, "tile_size");
+	glUniform2iv(glGetUniformLocation(volume_tiles_program, "viewport_size"), 1, viewport_size);
+	glUniform2iv(glGetUniformLocation(volume_tiles_program, "no_tiles"), 1, no_tiles);
+
+	glBindImageTexture(0, tex_depth_tiles, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RG32F);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, ssbo_volume_vertices);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, ssbo_volume_indices);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, volume_command);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, ssbo_tiles);
+
+	// the number of strip indices is only known on the GPU, the threads stride over them
+	glDispatchCompute(1024, 1, 1);
+
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+/* writes kTileMarkBit into the stencil of the lit tiles and kTileMarkBit | 1 into the fully shadowed ones, the stencil pass then counts in the boundary tiles only */
+void Rasterizer::markTiles()
+{
+	const GLboolean depth_test = glIsEnabled(GL_DEPTH_TEST);
+
+	glUseProgram(tile_mark_program);
+
+	SetInt(tile_mark_program, kTileSize, "tile_size");
+	SetInt(tile_mark_program, no_tiles_x, "no_tiles_x");
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, ssbo_tiles);
+
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthMask(GL_FALSE);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
+	glEnable(GL_STENCIL_TEST);
+	glStencilMask(0xFF);
+	glStencilOpSeparate(GL_FRONT_AND_BACK, GL_KEEP, GL_KEEP, GL_REPLACE);
+
+	glBindVertexArray(vao_caps); // no attributes
+	for (int shadowed = 0; shadowed < 2; ++shadowed)
+	{
+		SetInt(tile_mark_program, shadowed, "shadowed");
+		glStencilFunc(GL_ALWAYS, kTileMarkBit | shadowed, 0xFF);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+	}
+	glBindVertexArray(0);
+
+	if (depth_test)
+	{
+		glEnable(GL_DEPTH_TEST);
+	}
+}
+/* ZP+ initialization of the stencil buffer, the light facing triangles of the casters without kZFail projected from the light onto the near plane
+increment every near plane pixel once per shadow volume it lies in, then z-pass counts correctly even with the camera inside of a volume */
+void Rasterizer::drawNearCaps(const GLfloat* light_position)
+{
+	Vector3 near_corners[4];
+	camera.getNearPlaneCorners(near_corners);
+
+	Vector3 normal = (near_corners[3] - near_corners[0]).CrossProduct(near_corners[1] - near_corners[0]); // along the view direction
+	normal.Normalize();
+	const std::vector<float> near_plane = { normal.x, normal.y, normal.z, normal.DotProduct(near_corners[0]) };
+
+	glUseProgram(near_caps_program);
+
+	SetMatrix4x4(near_caps_program, camera.MVP.data(), "MVP");
+	SetVector3(near_caps_program, light_position, "light_position");
+	SetVector4(near_caps_program, near_plane.data(), "near_plane");
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, vbo_positions);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, ebo);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, ssbo_face_normals);
+
+	// the caps lie in the near plane, the depth clamp of the stencil pass keeps them from being clipped and the depth test must not reject them
+	glEnable(GL_CLIP_DISTANCE0);
+	glEnable(GL_CLIP_DISTANCE1);
+	glDepthFunc(GL_ALWAYS);
+	glStencilOpSeparate(GL_FRONT_AND_BACK, GL_KEEP, GL_KEEP, GL_INCR_WRAP);
+
+	glBindVertexArray(vao_caps);
+	const GLint transform_location = glGetUniformLocation(near_caps_program, "object_transform");
+
+	for (ObjectHandle object = 0; object < scene.size(); ++object)
+	{
+		if ((scene.flags[object] & (kCaster | kZFail | kCulled)) != kCaster)
+		{
+			continue;
+		}
+
+		glUniformMatrix4fv(transform_location, 1, GL_TRUE, scene.transforms[object].data());
+		glDrawArrays(GL_TRIANGLES, GLint(scene.first_indices[object] / 2), GLsizei(scene.no_indices[object] / 2));
+	}
+	glBindVertexArray(0);
+
+	glDisable(GL_CLIP_DISTANCE0);
+	glDisable(GL_CLIP_DISTANCE1);
+	setStencilPassState();
+}
+/* stencil pass geometry of the edge based volumes, caps by the vertex shader only and silhouette quads by stencil_edges.geom,
+the casters without kZFail are drawn first with z-pass and only the back caps of clamped CC volumes, leaves the z-fail state */
+void Rasterizer::drawEdgeVolumes(const GLfloat* light_position)
+{
+	glUseProgram(edges_program);
+
+	SetMatrix4x4(edges_program, camera.MVP.data(), "MVP");
+	SetVector3(edges_program, light_position, "light_position");
+
+	glBindVertexArray(vao_edges);
+	setStencilPassState(true);
+	drawObjectEdges(edges_program, kCaster | kZFail | kCulled, kCaster);
+
+	glUseProgram(caps_program);
+
+	SetMatrix4x4(caps_program, camera.MVP.data(), "MVP");
+	SetVector3(caps_program, light_position, "light_position");
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, vbo_positions);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, ebo);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, ssbo_face_normals);
+
+	glBindVertexArray(vao_caps);
+	const GLint transform_location = glGetUniformLocation(caps_program, "object_transform");
+	const GLint extrusion_location = glGetUniformLocation(caps_program, "extrusion_distance");
+
+	// 3 vertices per triangle, gl_VertexID / 3 is the triangle in the whole ebo, instance 0 - front cap, 1 - back cap
+	for (ObjectHandle object = 0; object < scene.size(); ++object)
+	{
+		if ((scene.flags[object] & (kCaster | kZFail | kCulled)) != kCaster || scene.extrusion_distances[object] <= 0.0f)
+		{
+			continue;
+		}
+
+		glUniformMatrix4fv(transform_location, 1, GL_TRUE, scene.transforms[object].data());
+		glUniform1f(extrusion_location, scene.extrusion_distances[object]);
+		glDrawArraysInstancedBaseInstance(GL_TRIANGLES, GLint(scene.first_indices[object] / 2), GLsizei(scene.no_indices[object] / 2), 1, 1);
+	}
+
+	setStencilPassState();
+
+	for (ObjectHandle object = 0; object < scene.size(); ++object)
+	{
+		if ((scene.flags[object] & (kCaster | kZFail | kCulled)) != (kCaster | kZFail))
+		{
+			continue;
+		}
+
+		glUniformMatrix4fv(transform_location, 1, GL_TRUE, scene.transforms[object].data());
+		glUniform1f(extrusion_location, scene.extrusion_distances[object]);
+		glDrawArraysInstanced(GL_TRIANGLES, GLint(scene.first_indices[object] / 2), GLsizei(scene.no_indices[object] / 2), 2);
+	}
+
+	glUseProgram(edges_program);
+	glBindVertexArray(vao_edges);
+	drawObjectEdges(edges_program, kCaster | kZFail | kCulled, kCaster | kZFail);
+	glBindVertexArray(0);
+}
+/* draws the unique edges of every object with (flags & mask) == value from vao_edges as GL_LINES_ADJACENCY, the program has to be in use */
+void Rasterizer::drawObjectEdges(const GLuint program, const uint8_t mask, const uint8_t value)
+{
+	const GLint transform_location = glGetUniformLocation(program, "object_transform");
+	const GLint extrusion_location = glGetUniformLocation(program, "extrusion_distance"); // volume programs only
+
+	for (ObjectHandle object = 0; object < scene.size(); ++object)
+	{
+		if ((scene.flags[object] & mask) != value)
+		{
+			continue;
+		}
+
+		glUniformMatrix4fv(transform_location, 1, GL_TRUE, scene.transforms[object].data());
+		if (extrusion_location != -1)
+		{
+			glUniform1f(extrusion_location, scene.extrusion_distances[object]);
+		}
+		glDrawElements(GL_LINES_ADJACENCY, GLsizei(scene.no_edge_indices[object]), GL_UNSIGNED_INT,
+			reinterpret_cast<const void*>(size_t(scene.first_edge_indices[object]) * sizeof(GLuint)));
+	}
+}
+/* draws every object with (flags & mask) == value from the bound vao, the program has to be in use */
+void Rasterizer::drawObjects(const GLuint program, const uint8_t mask, const uint8_t value)
+{
+	const GLint transform_location = glGetUniformLocation(program, "object_transform");
+	const GLint normal_transform_location = glGetUniformLocation(program, "normal_transform"); // shading programs only
+	const GLint extrusion_location = glGetUniformLocation(program, "extrusion_distance"); // volume programs only
+
+	for (ObjectHandle object = 0; object < scene.size(); ++object)
+	{
+		if ((scene.flags[object] & mask) != value)
+		{
+			continue;
+		}
+
+		glUniformMatrix4fv(transform_location, 1, GL_TRUE, scene.transforms[object].data());
+		if (normal_transform_location != -1)
+		{
+			glUniformMatrix4fv(normal_transform_location, 1, GL_TRUE, scene.normal_transforms[object].data());
+		}
+		if (extrusion_location != -1)
+		{
+			glUniform1f(extrusion_location, scene.extrusion_distances[object]);
+		}
+		glDrawElements(GL_TRIANGLES_ADJACENCY, GLsizei(scene.no_indices[object]), GL_UNSIGNED_INT,
+			reinterpret_cast<const void*>(size_t(scene.first_indices[object]) * sizeof(GLuint)));
+	}
+}
+int Rasterizer::InitEnvMap(const std::string& file_name)
+{
+	Texture3f env_map = Texture3f(file_name);
+
+	glGenTextures(1, &tex_env_map);
+	glBindTexture(GL_TEXTURE_2D, tex_env_map);
+	if (glIsTexture(tex_env_map))
+	{
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		// for HDR images use GL_RGB32F or GL_RGB16F as internal format !!!
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F,
+			env_map.width(), env_map.height(), 0,
+			GL_RGB, GL_FLOAT, env_map.data());
+		//glGenerateMipmap( GL_TEXTURE_2D );
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	return S_OK;
+}
+int Rasterizer::SetEnvMap()
+{
+	glActiveTexture(GL_TEXTURE7);
+	glBindTexture(GL_TEXTURE_2D, tex_env_map);
+
+	SetSampler(env_program, 7, "env_map");
+
+	return S_OK;
+}
+int Rasterizer::initOpenGl(int width, int height) {
+	glfwSetErrorCallback(glfw_callback);
+
+	if (!glfwInit())
+	{
+		return(EXIT_FAILURE);
+	}
+
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4); // verze
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6); // verze
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE); // core profile
+	glfwWindowHint(GLFW_SAMPLES, 8); // anti-aliasing (8 sampl)
+	glfwWindowHint(GLFW_RESIZABLE, GL_TRUE); // zmna velikosti okna za bhu
+	glfwWindowHint(GLFW_DOUBLEBUFFER, GL_TRUE); // na back buffer kreslm, front vidm (pro plynulost)
+
+	window = glfwCreateWindow(width, height, "OpenGL - stencil shadows", nullptr, nullptr);
+
+	if (!window)
+	{
+		glfwTerminate();
+		return EXIT_FAILURE;
+	}
+
+	glfwSetFramebufferSizeCallback(window, framebuffer_resize_callback); // kdy se zmn velikost okna
+	glfwMakeContextCurrent(window); // v OPENGL mu volat jen z vlkna, ve kter jsme to vytvoili
+	// nastavm domovsk current kontext
+
+	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) // natu vechny funkce OpenGL
+	{
+		if (!gladLoadGL())
+		{
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (glfwExtensionSupported("GL_EXT_depth_bounds_test"))
+	{
+		depth_bounds_ext = reinterpret_cast<PFNGLDEPTHBOUNDSEXTPROC>(glfwGetProcAddress("glDepthBoundsEXT"));
+	}
+	printf("Depth bounds test: %s\n", (depth_bounds_ext != nullptr) ? "GL_EXT_depth_bounds_test" : "not supported, scissor only");
+
+	glEnable(GL_DEBUG_OUTPUT);
+	glDebugMessageCallback(gl_callback, nullptr); // v OpenGL je sloit debugovat 
+	// kdy vznikne chba, vrt se do konzole ten error (errory jsou v referenn pruce)
+
+	printf("OpenGL %s, ", glGetString(GL_VERSION));
+	printf("%s", glGetString(GL_RENDERER));
+	printf(" (%s)\n", glGetString(GL_VENDOR));
+	printf("GLSL %s\n", glGetString(GL_SHADING_LANGUAGE_VERSION));
+
+	glEnable(GL_MULTISAMPLE);
+
+	// map from the range of NDC coordinates <-1.0, 1.0>^2 to <0, width> x <0, height>
+	glViewport(0, 0, width, height);
+	// GL_LOWER_LEFT (OpenGL) or GL_UPPER_LEFT (DirectX, Windows) and GL_NEGATIVE_ONE_TO_ONE or GL_ZERO_TO_ONE
+	//glClipControl(GL_UPPER_LEFT, GL_NEGATIVE_ONE_TO_ONE); // ( odkud se pot obrzek , pseudohloubka)
+	glClipControl(GL_LOWER_LEFT, GL_NEGATIVE_ONE_TO_ONE); // ( odkud se pot obrzek , pseudohloubka)
+
+}
+void Rasterizer::loadMesh(const std::string& file_name, const std::string model) {
+	SceneGraph scene;
+
+	LoadOBJ(file_name, scene, materials_, true); // true - load adjacentTriangles
+
+	std::vector<Vertex> vert;
+
+	for (SceneGraph::iterator iter = scene.begin(); iter != scene.end(); ++iter)
+	{
+		const std::string& node_name = iter->first;
+		const auto& node = iter->second;
+
+		const auto& mesh = std::static_pointer_cast<Mesh>(node);
+
+		if (mesh)
+		{
+			const MeshView mesh_view(*mesh, materials_);
+
+			vert.reserve(vert.size() + mesh_view.size() * 3);
+
+			for (const PatchView& patch : mesh_view.patches())
+			for (const TriangleView src_triangle : patch)
+			{
+				const int material_index = patch.material_index();
+
+				for (int i = 0; i < 3; ++i) {
+					Vertex new_vertex;
+					new_vertex.position = src_triangle.position(i);
+					new_vertex.normal = src_triangle.normal(i);
+					new_vertex.tangent = src_triangle.tangent(i);
+					new_vertex.texture_coord = Vector2(src_triangle.texture_coord(i).x, src_triangle.texture_coord(i).y);
+					new_vertex.material_index = material_index;
+
+					vert.push_back(new_vertex);
+				}
+				/*
+				for (int i = 0; i < 3; ++i)
+				{
+					std::optional<Vector3> av = src_triangle.adjacent_vertex_position(i);
+					if (av.has_value())
+					{
+						av.value().Print();
+					}
+					else
+					{
+						printf("-\n");
+					}
+				}*/
+			}
+		}
+	}
+	if (model.compare("map") == 0) {
+		this->loadedVerticesMap = vert;
+		this->map_loaded = true;
+	}
+	else {
+		this->loadedVertices = vert;
+	}
+}
+void Rasterizer::loadMesh_triangles(const std::string& file_name, const VertexLayout layout)
+{
+	vertex_layout = layout;
+
+	const auto t0 = std::chrono::high_resolution_clock::now();
+
+	if (loadMeshCache(file_name) != S_OK)
+	{
+		buildVertexPool(file_name);
+	}
+	scene.SetMaterials(materials_);
+
+	const auto t1 = std::chrono::high_resolution_clock::now();
+	const double mb = 1024.0 * 1024.0;
+	const size_t no_indices = adjacency_indices.size();
+
+	printf("Mesh '%s' loaded in %.3f s: %zu triangles, %zu unique vertices (%.2f MB positions, %.2f MB attributes, %.2f MB indices)\n", file_name.c_str(),
+		std::chrono::duration<double>(t1 - t0).count(), no_indices / 6, pool_positions.size(), pool_positions.size() * sizeof(Vector3) / mb,
+		pool_positions.size() * sizeof(VertexAttributes) / mb, no_indices * sizeof(GLuint) / mb);
+	printf("Scene: %zu objects, %zu materials\n", scene.size(), scene.materials.size());
+	// upper bound of the vertex fetch of one depth or stencil draw, i.e. without any post-transform cache hits
+	printf("Depth/stencil pass vertex fetch: %.2f MB per draw (%.2f MB with interleaved vertices)\n",
+		no_indices * sizeof(Vector3) / mb, no_indices * (sizeof(Vector3) + sizeof(VertexAttributes)) / mb);
+}
+/* unique edges and face normals of every object for the edge based volumes, derived from the adjacency indices so both load paths share it */
+void Rasterizer::buildEdges()
+{
+	edge_indices.clear();
+	face_normals.resize(adjacency_indices.size() / 6);
+
+	for (size_t i = 0; i < face_normals.size(); ++i)
+	{
+		const Vector3& v0 = pool_positions[adjacency_indices[6 * i]];
+
+		face_normals[i] = (pool_positions[adjacency_indices[6 * i + 2]] - v0).CrossProduct(pool_positions[adjacency_indices[6 * i + 4]] - v0);
+	}
+
+	size_t no_edges = 0;
+
+	for (ObjectHandle object = 0; object < scene.size(); ++object)
+	{
+		scene.first_edge_indices[object] = GLuint(edge_indices.size());
+		no_edges += BuildEdgeList(adjacency_indices.data() + scene.first_indices[object], scene.no_indices[object], pool_positions.data(), edge_indices);
+		scene.no_edge_indices[object] = GLuint(edge_indices.size() - scene.first_edge_indices[object]);
+	}
+
+	printf("Edge list: %zu unique edges for %zu triangles\n", no_edges, adjacency_indices.size() / 6);
+}
+/* attributes of a vertex of the pool, the first no_cached_vertices live in the mapped mesh cache */
+const VertexAttributes& Rasterizer::poolAttributes(const size_t vertex) const
+{
+	if (vertex < no_cached_vertices)
+	{
+		return static_cast<const VertexAttributes*>(mesh_cache.attributes)[vertex];
+	}
+
+	return pool_attributes[vertex - no_cached_vertices];
+}
+void Rasterizer::generateGridScene(const int no_rows, const int no_columns, const float spacing)
+{
+	const ObjectHandle no_objects = ObjectHandle(scene.size());
+
+	if (no_objects == 0)
+	{
+		printf("Grid scene: no objects to copy.\n");
+		return;
+	}
+
+	// world bounds of the loaded objects, the ground lies under their lowest point
+	Vector3 lower(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+	Vector3 upper = -lower;
+
+	for (ObjectHandle object = 0; object < no_objects; ++object)
+	{
+		Vector3 world_min, world_max;
+		TransformBounds(scene.transforms[object], scene.bounds_min[object], scene.bounds_max[object], world_min, world_max);
+
+		lower = Vector3(std::min(lower.x, world_min.x), std::min(lower.y, world_min.y), std::min(lower.z, world_min.z));
+		upper = Vector3(std::max(upper.x, world_max.x), std::max(upper.y, world_max.y), std::max(upper.z, world_max.z));
+	}
+
+	// the ground is tessellated so that the receiver grid sees its distances per cell and not only its farthest corner
+	static const int kGroundCells = 32;
+	const float x0 = lower.x - spacing;
+	const float y0 = lower.y - spacing;
+	const float size_x = upper.x - lower.x + (no_columns + 1) * spacing;
+	const float size_y = upper.y - lower.y + (no_rows + 1) * spacing;
+	const GLuint first_vertex = GLuint(pool_positions.size());
+	const GLuint first_index = GLuint(adjacency_indices.size());
+	const int material_index = poolAttributes(adjacency_indices[scene.first_indices[0]]).material_index;
+
+	for (int j = 0; j <= kGroundCells; ++j)
+	{
+		for (int i = 0; i <= kGroundCells; ++i)
+		{
+			const float u = float(i) / kGroundCells;
+			const float v = float(j) / kGroundCells;
+
+			VertexAttributes attributes;
+			attributes.normal = Vector3(0.0f, 0.0f, 1.0f);
+			attributes.tangent = Vector3(1.0f, 0.0f, 0.0f);
+			attributes.texture_coord = Vector2(u, v);
+			attributes.material_index = material_index;
+
+			pool_positions.push_back(Vector3(x0 + u * size_x, y0 + v * size_y, lower.z));
+			pool_attributes.push_back(attributes);
+		}
+	}
+
+	// the ground never casts, so every edge gets the opposite corner of its own triangle instead of a neighbour
+	auto add_triangle = [&](const GLuint a, const GLuint b, const GLuint c) {
+		const GLuint triangle[6] = { a, c, b, a, c, b };
+		adjacency_indices.insert(adjacency_indices.end(), triangle, triangle + 6);
+	};
+
+	for (int j = 0; j < kGroundCells; ++j)
+	{
+		for (int i = 0; i < kGroundCells; ++i)
+		{
+			const GLuint v00 = first_vertex + GLuint(j * (kGroundCells + 1) + i);
+			const GLuint v10 = v00 + 1;
+			const GLuint v01 = v00 + kGroundCells + 1;
+			const GLuint v11 = v01 + 1;
+
+			add_triangle(v00, v10, v11); // CCW seen from +z
+			add_triangle(v00, v11, v01);
+		}
+	}
+
+	const ObjectHandle ground = scene.Add("grid_ground", first_index, GLuint(adjacency_indices.size()) - first_index, scene.material_ids[0], kReceiver);
+	scene.UpdateBounds(ground, pool_positions.data(), adjacency_indices.data());
+	buildEdges();
+
+	// the copies share the index and edge ranges of their originals
+	for (int row = 0; row < no_rows; ++row)
+	{
+		for (int column = 0; column < no_columns; ++column)
+		{
+			if (row == 0 && column == 0)
+			{
+				continue; // the originals
+			}
+
+			for (ObjectHandle object = 0; object < no_objects; ++object)
+			{
+				const ObjectHandle copy = scene.Add(scene.names[object] + "_" + std::to_string(row) + "_" + std::to_string(column),
+					scene.first_indices[object], scene.no_indices[object], scene.material_ids[object], scene.flags[object]);
+
+				Matrix4x4 transform = scene.transforms[object];
+				transform.set(0, 3, transform.get(0, 3) + column * spacing);
+				transform.set(1, 3, transform.get(1, 3) + row * spacing);
+
+				scene.transforms[copy] = transform;
+				scene.bounds_min[copy] = scene.bounds_min[object];
+				scene.bounds_max[copy] = scene.bounds_max[object];
+				scene.sphere_centers[copy] = scene.sphere_centers[object];
+				scene.sphere_radii[copy] = scene.sphere_radii[object];
+				scene.first_edge_indices[copy] = scene.first_edge_indices[object];
+				scene.no_edge_indices[copy] = scene.no_edge_indices[object];
+			}
+		}
+	}
+	scene.UpdateNormalTransforms();
+
+	printf("Grid scene: %d x %d copies of %u objects on %d ground triangles, %zu objects\n", no_rows, no_columns, no_objects,
+		2 * kGroundCells * kGroundCells, scene.size());
+}
+/* appends the vertex pool, adjacency indices and materials stored in the cache of the OBJ file, no parsing and no adjacency search */
+int Rasterizer::loadMeshCache(const std::string& file_name)
+{
+	// the first mesh keeps its cache mapped, the attributes of later ones are copied into the pool
+	MeshCache local_cache;
+	MeshCache& cache = (no_cached_vertices == 0 && pool_positions.empty()) ? mesh_cache : local_cache;
+
+	if (LoadMeshCache(file_name, sizeof(VertexAttributes), cache) != S_OK)
+	{
+		return S_FALSE;
+	}
+
+	// material indices of the cache refer to its own table while the library may already contain other materials
+	std::vector<int> material_indices(cache.no_materials);
+
+	for (size_t i = 0; i < cache.no_materials; ++i)
+	{
+		const MeshCacheMaterial& src = cache.materials[i];
+		std::shared_ptr<Material>& material = materials_[src.name];
+
+		if (!material)
+		{
+			material = std::make_shared<Material>(std::string(src.name));
+			material->ambient_ = Color3f({ src.ambient[0], src.ambient[1], src.ambient[2] });
+			material->set_value(Map::kDiffuse, Color3f({ src.diffuse[0], src.diffuse[1], src.diffuse[2] }));
+			material->set_value(Map::kSpecular, Color3f({ src.specular[0], src.specular[1], src.specular[2] }));
+			material->emission_ = Color3f({ src.emission[0], src.emission[1], src.emission[2] });
+			material->set_shininess(src.shininess);
+			material->ior = src.ior;
+			material->roughness_ = src.roughness;
+			material->metallic_ = src.metallic;
+		}
+	}
+	bool same_materials = true; // the material indices of the attributes are valid as stored
+
+	for (size_t i = 0; i < cache.no_materials; ++i)
+	{
+		material_indices[i] = int(std::distance(std::begin(materials_), materials_.find(cache.materials[i].name)));
+		same_materials = same_materials && material_indices[i] == int(i);
+	}
+
+	const GLuint first_vertex = GLuint(pool_positions.size());
+	const size_t first_index = adjacency_indices.size();
+	const size_t first_edge_index = edge_indices.size();
+
+	// the positions and indices are read by the CPU paths, so they are copied once, and range checked on the way
+	bool valid = true;
+
+	adjacency_indices.resize(first_index + cache.no_indices);
+	for (size_t i = 0; i < cache.no_indices; ++i)
+	{
+		valid &= cache.indices[i] < cache.no_vertices;
+		adjacency_indices[first_index + i] = cache.indices[i] + first_vertex;
+	}
+	edge_indices.resize(first_edge_index + cache.no_edge_indices);
+	for (size_t i = 0; i < cache.no_edge_indices; ++i)
+	{
+		valid &= cache.edge_indices[i] < cache.no_vertices;
+		edge_indices[first_edge_index + i] = cache.edge_indices[i] + first_vertex;
+	}
+
+	if (!valid)
+	{
+		printf("Mesh cache '%s' is corrupt, rebuilding.\n", MeshCacheFileName(file_name).c_str());
+		adjacency_indices.resize(first_index);
+		edge_indices.resize(first_edge_index);
+		cache.file.Close();
+
+		return S_FALSE;
+	}
+
+	pool_positions.insert(pool_positions.end(), cache.positions, cache.positions + cache.no_vertices);
+	face_normals.insert(face_normals.end(), cache.face_normals, cache.face_normals + cache.no_indices / 6);
+
+	if (&cache == &mesh_cache && same_materials)
+	{
+		no_cached_vertices = cache.no_vertices;
+	}
+	else
+	{
+		const VertexAttributes* attributes = static_cast<const VertexAttributes*>(cache.attributes);
+		const size_t first_attribute = pool_attributes.size();
+
+		pool_attributes.insert(pool_attributes.end(), attributes, attributes + cache.no_vertices);
+
+		for (size_t i = first_attribute; i < pool_attributes.size(); ++i)
+		{
+			int& material_index = pool_attributes[i].material_index;
+
+			if (material_index >= 0 && material_index < int(material_indices.size()))
+			{
+				material_index = material_indices[material_index];
+			}
+		}
+	}
+
+	for (size_t i = 0; i < cache.no_objects; ++i)
+	{
+		const MeshCacheObject& src = cache.objects[i];
+		const int material_id = (src.material_id >= 0 && src.material_id < int(material_indices.size())) ? material_indices[src.material_id] : -1;
+		const ObjectHandle object = scene.Add(src.name, GLuint(first_index + src.first_index), src.no_indices, material_id, uint8_t(src.flags));
+
+		scene.first_edge_indices[object] = GLuint(first_edge_index + src.first_edge_index);
+		scene.no_edge_indices[object] = src.no_edge_indices;
+
+		scene.bounds_min[object] = Vector3(src.bounds_min[0], src.bounds_min[1], src.bounds_min[2]);
+		scene.bounds_max[object] = Vector3(src.bounds_max[0], src.bounds_max[1], src.bounds_max[2]);
+		scene.sphere_centers[object] = Vector3(src.sphere[0], src.sphere[1], src.sphere[2]);
+		scene.sphere_radii[object] = src.sphere[3];
+	}
+
+	if (no_cached_vertices == 0)
+	{
+		cache.file.Close();
+	}
+
+	printf("Edge list: %zu unique edges for %zu triangles (cached)\n", cache.no_edge_indices / 4, cache.no_indices / 6);
+
+	return S_OK;
+}
+/* builds the vertex pool and adjacency indices from the OBJ file and writes them to the cache */
+void Rasterizer::buildVertexPool(const std::string& file_name)
+{
+	SceneGraph scene_graph;
+	std::vector<std::string> material_libraries;
+
+	LoadOBJParallel(file_name, scene_graph, materials_, true, 0, &material_libraries);
+
+	const size_t cache_first_vertex = pool_positions.size();
+	const size_t cache_first_attribute = pool_attributes.size(); // behind the vertices of a mapped cache
+	const size_t cache_first_index = adjacency_indices.size();
+	struct MeshRange
+	{
+		const std::string* name;
+		size_t first; // [first, last) adjacency index of the mesh
+		size_t last;
+		int material_index; // material of the largest patch
+	};
+	std::vector<MeshRange> mesh_ranges;
+
+	// a vertex of the pool is given by its attribute indices and material, adjacent vertices only need a position
+	struct VertexKey
+	{
+		int position_index;
+		int texture_coord_index;
+		int normal_index;
+		int material_index;
+
+		bool operator==(const VertexKey& other) const {
+			return position_index == other.position_index && texture_coord_index == other.texture_coord_index &&
+				normal_index == other.normal_index && material_index == other.material_index;
+		}
+	};
+	struct VertexKeyHash
+	{
+		size_t operator()(const VertexKey& key) const {
+			size_t hash = std::hash<int>()(key.position_index);
+			hash = hash * 31 + std::hash<int>()(key.texture_coord_index);
+			hash = hash * 31 + std::hash<int>()(key.normal_index);
+			return hash * 31 + std::hash<int>()(key.material_index);
+		}
+	};
+
+	const GLuint no_vertex = std::numeric_limits<GLuint>::max();
+	GLuint null_vertex = no_vertex; // shared vertex in the origin for edges without a neighbour
+
+	for (SceneGraph::iterator iter = scene_graph.begin(); iter != scene_graph.end(); ++iter)
+	{
+		const std::string& node_name = iter->first;
+		const auto& node = iter->second;
+
+		const auto& mesh = std::static_pointer_cast<Mesh>(node);
+
+		if (mesh)
+		{
+			const MeshView mesh_view(*mesh, materials_);
+			std::unordered_map<VertexKey, GLuint, VertexKeyHash> pool_indices;
+			std::vector<GLuint> position_to_pool(mesh->vertex_buffer().positions.size(), no_vertex);
+			const size_t first_index = adjacency_indices.size();
+			int mesh_material_index = -1;
+			size_t mesh_material_faces = 0;
+
+			pool_indices.reserve(mesh_view.size() * 3);
+			adjacency_indices.reserve(first_index + mesh_view.size() * 6);
+
+			for (const PatchView& patch : mesh_view.patches())
+			{
+				if (patch.size() > mesh_material_faces)
+				{
+					mesh_material_faces = patch.size();
+					mesh_material_index = patch.material_index();
+				}
+			}
+
+			for (const PatchView& patch : mesh_view.patches())
+			for (const TriangleView src_triangle : patch)
+			{
+				const int material_index = patch.material_index();
+
+				for (int i = 0; i < 3; ++i)
+				{
+					const VertexKey key = { src_triangle.position_index(i), src_triangle.texture_coord_index(i), src_triangle.normal_index(i), material_index };
+					const auto inserted = pool_indices.emplace(key, GLuint(pool_positions.size()));
+
+					if (inserted.second)
+					{
+						VertexAttributes new_vertex;
+						new_vertex.normal = src_triangle.normal(i);
+						new_vertex.texture_coord = Vector2(src_triangle.texture_coord(i).x, src_triangle.texture_coord(i).y);
+						new_vertex.tangent = src_triangle.tangent(i);
+						new_vertex.material_index = material_index;
+
+						pool_positions.push_back(src_triangle.position(i));
+						pool_attributes.push_back(new_vertex);
+						position_to_pool[key.position_index] = inserted.first->second;
+					}
+
+					adjacency_indices.push_back(inserted.first->second);
+					adjacency_indices.push_back(GLuint(src_triangle.adjacency(i))); // position index, resolved below
+				}
+			}
+
+			// every adjacent position is a corner of another triangle of this mesh, so it is in the pool by now
+			for (size_t i = first_index + 1; i < adjacency_indices.size(); i += 2)
+			{
+				const int position_index = int(adjacency_indices[i]);
+
+				if (position_index < 0 || position_to_pool[position_index] == no_vertex)
+				{
+					if (null_vertex == no_vertex)
+					{
+						VertexAttributes new_vertex;
+						new_vertex.material_index = -1;
+
+						null_vertex = GLuint(pool_positions.size());
+						pool_positions.push_back(Vector3());
+						pool_attributes.push_back(new_vertex);
+					}
+					adjacency_indices[i] = null_vertex;
+				}
+				else
+				{
+					adjacency_indices[i] = position_to_pool[position_index];
+				}
+			}
+
+			mesh_ranges.push_back({ &node_name, first_index, adjacency_indices.size(), mesh_material_index });
+		}
+	}
+
+	// indices of the cache are relative to its own first vertex
+	std::vector<GLuint> cache_indices(adjacency_indices.begin() + cache_first_index, adjacency_indices.end());
+	const size_t no_cache_vertices = pool_positions.size() - cache_first_vertex;
+
+	for (GLuint& index : cache_indices)
+	{
+		index -= GLuint(cache_first_vertex);
+	}
+
+	// primitives of every mesh are reordered for the post-transform cache, then the vertices for fetch locality
+	const VertexCacheStatistics before = AnalyzeVertexCache(cache_indices.data(), cache_indices.size(), no_cache_vertices);
+
+	for (const auto& range : mesh_ranges)
+	{
+		OptimizeVertexCache(cache_indices.data() + (range.first - cache_first_index), range.last - range.first);
+	}
+
+	const VertexCacheStatistics after = AnalyzeVertexCache(cache_indices.data(), cache_indices.size(), no_cache_vertices);
+	const std::vector<GLuint> remap = OptimizeVertexFetch(cache_indices.data(), cache_indices.size(), no_cache_vertices);
+
+	std::vector<Vector3> positions(pool_positions.begin() + cache_first_vertex, pool_positions.end());
+	std::vector<VertexAttributes> attributes(pool_attributes.begin() + cache_first_attribute, pool_attributes.end());
+
+	RemapVertices(positions, remap);
+	RemapVertices(attributes, remap);
+	std::copy(positions.begin(), positions.end(), pool_positions.begin() + cache_first_vertex);
+	std::copy(attributes.begin(), attributes.end(), pool_attributes.begin() + cache_first_attribute);
+
+	for (size_t i = 0; i < cache_indices.size(); ++i)
+	{
+		adjacency_indices[cache_first_index + i] = cache_indices[i] + GLuint(cache_first_vertex);
+	}
+
+	printf("Vertex cache (FIFO %d, %d vertices per primitive): ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", kVertexCacheSize, kAdjacencyPrimitiveSize,
+		before.acmr, after.acmr, before.atvr, after.atvr);
+
+	// every mesh becomes one object, the primitive reordering kept the ranges intact
+	const ObjectHandle first_object = ObjectHandle(scene.size());
+
+	for (const MeshRange& range : mesh_ranges)
+	{
+		const ObjectHandle object = scene.Add(*range.name, GLuint(range.first), GLuint(range.last - range.first), range.material_index);
+
+		scene.UpdateBounds(object, pool_positions.data(), adjacency_indices.data());
+	}
+
+	buildEdges();
+
+	// edges of the cache are relative to its own first edge and vertex like the indices
+	const size_t cache_first_edge_index = (mesh_ranges.empty()) ? edge_indices.size() : scene.first_edge_indices[first_object];
+	std::vector<GLuint> cache_edge_indices(edge_indices.begin() + cache_first_edge_index, edge_indices.end());
+
+	for (GLuint& index : cache_edge_indices)
+	{
+		index -= GLuint(cache_first_vertex);
+	}
+
+	std::vector<MeshCacheObject> objects(mesh_ranges.size());
+
+	for (size_t i = 0; i < mesh_ranges.size(); ++i)
+	{
+		const MeshRange& range = mesh_ranges[i];
+		const ObjectHandle object = first_object + ObjectHandle(i);
+
+		MeshCacheObject& dst = objects[i];
+		strncpy(dst.name, range.name->c_str(), sizeof(dst.name) - 1);
+		dst.first_index = uint32_t(range.first - cache_first_index);
+		dst.no_indices = scene.no_indices[object];
+		dst.first_edge_index = uint32_t(scene.first_edge_indices[object] - cache_first_edge_index);
+		dst.no_edge_indices = scene.no_edge_indices[object];
+		dst.material_id = range.material_index; // the cache materials are written in library order
+		dst.flags = scene.flags[object];
+		const Vector3& lower = scene.bounds_min[object];
+		const Vector3& upper = scene.bounds_max[object];
+		const Vector3& center = scene.sphere_centers[object];
+		std::copy_n(&lower.x, 3, dst.bounds_min);
+		std::copy_n(&upper.x, 3, dst.bounds_max);
+		std::copy_n(&center.x, 3, dst.sphere);
+		dst.sphere[3] = scene.sphere_radii[object];
+	}
+
+	SaveMeshCache(file_name, material_libraries, pool_positions.data() + cache_first_vertex, pool_attributes.data() + cache_first_attribute, sizeof(VertexAttributes),
+		no_cache_vertices, cache_indices.data(), cache_indices.size(), cache_edge_indices.data(), cache_edge_indices.size(),
+		face_normals.data() + cache_first_index / 6, materials_, objects);
+}
+void Rasterizer::initSurface() {
+
+	const int no_vertices = loadedVertices.size();
+	
+	const int vertex_stride = sizeof(Vertex);
+
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+
+	glGenBuffers(1, &vbo); // generate vertex buffer object (one of OpenGL objects) and get the unique ID corresponding to that buffer
+	glBindBuffer(GL_ARRAY_BUFFER, vbo); // bind the newly created buffer to the GL_ARRAY_BUFFER target
+	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * no_vertices, loadedVertices.data(), GL_STATIC_DRAW); // copies the previously defined vertex data into the buffer's memory
+	// vertex position
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, vertex_stride, (void*)(offsetof(Vertex, position)));
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, vertex_stride, (void*)(offsetof(Vertex, normal)));
+	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, vertex_stride, (void*)(offsetof(Vertex, tangent)));
+	glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, vertex_stride, (void*)(offsetof(Vertex, texture_coord)));
+	glVertexAttribIPointer(4, 1, GL_INT, vertex_stride, (void*)(offsetof(Vertex, material_index)));
+
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glEnableVertexAttribArray(2);
+	glEnableVertexAttribArray(3);
+	glEnableVertexAttribArray(4);
+
+	glBindVertexArray(0);
+}
+void Rasterizer::initSurfaceEnvMap() {
+	if (loadedVerticesMap.size() > 0) {
+		const int no_vertices_map = loadedVerticesMap.size();
+
+		const int vertex_stride = sizeof(Vertex);
+
+		glGenVertexArrays(1, &vao_env);
+		glBindVertexArray(vao_env);
+
+		glGenBuffers(1, &vbo_env); // generate vertex buffer object (one of OpenGL objects) and get the unique ID corresponding to that buffer
+		glBindBuffer(GL_ARRAY_BUFFER, vbo_env); // bind the newly created buffer to the GL_ARRAY_BUFFER target
+		glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * no_vertices_map, loadedVerticesMap.data(), GL_STATIC_DRAW); // copies the previously defined vertex data into the buffer's memory
+		
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, vertex_stride, (void*)(offsetof(Vertex, position)));
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, vertex_stride, (void*)(offsetof(Vertex, normal)));
+		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, vertex_stride, (void*)(offsetof(Vertex, tangent)));
+		glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, vertex_stride, (void*)(offsetof(Vertex, texture_coord)));
+		glEnableVertexAttribArray(0);
+		glEnableVertexAttribArray(1);
+		glEnableVertexAttribArray(2);
+		glEnableVertexAttribArray(3);
+	}
+	else {
+		printf("Environmental map did not load properly");
+	}
+}
+void Rasterizer::initSurfaceTriangles() {
+
+	const int no_vertices = pool_positions.size();
+
+	glGenBuffers(1, &vbo_positions);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo_positions);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(Vector3) * no_vertices, pool_positions.data(), GL_STATIC_DRAW);
+
+	glGenBuffers(1, &vbo); // generate vertex buffer object (one of OpenGL objects) and get the unique ID corresponding to that buffer
+
+	glGenBuffers(1, &ebo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * adjacency_indices.size(), adjacency_indices.data(), GL_STATIC_DRAW);
+
+	// depth and stencil passes only read the position stream
+	glGenVertexArrays(1, &vao_positions);
+	glBindVertexArray(vao_positions);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo); // the element buffer binding is part of the vao state
+	glBindBuffer(GL_ARRAY_BUFFER, vbo_positions);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vector3), (void*)0);
+	glEnableVertexAttribArray(0);
+
+	// edge based volumes read the positions through the edge indices
+	glGenBuffers(1, &ebo_edges);
+	glGenVertexArrays(1, &vao_edges);
+	glBindVertexArray(vao_edges);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo_edges);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * edge_indices.size(), edge_indices.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo_positions);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vector3), (void*)0);
+	glEnableVertexAttribArray(0);
+
+	// the caps pull positions, indices and face normals from ssbos, their vao has no attributes
+	glGenBuffers(1, &ssbo_face_normals);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo_face_normals);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(Vector3) * face_normals.size(), face_normals.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glGenVertexArrays(1, &vao_caps);
+
+	// lighting pass reads both streams
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo_positions);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vector3), (void*)0);
+	glEnableVertexAttribArray(0);
+
+	uploadVertexAttributes();
+}
+/* (re)fills the attribute stream in the selected layout and points the lighting vao to it */
+void Rasterizer::uploadVertexAttributes() {
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+
+	if (vertex_layout == VertexLayout::kCompact)
+	{
+		std::vector<CompactVertexAttributes> compact_attributes(pool_positions.size());
+
+		for (size_t i = 0; i < compact_attributes.size(); ++i)
+		{
+			const VertexAttributes& src = poolAttributes(i);
+			CompactVertexAttributes& dst = compact_attributes[i];
+
+			EncodeOctahedral(src.normal, dst.normal);
+			dst.texture_coord[0] = FloatToHalf(src.texture_coord.x);
+			dst.texture_coord[1] = FloatToHalf(src.texture_coord.y);
+			dst.material_index = GLushort(src.material_index); // -1 of the null vertex becomes 0xFFFF
+		}
+
+		const int vertex_stride = sizeof(CompactVertexAttributes);
+
+		glBufferData(GL_ARRAY_BUFFER, sizeof(CompactVertexAttributes) * compact_attributes.size(), compact_attributes.data(), GL_STATIC_DRAW);
+
+		glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, vertex_stride, (void*)(offsetof(CompactVertexAttributes, normal)));
+		glVertexAttribPointer(3, 2, GL_HALF_FLOAT, GL_FALSE, vertex_stride, (void*)(offsetof(CompactVertexAttributes, texture_coord)));
+		glVertexAttribIPointer(4, 1, GL_UNSIGNED_SHORT, vertex_stride, (void*)(offsetof(CompactVertexAttributes, material_index)));
+	}
+	else
+	{
+		const int vertex_stride = sizeof(VertexAttributes);
+
+		// the attributes of a mapped cache go from the file to the buffer without a copy in between
+		glBufferData(GL_ARRAY_BUFFER, sizeof(VertexAttributes) * pool_positions.size(), nullptr, GL_STATIC_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(VertexAttributes) * no_cached_vertices, mesh_cache.attributes);
+		glBufferSubData(GL_ARRAY_BUFFER, sizeof(VertexAttributes) * no_cached_vertices, sizeof(VertexAttributes) * pool_attributes.size(), pool_attributes.data());
+
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, vertex_stride, (void*)(offsetof(VertexAttributes, normal)));
+		glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, vertex_stride, (void*)(offsetof(VertexAttributes, texture_coord)));
+		glVertexAttribIPointer(4, 1, GL_INT, vertex_stride, (void*)(offsetof(VertexAttributes, material_index)));
+	}
+
+	glEnableVertexAttribArray(1);
+	glEnableVertexAttribArray(3);
+	glEnableVertexAttribArray(4);
+
+	glBindVertexArray(0);
+}
+/* allocates the output of shadow_volume.comp for the worst case of all caster triangles facing the light with three silhouette edges */
+void Rasterizer::initShadowVolumes() {
+	size_t no_caster_triangles = 0;
+
+	for (ObjectHandle object = 0; object < scene.size(); ++object)
+	{
+		if (scene.flags[object] & kCaster)
+		{
+			no_caster_triangles += scene.no_indices[object] / 6;
+		}
+	}
+	no_caster_triangles = std::max<size_t>(no_caster_triangles, 1);
+
+	glGenBuffers(1, &ssbo_volume_vertices);
+	glBindBuffer(GL_ARRAY_BUFFER, ssbo_volume_vertices);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 4 * kVolumeVerticesPerTriangle * no_caster_triangles, nullptr, GL_DYNAMIC_COPY);
+
+	glGenBuffers(1, &ssbo_volume_indices);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ssbo_volume_indices);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * kVolumeIndicesPerTriangle * no_caster_triangles, nullptr, GL_DYNAMIC_COPY);
+
+	const VolumeCommand empty_command = { 0, 1, 0, 0, 0, 0 };
+
+	glGenBuffers(1, &volume_command);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, volume_command);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(VolumeCommand), &empty_command, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+	glGenVertexArrays(1, &vao_volumes);
+	glBindVertexArray(vao_volumes);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ssbo_volume_indices);
+	glBindBuffer(GL_ARRAY_BUFFER, ssbo_volume_vertices);
+	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (void*)0);
+	glEnableVertexAttribArray(0);
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	// the mapped regions of the CPU path are sized by its first build, see reserveCpuShadowVolumes
+	volume_builder.SetPositions(pool_positions);
+
+	initHierarchicalVolumes();
+	initLayeredVolumes();
+	initCountingVolumes();
+	initDeferredShading();
+	initShadowMasks();
+
+	printf("Shadow volume buffers: %.2f MB for %zu caster triangles\n",
+		(sizeof(GLfloat) * 4 * kVolumeVerticesPerTriangle + sizeof(GLuint) * kVolumeIndicesPerTriangle) * no_caster_triangles / (1024.0 * 1024.0), no_caster_triangles);
+}
+/* G-buffer and color target of the deferred path for the size of the camera, multisampled like the default framebuffer */
+void Rasterizer::initDeferredShading()
+{
+	const int width = camera.getWidth();
+	const int height = camera.getHeight();
+
+	// the finished frame is blitted into the default framebuffer, which needs the same formats on both sides
+	GLint color_bits[4] = { 0, 0, 0, 0 };
+	GLint depth_bits = 0;
+	GLint stencil_bits = 0;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_BACK_LEFT, GL_FRAMEBUFFER_ATTACHMENT_RED_SIZE, &color_bits[0]);
+	glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_BACK_LEFT, GL_FRAMEBUFFER_ATTACHMENT_GREEN_SIZE, &color_bits[1]);
+	glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_BACK_LEFT, GL_FRAMEBUFFER_ATTACHMENT_BLUE_SIZE, &color_bits[2]);
+	glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_BACK_LEFT, GL_FRAMEBUFFER_ATTACHMENT_ALPHA_SIZE, &color_bits[3]);
+	glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_DEPTH, GL_FRAMEBUFFER_ATTACHMENT_DEPTH_SIZE, &depth_bits);
+	glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_STENCIL, GL_FRAMEBUFFER_ATTACHMENT_STENCIL_SIZE, &stencil_bits);
+	deferred_supported = color_bits[0] == 8 && color_bits[1] == 8 && color_bits[2] == 8 && color_bits[3] == 8 && depth_bits == 24 && stencil_bits == 8;
+
+	if (!deferred_supported)
+	{
+		printf("Deferred shading needs an RGBA8 color and 24/8 depth-stencil default framebuffer (%d%d%d%d, %d/%d bits).\n",
+			color_bits[0], color_bits[1], color_bits[2], color_bits[3], depth_bits, stencil_bits);
+		deferred_shading = false;
+
+		return;
+	}
+
+	const auto multisample_texture = [&](GLuint& texture, const GLenum format) {
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, texture);
+		glTexStorage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, no_depth_samples, format, width, height, GL_TRUE);
+	};
+
+	multisample_texture(tex_gbuffer_normals, GL_RG16_SNORM);
+	multisample_texture(tex_gbuffer_materials, GL_R32UI);
+	multisample_texture(tex_gbuffer_depths, GL_R32F);
+	multisample_texture(tex_deferred_color, GL_RGBA8);
+	multisample_texture(tex_deferred_depth_stencil, GL_DEPTH24_STENCIL8);
+	glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
+
+	const GLenum draw_buffers[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+
+	glGenFramebuffers(1, &fbo_gbuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo_gbuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D_MULTISAMPLE, tex_gbuffer_normals, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D_MULTISAMPLE, tex_gbuffer_materials, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D_MULTISAMPLE, tex_gbuffer_depths, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D_MULTISAMPLE, tex_deferred_depth_stencil, 0);
+	glDrawBuffers(3, draw_buffers);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		printf("G-buffer framebuffer is not complete.\n");
+		deferred_supported = false;
+	}
+
+	// the G-buffer textures are sampled while this one is bound, so they are not attached to it
+	glGenFramebuffers(1, &fbo_deferred);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo_deferred);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D_MULTISAMPLE, tex_deferred_color, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D_MULTISAMPLE, tex_deferred_depth_stencil, 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		printf("Deferred color framebuffer is not complete.\n");
+		deferred_supported = false;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+/* the only pass of the deferred path that draws the objects, normals, material ids and depths of the visible samples, clears the stencil */
+void Rasterizer::renderGBuffer()
+{
+	const GLfloat zeros[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	const GLuint no_material = 0;
+	const GLfloat far_depth = 1.0f;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo_gbuffer);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glClearBufferfv(GL_COLOR, 0, zeros);
+	glClearBufferuiv(GL_COLOR, 1, &no_material);
+	glClearBufferfv(GL_COLOR, 2, &far_depth);
+	glClear(GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+
+	glDisable(GL_BLEND);
+	glEnable(GL_CULL_FACE);
+	glCullFace(GL_BACK);
+
+	glUseProgram(gbuffer_program);
+
+	SetMatrix4x4(gbuffer_program, camera.MVP.data(), "MVP");
+	SetMatrix4x4(gbuffer_program, camera.MN.data(), "MN");
+	SetMatrix4x4(gbuffer_program, camera.M.data(), "M");
+	SetInt(gbuffer_program, vertex_layout == VertexLayout::kCompact, "compact_vertices");
+
+	glBindVertexArray(vao);
+	SetInt(gbuffer_program, 1, "receiver");
+	drawObjects(gbuffer_program, kReceiver, kReceiver);
+	SetInt(gbuffer_program, 0, "receiver");
+	drawObjects(gbuffer_program, kReceiver, 0);
+	glBindVertexArray(0);
+}
+/* one full screen triangle of deferred_program over the samples of receivers (1), of the other objects (0) or of all of them (-1)
+with the shadow mask of a layer, the counts of a lane or without (-1), the state and the light uniforms are set by renderFrame */
+void Rasterizer::drawDeferredPass(const int receivers, const int layer, const int lane)
+{
+	SetInt(deferred_program, receivers, "receiver_filter");
+	SetInt(deferred_program, layer, "shadow_layer");
+	SetInt(deferred_program, lane, "count_lane");
+
+	glBindVertexArray(vao_caps); // no attributes
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glBindVertexArray(0);
+}
+/* R8 shadow mask array, the stencil copy read by the resolve in the forward path and the light list of the batched shading pass */
+void Rasterizer::initShadowMasks()
+{
+	const int width = camera.getWidth();
+	const int height = camera.getHeight();
+
+	// the stencil of the default framebuffer is blitted into a texture, which needs the same format on both sides
+	GLint depth_bits = 0;
+	GLint stencil_bits = 0;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_DEPTH, GL_FRAMEBUFFER_ATTACHMENT_DEPTH_SIZE, &depth_bits);
+	glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_STENCIL, GL_FRAMEBUFFER_ATTACHMENT_STENCIL_SIZE, &stencil_bits);
+	masks_supported = depth_bits == 24 && stencil_bits == 8;
+
+	if (!masks_supported)
+	{
+		printf("Shadow masks need a 24 bit depth and 8 bit stencil default framebuffer (%d/%d bits).\n", depth_bits, stencil_bits);
+		batched_shading = false;
+
+		return;
+	}
+
+	glGenTextures(1, &tex_shadow_masks);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, tex_shadow_masks);
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_R8, width, height, kMaxShadowMasks);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	glGenFramebuffers(1, &fbo_shadow_masks);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo_shadow_masks);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, tex_shadow_masks, 0, 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		printf("Shadow mask framebuffer is not complete.\n");
+		masks_supported = false;
+	}
+
+	glGenTextures(1, &tex_mask_stencil);
+	glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, tex_mask_stencil);
+	glTexStorage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, no_depth_samples, GL_DEPTH24_STENCIL8, width, height, GL_TRUE);
+	glTexParameteri(GL_TEXTURE_2D_MULTISAMPLE, GL_DEPTH_STENCIL_TEXTURE_MODE, GL_STENCIL_INDEX);
+	if (deferred_supported)
+	{
+		// the deferred path resolves from its own stencil
+		glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, tex_deferred_depth_stencil);
+		glTexParameteri(GL_TEXTURE_2D_MULTISAMPLE, GL_DEPTH_STENCIL_TEXTURE_MODE, GL_STENCIL_INDEX);
+	}
+	glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
+
+	glGenFramebuffers(1, &fbo_mask_stencil);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo_mask_stencil);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D_MULTISAMPLE, tex_mask_stencil, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		printf("Stencil copy framebuffer is not complete.\n");
+		masks_supported = false;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	glGenBuffers(1, &ubo_batched_lights);
+	glBindBuffer(GL_UNIFORM_BUFFER, ubo_batched_lights);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(BatchedLights), nullptr, GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, 1, ubo_batched_lights); // binding = 1 in basic_shader.frag and deferred_light.frag
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+/* the shadowed lights keep their mask layers and the newly shadowed ones get the free layers,
+a light left without a layer is drawn unshadowed */
+void Rasterizer::assignShadowMasks()
+{
+	bool used[kMaxShadowMasks] = {};
+
+	for (LightStats& stats : light_stats)
+	{
+		if (!stats.shadowed)
+		{
+			stats.mask_slot = -1;
+			stats.mask_valid = false;
+		}
+		else if (stats.mask_slot >= 0)
+		{
+			used[stats.mask_slot] = true;
+		}
+	}
+
+	for (const int i : light_order)
+	{
+		LightStats& stats = light_stats[i];
+
+		if (!stats.shadowed || stats.mask_slot >= 0)
+		{
+			continue;
+		}
+
+		const bool* free_slot = std::find(used, used + kMaxShadowMasks, false);
+
+		if (free_slot == used + kMaxShadowMasks)
+		{
+			stats.shadowed = false;
+			--no_shadowed_lights;
+			continue;
+		}
+
+		stats.mask_slot = int(free_slot - used);
+		stats.mask_valid = false;
+		used[stats.mask_slot] = true;
+	}
+}
+/* the mask layer still holds the shadows of the light, the casters do not move so only the light and the view invalidate it */
+bool Rasterizer::shadowMaskCurrent(const Light& light, const LightStats& stats)
+{
+	return stats.mask_valid && stats.mask_slot >= 0 && stats.mask_light_position == light.position && stats.mask_light_range == light.range &&
+		stats.mask_MVP == camera.MVP;
+}
+/* writes the lit fraction of the samples of every pixel within the scissor into a mask layer, from the stencil of the frame (layer and lane -1),
+from a layer of the layered volumes or from the counts of a lane */
+void Rasterizer::resolveShadowMask(const int slot, const int layer, const int lane)
+{
+	const int width = camera.getWidth();
+	const int height = camera.getHeight();
+
+	if (layer < 0 && lane < 0)
+	{
+		GLuint stencil_texture = tex_deferred_depth_stencil;
+
+		if (frame_fbo != fbo_deferred || frame_fbo == 0)
+		{
+			// the default framebuffer cannot be sampled, the scissor limits the copy to the bounds of the light
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, frame_fbo);
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo_mask_stencil);
+			glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_STENCIL_BUFFER_BIT, GL_NEAREST);
+			stencil_texture = tex_mask_stencil;
+		}
+
+		glActiveTexture(GL_TEXTURE14);
+		glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, stencil_texture);
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo_shadow_masks);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, tex_shadow_masks, 0, slot);
+
+	// no depth or stencil attachment, both tests pass
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glDisable(GL_BLEND);
+	glDisable(GL_CULL_FACE);
+
+	glUseProgram(resolve_mask_program);
+
+	SetInt(resolve_mask_program, layer, "source_layer");
+	SetInt(resolve_mask_program, no_depth_samples, "no_samples");
+	SetInt(resolve_mask_program, layer < 0 && tiles_marked ? 0xFF & ~kTileMarkBit : 0xFF, "stencil_mask");
+	SetInt(resolve_mask_program, lane, "count_lane");
+	SetInt(resolve_mask_program, packed_counts, "packed_counts");
+
+	glBindVertexArray(vao_caps); // no attributes
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glBindVertexArray(0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, frame_fbo);
+}
+/* shading passes of up to kMaxBatchedLights visible lights each in the lighting state of renderFrame, the shadowed lights read their mask layers */
+void Rasterizer::drawBatchedLights()
+{
+	if (light_order.empty())
+	{
+		return;
+	}
+
+	const bool deferred = frame_fbo == fbo_deferred && frame_fbo != 0;
+	const GLuint program = deferred ? deferred_program : shader_program;
+
+	glUseProgram(program);
+
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glDisable(GL_DEPTH_CLAMP);
+	glEnable(GL_CULL_FACE);
+	glCullFace(GL_BACK);
+	glDisable(GL_STENCIL_TEST);
+	glEnable(GL_BLEND);
+	glBlendEquation(GL_FUNC_ADD);
+	glBlendFunc(GL_ONE, GL_ONE);
+
+	glActiveTexture(GL_TEXTURE13);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, tex_shadow_masks);
+	glActiveTexture(GL_TEXTURE0);
+
+	SetInt(program, 1, "batched");
+
+	// the lights beyond the uniform block are added by further passes
+	for (size_t first = 0; first < light_order.size(); first += kMaxBatchedLights)
+	{
+		const size_t last = std::min(light_order.size(), first + kMaxBatchedLights);
+		BatchedLights batched_lights = {};
+
+		for (size_t j = first; j < last; ++j)
+		{
+			const Light& light = lights[light_order[j]];
+			const LightStats& stats = light_stats[light_order[j]];
+			GLfloat* position = batched_lights.positions[batched_lights.no_lights];
+			GLfloat* params = batched_lights.params[batched_lights.no_lights];
+
+			position[0] = light.position.x;
+			position[1] = light.position.y;
+			position[2] = light.position.z;
+			position[3] = light.range;
+			params[0] = light.intensity;
+			params[1] = stats.shadowed && stats.mask_valid ? float(stats.mask_slot) : -1.0f;
+			++batched_lights.no_lights;
+		}
+
+		glBindBuffer(GL_UNIFORM_BUFFER, ubo_batched_lights);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(BatchedLights), &batched_lights);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+		if (deferred)
+		{
+			glDepthMask(GL_FALSE);
+			glDepthFunc(GL_ALWAYS);
+			drawDeferredPass(-1, -1);
+			glDepthMask(GL_TRUE);
+			glDepthFunc(GL_LEQUAL);
+		}
+		else
+		{
+			glDepthMask(GL_TRUE);
+			glDepthFunc(GL_LEQUAL);
+
+			glBindVertexArray(vao);
+			SetInt(shader_program, 1, "receiver");
+			drawObjects(shader_program, kReceiver, kReceiver);
+			SetInt(shader_program, 0, "receiver");
+			drawObjects(shader_program, kReceiver, 0);
+			glBindVertexArray(0);
+		}
+	}
+
+	SetInt(program, 0, "batched");
+}
+/* layered depth-stencil target of the batched lights for the size of the camera, no_depth_samples of initHierarchicalVolumes */
+void Rasterizer::initLayeredVolumes()
+{
+	const int width = camera.getWidth();
+	const int height = camera.getHeight();
+
+	// the depth buffer is blitted into the layers, which needs the same format on both sides
+	GLint depth_bits = 0;
+	GLint stencil_bits = 0;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_DEPTH, GL_FRAMEBUFFER_ATTACHMENT_DEPTH_SIZE, &depth_bits);
+	glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_STENCIL, GL_FRAMEBUFFER_ATTACHMENT_STENCIL_SIZE, &stencil_bits);
+	layered_supported = depth_bits == 24 && stencil_bits == 8;
+
+	if (!layered_supported)
+	{
+		printf("Layered shadow volumes need a 24 bit depth and 8 bit stencil default framebuffer (%d/%d bits).\n", depth_bits, stencil_bits);
+		layered_volumes = false;
+
+		return;
+	}
+
+	glGenTextures(1, &tex_layered_depth_stencil);
+	glBindTexture(GL_TEXTURE_2D_MULTISAMPLE_ARRAY, tex_layered_depth_stencil);
+	glTexStorage3DMultisample(GL_TEXTURE_2D_MULTISAMPLE_ARRAY, no_depth_samples, GL_DEPTH24_STENCIL8, width, height, kMaxLayeredLights, GL_TRUE);
+	glTexParameteri(GL_TEXTURE_2D_MULTISAMPLE_ARRAY, GL_DEPTH_STENCIL_TEXTURE_MODE, GL_STENCIL_INDEX);
+	glBindTexture(GL_TEXTURE_2D_MULTISAMPLE_ARRAY, 0);
+
+	glGenFramebuffers(1, &fbo_layered);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo_layered);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, tex_layered_depth_stencil, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		printf("Layered depth-stencil framebuffer is not complete.\n");
+		layered_supported = false;
+	}
+
+	glGenFramebuffers(1, &fbo_layered_copy);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo_layered_copy);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, tex_layered_depth_stencil, 0, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	glGenBuffers(1, &ubo_layered_lights);
+	glBindBuffer(GL_UNIFORM_BUFFER, ubo_layered_lights);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(LayeredLights), nullptr, GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, 0, ubo_layered_lights); // binding = 0 in stencil_layered.geom
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+/* counting image and single sampled depth copy of the atomic counting pass for the size of the camera, the lights come from the
+LayeredLights block of initLayeredVolumes */
+void Rasterizer::initCountingVolumes()
+{
+	const int width = camera.getWidth();
+	const int height = camera.getHeight();
+
+	if (!layered_supported)
+	{
+		printf("Atomic shadow volume counting needs the layered shadow volumes.\n");
+		atomic_counting = false;
+
+		return;
+	}
+
+	glGenTextures(1, &tex_shadow_counts);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, tex_shadow_counts);
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_R32I, width, height, kMaxLayeredLights);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST); // integer textures are incomplete with linear filters
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	// the multisampled depth is resolved by the blit, the early depth test of one sample per pixel
+	glGenTextures(1, &tex_count_depth);
+	glBindTexture(GL_TEXTURE_2D, tex_count_depth);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH24_STENCIL8, width, height);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	const GLuint zero = 0;
+
+	glGenBuffers(1, &acb_count_overflows);
+	glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, acb_count_overflows);
+	glBufferData(GL_ATOMIC_COUNTER_BUFFER, sizeof(GLuint), &zero, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+
+	glGenFramebuffers(1, &fbo_count);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo_count);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, tex_count_depth, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	counting_supported = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	if (!counting_supported)
+	{
+		printf("Atomic counting depth framebuffer is not complete.\n");
+		atomic_counting = false;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+/* depth copy, depth tiles and tile classes for the size of the camera */
+void Rasterizer::initHierarchicalVolumes()
+{
+	const int width = camera.getWidth();
+	const int height = camera.getHeight();
+
+	// the copy has to see the same samples as the stencil pass
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glGetIntegerv(GL_SAMPLES, &no_depth_samples);
+	no_depth_samples = std::max(no_depth_samples, 1);
+
+	glGenTextures(1, &tex_tile_depth);
+	glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, tex_tile_depth);
+	glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, no_depth_samples, GL_DEPTH_COMPONENT24, width, height, GL_TRUE);
+	glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
+
+	glGenFramebuffers(1, &fbo_tile_depth);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo_tile_depth);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D_MULTISAMPLE, tex_tile_depth, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		printf("Tile depth framebuffer is not complete.\n");
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	no_tiles_x = (width + kTileSize - 1) / kTileSize;
+	no_tiles_y = (height + kTileSize - 1) / kTileSize;
+
+	glGenTextures(1, &tex_depth_tiles);
+	glBindTexture(GL_TEXTURE_2D, tex_depth_tiles);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG32F, no_tiles_x, no_tiles_y);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenBuffers(1, &ssbo_tiles);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo_tiles);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLint) * 2 * no_tiles_x * no_tiles_y, nullptr, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+/* converts a Material to its entry of the material table */
+static GpuMaterial MakeGpuMaterial(const Material& material)
+{
+	GpuMaterial gpu_material;
+
+	const Color3f diffuse = material.value(Map::kDiffuse);
+	const Color3f specular = material.value(Map::kSpecular);
+	const Color3f emission = material.emission();
+
+	for (int i = 0; i < 3; ++i)
+	{
+		gpu_material.diffuse[i] = diffuse.data[i];
+		gpu_material.specular[i] = specular.data[i];
+		gpu_material.emission[i] = emission.data[i];
+		gpu_material.ambient[i] = material.ambient_.data[i];
+	}
+	gpu_material.shininess = material.shininess(nullptr);
+	gpu_material.roughness = material.roughness();
+	gpu_material.metallic = material.metallic();
+	gpu_material.ior = material.ior;
+
+	return gpu_material;
+}
+/* uploads all materials of the scene once, the lighting pass looks them up by the material index of the vertex */
+void Rasterizer::initMaterials() {
+	std::vector<GpuMaterial> gpu_materials;
+
+	gpu_materials.reserve(std::max<size_t>(scene.materials.size(), 1));
+	for (const auto& material : scene.materials)
+	{
+		gpu_materials.push_back(MakeGpuMaterial(*material));
+	}
+	if (gpu_materials.empty())
+	{
+		gpu_materials.push_back(GpuMaterial()); // an empty buffer cannot be bound
+	}
+
+	glGenBuffers(1, &ssbo_materials);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo_materials);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GpuMaterial) * gpu_materials.size(), gpu_materials.data(), GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssbo_materials); // binding = 0 in basic_shader.frag
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+void Rasterizer::updateMaterial(const int material_id) {
+	if (material_id < 0 || material_id >= int(scene.materials.size()))
+	{
+		return;
+	}
+
+	const GpuMaterial gpu_material = MakeGpuMaterial(*scene.materials[material_id]);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo_materials);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(GpuMaterial) * material_id, sizeof(GpuMaterial), &gpu_material);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+/* reads the stencil buffer, one byte per pixel */
+std::vector<GLubyte> Rasterizer::captureStencil() {
+	const int width = camera.getWidth();
+	const int height = camera.getHeight();
+
+	std::vector<GLubyte> stencil(size_t(width) * size_t(height));
+
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width, height, GL_STENCIL_INDEX, GL_UNSIGNED_BYTE, stencil.data());
+
+	return stencil;
+}
+/* renders the stencil pass into a cleared stencil buffer and returns it, then the samples rasterized without the depth test and the mean GPU time */
+void Rasterizer::measureShadowPass(const std::vector<float>& light_position_ws, const int no_frames, GLuint64& no_samples, double& gpu_ms,
+	std::vector<GLubyte>& stencil)
+{
+	GLuint queries[2] = { 0, 0 };
+	glGenQueries(2, queries);
+
+	setStencilPassState();
+	glClear(GL_STENCIL_BUFFER_BIT);
+	renderShadowPass(light_position_ws);
+	stencil = captureStencil();
+
+	// fill rate, without the depth test every rasterized sample of the volumes and caps passes
+	no_samples = 0;
+
+	glDisable(GL_DEPTH_TEST);
+	setStencilPassState();
+	glClear(GL_STENCIL_BUFFER_BIT);
+	glBeginQuery(GL_SAMPLES_PASSED, queries[0]);
+	renderShadowPass(light_position_ws);
+	glEndQuery(GL_SAMPLES_PASSED);
+	glEnable(GL_DEPTH_TEST);
+	glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &no_samples);
+
+	gpu_ms = 0.0;
+
+	for (int frame = 0; frame < no_frames; ++frame)
+	{
+		GLuint64 elapsed = 0;
+
+		setStencilPassState();
+		glClear(GL_STENCIL_BUFFER_BIT);
+		glBeginQuery(GL_TIME_ELAPSED, queries[1]);
+		renderShadowPass(light_position_ws);
+		glEndQuery(GL_TIME_ELAPSED);
+		glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &elapsed);
+
+		gpu_ms += elapsed * 1e-6 / no_frames;
+	}
+
+	glDeleteQueries(2, queries);
+}
+int Rasterizer::compareStencilModes(const int no_frames) {
+	const StencilMode mode = stencil_mode;
+	const ShadowVolumePath path = shadow_volume_path;
+	const Light& light = lights[0];
+	const std::vector<float> light_position_ws = { light.position.x, light.position.y, light.position.z };
+
+	// depth buffer of the current view, ZP+ needs a path with per caster draws
+	camera.Update();
+	if (shadow_volume_path == ShadowVolumePath::kCompute || shadow_volume_path == ShadowVolumePath::kCpu)
+	{
+		shadow_volume_path = ShadowVolumePath::kGeometryShader;
+	}
+	renderFrame();
+
+	std::vector<GLubyte> stencils[2];
+	const StencilMode modes[2] = { StencilMode::kZFail, StencilMode::kZPassPlus };
+
+	printf("%10s %16s %10s\n", "mode", "samples", "GPU [ms]");
+
+	for (int m = 0; m < 2; ++m)
+	{
+		GLuint64 no_samples = 0;
+		double gpu_ms = 0.0;
+
+		stencil_mode = modes[m];
+		measureShadowPass(light_position_ws, no_frames, no_samples, gpu_ms, stencils[m]);
+
+		printf("%10s %16llu %10.3f\n", (modes[m] == StencilMode::kZFail) ? "z-fail" : "ZP+", (unsigned long long)no_samples, gpu_ms);
+	}
+
+	stencil_mode = mode;
+	shadow_volume_path = path;
+
+	// the counts may differ where the camera is inside of a volume, the shadowed pixels must not
+	size_t no_different_pixels = 0;
+
+	for (size_t i = 0; i < stencils[0].size(); ++i)
+	{
+		no_different_pixels += ((stencils[0][i] != 0) != (stencils[1][i] != 0)) ? 1 : 0;
+	}
+
+	printf("Stencil mode comparison: %zu of %zu pixels differ.\n", no_different_pixels, stencils[0].size());
+
+	return (no_different_pixels == 0) ? S_OK : S_FALSE;
+}
+int Rasterizer::compareCCVolumes(const int no_frames) {
+	const bool cc = cc_volumes;
+	const ShadowVolumePath path = shadow_volume_path;
+
+	// depth buffer of the current view, only the per caster paths clamp the volumes
+	camera.Update();
+	if (shadow_volume_path == ShadowVolumePath::kCompute || shadow_volume_path == ShadowVolumePath::kCpu)
+	{
+		shadow_volume_path = ShadowVolumePath::kGeometryShader;
+	}
+	renderFrame();
+
+	size_t no_different_pixels = 0;
+	size_t no_pixels = 0;
+
+	printf("%5s %10s %10s %16s %10s %10s\n", "light", "volumes", "culled", "samples", "fill [%]", "GPU [ms]");
+
+	for (size_t l = 0; l < lights.size(); ++l)
+	{
+		const Light& light = lights[l];
+		const std::vector<float> light_position_ws = { light.position.x, light.position.y, light.position.z };
+		std::vector<GLubyte> stencils[2];
+		GLuint64 infinite_samples = 0;
+
+		for (int m = 0; m < 2; ++m)
+		{
+			GLuint64 no_samples = 0;
+			double gpu_ms = 0.0;
+
+			cc_volumes = (m == 1);
+			measureShadowPass(light_position_ws, no_frames, no_samples, gpu_ms, stencils[m]);
+
+			if (m == 0)
+			{
+				infinite_samples = no_samples;
+			}
+
+			// fill rate of the clamped volumes relative to the infinite ones
+			printf("%5zu %10s %10zu %16llu %10.1f %10.3f\n", l, cc_volumes ? "CC" : "infinite", no_culled_casters, (unsigned long long)no_samples,
+				infinite_samples > 0 ? 100.0 * double(no_samples) / double(infinite_samples) : 100.0, gpu_ms);
+		}
+
+		// the volumes only lose their parts in front of no receiver, so the shadowed pixels must not change
+		for (size_t i = 0; i < stencils[0].size(); ++i)
+		{
+			no_different_pixels += ((stencils[0][i] != 0) != (stencils[1][i] != 0)) ? 1 : 0;
+		}
+		no_pixels += stencils[0].size();
+	}
+
+	cc_volumes = cc;
+	shadow_volume_path = path;
+
+	printf("CC volume comparison: %zu of %zu pixels differ.\n", no_different_pixels, no_pixels);
+
+	return (no_different_pixels == 0) ? S_OK : S_FALSE;
+}
+/* CPU port of volume_tiles.comp, the reference of compareHierarchicalVolumes, tiles hold (z-fail count, boundary) per tile */
+struct TileClassifier
+{
+	int width;
+	int height;
+	int no_tiles_x;
+	int no_tiles_y;
+	const std::vector<float>& depth_tiles; // (min, max) window depth per tile
+	std::vector<GLint>& tiles;
+
+	void markBoundary()
+	{
+		for (size_t i = 1; i < tiles.size(); i += 2)
+		{
+			tiles[i] = 1;
+		}
+	}
+
+	void classifyTriangle(const float A[3], const float B[3], const float C[3])
+	{
+		const float area = (B[0] - A[0]) * (C[1] - A[1]) - (C[0] - A[0]) * (B[1] - A[1]);
+
+		if (area == 0.0f)
+		{
+			return;
+		}
+
+		const int z_fail = (area > 0.0f) ? -1 : 1;
+		const float orientation = (area > 0.0f) ? 1.0f : -1.0f;
+		const float gradient[2] = { ((B[2] - A[2]) * (C[1] - A[1]) - (C[2] - A[2]) * (B[1] - A[1])) / area,
+			((C[2] - A[2]) * (B[0] - A[0]) - (B[2] - A[2]) * (C[0] - A[0])) / area };
+
+		// clamped to the viewport before the conversion, which leaves the tile range unchanged
+		const float lower[2] = { std::max(0.0f, std::min({ A[0], B[0], C[0] })), std::max(0.0f, std::min({ A[1], B[1], C[1] })) };
+		const float upper[2] = { std::min(float(width), std::max({ A[0], B[0], C[0] })), std::min(float(height), std::max({ A[1], B[1], C[1] })) };
+		const int first_tile[2] = { int(floorf(lower[0])) / kTileSize, int(floorf(lower[1])) / kTileSize };
+		const int last_tile[2] = { std::min(int(floorf(upper[0])) / kTileSize, no_tiles_x - 1), std::min(int(floorf(upper[1])) / kTileSize, no_tiles_y - 1) };
+		const float* vertices[3] = { A, B, C };
+
+		for (int y = first_tile[1]; y <= last_tile[1]; ++y)
+		{
+			for (int x = first_tile[0]; x <= last_tile[0]; ++x)
+			{
+				const float p0[2] = { float(x * kTileSize), float(y * kTileSize) };
+				const float p1[2] = { std::min(float((x + 1) * kTileSize), float(width)), std::min(float((y + 1) * kTileSize), float(height)) };
+				const float corners[4][2] = { { p0[0], p0[1] }, { p1[0], p0[1] }, { p0[0], p1[1] }, { p1[0], p1[1] } };
+
+				bool outside = false;
+				bool covered = true;
+
+				for (int e = 0; e < 3; ++e)
+				{
+					const float* from = vertices[e];
+					const float* to = vertices[(e + 1) % 3];
+					const float slack = sqrtf((to[0] - from[0]) * (to[0] - from[0]) + (to[1] - from[1]) * (to[1] - from[1])) / 64.0f;
+					int no_inside = 0;
+
+					for (int c = 0; c < 4; ++c)
+					{
+						const float inside = orientation * ((to[0] - from[0]) * (corners[c][1] - from[1]) - (to[1] - from[1]) * (corners[c][0] - from[0]));
+						no_inside += (inside >= -slack) ? 1 : 0;
+						covered = covered && (inside > slack);
+					}
+
+					outside = outside || (no_inside == 0);
+				}
+
+				if (outside)
+				{
+					continue;
+				}
+
+				float depth_min = 1.0f;
+				float depth_max = 0.0f;
+
+				for (int c = 0; c < 4; ++c)
+				{
+					const float depth = A[2] + gradient[0] * (corners[c][0] - A[0]) + gradient[1] * (corners[c][1] - A[1]);
+					depth_min = std::min(depth_min, std::max(0.0f, std::min(1.0f, depth)));
+					depth_max = std::max(depth_max, std::max(0.0f, std::min(1.0f, depth)));
+				}
+				if (!covered)
+				{
+					depth_min = std::max(depth_min, std::max(0.0f, std::min(1.0f, std::min({ A[2], B[2], C[2] }))));
+					depth_max = std::min(depth_max, std::max(0.0f, std::min(1.0f, std::max({ A[2], B[2], C[2] }))));
+				}
+
+				const size_t tile = size_t(y) * no_tiles_x + x;
+				const float kDepthEpsilon = 2e-6f;
+
+				if (depth_max < depth_tiles[2 * tile] - kDepthEpsilon)
+				{
+					continue;
+				}
+
+				if (covered && depth_min >= depth_tiles[2 * tile + 1] + kDepthEpsilon)
+				{
+					tiles[2 * tile] += z_fail;
+				}
+				else
+				{
+					tiles[2 * tile + 1] = 1;
+				}
+			}
+		}
+	}
+
+	void classify(const std::array<float, 4>& P0, const std::array<float, 4>& P1, const std::array<float, 4>& P2)
+	{
+		const std::array<float, 4> in_points[3] = { P0, P1, P2 };
+		std::array<float, 4> points[4];
+		int no_points = 0;
+
+		for (int i = 0; i < 3; ++i)
+		{
+			const std::array<float, 4>& P = in_points[i];
+			const std::array<float, 4>& Q = in_points[(i + 1) % 3];
+			const float p = P[2] + P[3];
+			const float q = Q[2] + Q[3];
+
+			if (p >= 0.0f)
+			{
+				points[no_points++] = P;
+			}
+			if ((p >= 0.0f) != (q >= 0.0f))
+			{
+				const float t = p / (p - q);
+
+				for (int c = 0; c < 4; ++c)
+				{
+					points[no_points][c] = P[c] + t * (Q[c] - P[c]);
+				}
+				++no_points;
+			}
+		}
+
+		if (no_points < 3)
+		{
+			return;
+		}
+
+		float windows[4][3];
+
+		for (int i = 0; i < no_points; ++i)
+		{
+			if (points[i][3] < 1e-6f)
+			{
+				markBoundary();
+				return;
+			}
+
+			windows[i][0] = (points[i][0] / points[i][3] * 0.5f + 0.5f) * width;
+			windows[i][1] = (points[i][1] / points[i][3] * 0.5f + 0.5f) * height;
+			windows[i][2] = points[i][2] / points[i][3] * 0.5f + 0.5f;
+		}
+
+		for (int i = 1; i + 1 < no_points; ++i)
+		{
+			classifyTriangle(windows[0], windows[i], windows[i + 1]);
+		}
+	}
+};
+int Rasterizer::compareHierarchicalVolumes(const int no_frames) {
+	const bool hierarchical = hierarchical_volumes;
+	const ShadowVolumePath path = shadow_volume_path;
+	const Light& light = lights[0];
+	const std::vector<float> light_position_ws = { light.position.x, light.position.y, light.position.z };
+
+	// depth buffer of the current view, only the compute path keeps its volumes in buffers the tiles can be tested against
+	camera.Update();
+	shadow_volume_path = ShadowVolumePath::kCompute;
+	renderFrame();
+
+	std::vector<GLubyte> stencils[2];
+
+	printf("%12s %16s %10s\n", "volumes", "samples", "GPU [ms]");
+
+	for (int m = 0; m < 2; ++m)
+	{
+		GLuint64 no_samples = 0;
+		double gpu_ms = 0.0;
+
+		hierarchical_volumes = (m == 1);
+		measureShadowPass(light_position_ws, no_frames, no_samples, gpu_ms, stencils[m]);
+
+		printf("%12s %16llu %10.3f\n", hierarchical_volumes ? "hierarchical" : "per pixel", (unsigned long long)no_samples, gpu_ms);
+	}
 
-	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) // natu vechny funkce OpenGL
+	// tiles of the last pass
+	std::vector<GLint> tiles(size_t(2) * no_tiles_x * no_tiles_y);
+	size_t no_tiles_by_class[3] = { 0, 0, 0 }; // lit, shadowed, boundary
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo_tiles);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLint) * tiles.size(), tiles.data());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	for (size_t i = 0; i < tiles.size(); i += 2)
 	{
-		if (!gladLoadGL())
-		{
-			return EXIT_FAILURE;
-		}
+		++no_tiles_by_class[(tiles[i + 1] != 0) ? 2 : ((tiles[i] != 0) ? 1 : 0)];
 	}
 
-	glEnable(GL_DEBUG_OUTPUT);
-	glDebugMessageCallback(gl_callback, nullptr); // v OpenGL je sloit debugovat 
-	// kdy vznikne chba, vrt se do konzole ten error (errory jsou v referenn pruce)
-
-	printf("OpenGL %s, ", glGetString(GL_VERSION));
-	printf("%s", glGetString(GL_RENDERER));
-	printf(" (%s)\n", glGetString(GL_VENDOR));
-	printf("GLSL %s\n", glGetString(GL_SHADING_LANGUAGE_VERSION));
+	printf("Tiles: %zu lit, %zu shadowed, %zu boundary of %zu.\n", no_tiles_by_class[0], no_tiles_by_class[1], no_tiles_by_class[2], tiles.size() / 2);
 
-	glEnable(GL_MULTISAMPLE);
+	// the CPU port of the tile test over the volumes and depth tiles of the last pass
+	GLuint command[6] = { 0, 0, 0, 0, 0, 0 }; // VolumeCommand
 
-	// map from the range of NDC coordinates <-1.0, 1.0>^2 to <0, width> x <0, height>
-	glViewport(0, 0, width, height);
-	// GL_LOWER_LEFT (OpenGL) or GL_UPPER_LEFT (DirectX, Windows) and GL_NEGATIVE_ONE_TO_ONE or GL_ZERO_TO_ONE
-	//glClipControl(GL_UPPER_LEFT, GL_NEGATIVE_ONE_TO_ONE); // ( odkud se pot obrzek , pseudohloubka)
-	glClipControl(GL_LOWER_LEFT, GL_NEGATIVE_ONE_TO_ONE); // ( odkud se pot obrzek , pseudohloubka)
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, volume_command);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(command), command);
 
-}
-void Rasterizer::loadMesh(const std::string& file_name, const std::string model) {
-	SceneGraph scene;
+	std::vector<GLuint> volume_indices(command[0]);
+	std::vector<GLfloat> volume_vertices(size_t(4) * command[5]);
 
-	LoadOBJ(file_name, scene, materials_, true); // true - load adjacentTriangles
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo_volume_indices);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint) * volume_indices.size(), volume_indices.data());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo_volume_vertices);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLfloat) * volume_vertices.size(), volume_vertices.data());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
-	// build continuous array for GL_TRIANGLES_ADJACENCY primitive mode
-	TriangleWithAdjacency dst_triangle;
+	std::vector<float> depth_tiles(size_t(2) * no_tiles_x * no_tiles_y);
 
-	std::vector<TriangleWithAdjacency> triangles;
-	std::vector<Vertex> vert;
+	glBindTexture(GL_TEXTURE_2D, tex_depth_tiles);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RG, GL_FLOAT, depth_tiles.data());
+	glBindTexture(GL_TEXTURE_2D, 0);
 
-	for (SceneGraph::iterator iter = scene.begin(); iter != scene.end(); ++iter)
-	{
-		const std::string& node_name = iter->first;
-		const auto& node = iter->second;
+	std::vector<GLint> cpu_tiles(tiles.size(), 0);
+	TileClassifier classifier = { camera.getWidth(), camera.getHeight(), no_tiles_x, no_tiles_y, depth_tiles, cpu_tiles };
 
-		const auto& mesh = std::static_pointer_cast<Mesh>(node);
+	auto clip_point = [&](const GLuint index) {
+		std::array<float, 4> P;
 
-		if (mesh)
+		for (int r = 0; r < 4; ++r)
 		{
-			for (Mesh::iterator iter = mesh->begin(); iter != mesh->end(); ++iter)
+			P[r] = 0.0f;
+			for (int c = 0; c < 4; ++c)
 			{
-				const auto& src_triangle = Triangle3i(**iter);
-				std::shared_ptr<Material> material = iter.triangle_material();
-				const int material_index = int(std::distance(std::begin(materials_), materials_.find(material->name())));
-
-				for (int i = 0; i < 3; ++i) {
-					Vertex new_vertex;
-					new_vertex.position = src_triangle.position(i);
-					new_vertex.normal = src_triangle.normal(i);
-					new_vertex.tangent = src_triangle.tangent(i);
-					new_vertex.texture_coord = Vector2(src_triangle.texture_coord(i).x, src_triangle.texture_coord(i).y);
-					new_vertex.material_index = material_index;
+				P[r] += camera.MVP.get(r, c) * volume_vertices[size_t(4) * index + c];
+			}
+		}
 
-					dst_triangle.vertices[i * 2].position = src_triangle.position(i);
-					dst_triangle.vertices[i * 2].normal = src_triangle.normal(i);
-					dst_triangle.vertices[i * 2].texture_coord = Vector2(src_triangle.texture_coord(i).x, src_triangle.texture_coord(i).y);
-					dst_triangle.vertices[i * 2].tangent = src_triangle.tangent(i);
-					dst_triangle.vertices[i * 2].material_index = material_index;
+		return P;
+	};
 
-					dst_triangle.vertices[i * 2 + 1].position = src_triangle.adjacent_vertex_position(i).value_or(Vector3());
-					dst_triangle.vertices[i * 2 + 1].normal = Vector3();
-					dst_triangle.vertices[i * 2 + 1].texture_coord = Vector2();
-					dst_triangle.vertices[i * 2 + 1].tangent = Vector3();
-					dst_triangle.vertices[i * 2 + 1].material_index = -1;
+	const GLuint kRestartIndex = 0xFFFFFFFFu;
 
-					vert.push_back(new_vertex);
-				}
-				triangles.push_back(dst_triangle);
-				/*
-				for (int i = 0; i < 3; ++i)
-				{
-					std::optional<Vector3> av = src_triangle.adjacent_vertex_position(i);
-					if (av.has_value())
-					{
-						av.value().Print();
-					}
-					else
-					{
-						printf("-\n");
-					}
-				}*/
-			}
+	for (size_t i = 0; i + 2 < volume_indices.size(); ++i)
+	{
+		if ((i > 0 && volume_indices[i - 1] != kRestartIndex) || volume_indices[i] == kRestartIndex)
+		{
+			continue;
 		}
-	}
-	if (model.compare("map") == 0) {
-		this->loadedVerticesMap = vert;
-		this->map_loaded = true;
-	}
-	else {
-		this->loaded_triangles = triangles;
-		this->loadedVertices = vert;
-	}
-}
-void Rasterizer::loadMesh_triangles(const std::string& file_name)
-{
-	SceneGraph scene;
 
-	LoadOBJ(file_name, scene, materials_, true);
+		const std::array<float, 4> P0 = clip_point(volume_indices[i]);
+		const std::array<float, 4> P1 = clip_point(volume_indices[i + 1]);
+		const std::array<float, 4> P2 = clip_point(volume_indices[i + 2]);
 
-	TriangleWithAdjacency dst_triangle;
+		classifier.classify(P0, P1, P2);
+		if (i + 3 < volume_indices.size() && volume_indices[i + 3] != kRestartIndex)
+		{
+			classifier.classify(P1, clip_point(volume_indices[i + 3]), P2);
+		}
+	}
 
+	// the GPU tiles against the port, and every pixel of a lit or shadowed tile against the per pixel stencil
+	size_t no_different_tiles = 0;
+	size_t no_misclassified_pixels = 0;
+	const int width = camera.getWidth();
+	const int height = camera.getHeight();
 
-	for (SceneGraph::iterator iter = scene.begin(); iter != scene.end(); ++iter)
+	for (size_t tile = 0; tile < cpu_tiles.size() / 2; ++tile)
 	{
-		const std::string& node_name = iter->first;
-		const auto& node = iter->second;
-
-		const auto& mesh = std::static_pointer_cast<Mesh>(node);
+		no_different_tiles += (cpu_tiles[2 * tile] != tiles[2 * tile] || cpu_tiles[2 * tile + 1] != tiles[2 * tile + 1]) ? 1 : 0;
 
-		if (mesh)
+		if (cpu_tiles[2 * tile + 1] != 0)
 		{
-			for (Mesh::iterator iter = mesh->begin(); iter != mesh->end(); ++iter)
-			{
-				const auto& src_triangle = Triangle3i(**iter);
-				std::shared_ptr<Material> material = iter.triangle_material();
-				const int material_index = int(std::distance(std::begin(materials_), materials_.find(material->name())));
+			continue;
+		}
 
-				for (int i = 0; i < 3; ++i)
-				{ 
-					dst_triangle.vertices[i * 2].position = src_triangle.position(i);
-					dst_triangle.vertices[i * 2].normal = src_triangle.normal(i);
-					dst_triangle.vertices[i * 2].texture_coord = Vector2(src_triangle.texture_coord(i).x, src_triangle.texture_coord(i).y);
-					dst_triangle.vertices[i * 2].tangent = src_triangle.tangent(i);
-					dst_triangle.vertices[i * 2].color = Vector3(material->value(Map::kDiffuse).data[0], material->value(Map::kDiffuse).data[1], material->value(Map::kDiffuse).data[2]);
-					dst_triangle.vertices[i * 2].material_index = material_index;
-
-					dst_triangle.vertices[i * 2 + 1].position = src_triangle.adjacent_vertex_position(i).value_or(Vector3());
-					dst_triangle.vertices[i * 2 + 1].normal = Vector3();
-					dst_triangle.vertices[i * 2 + 1].texture_coord = Vector2();
-					dst_triangle.vertices[i * 2 + 1].tangent = Vector3();
-					dst_triangle.vertices[i * 2 + 1].color = Vector3();
-					dst_triangle.vertices[i * 2 + 1].material_index = -1;
-				}
+		const int tile_x = int(tile % no_tiles_x);
+		const int tile_y = int(tile / no_tiles_x);
+		const bool shadowed = GLubyte(cpu_tiles[2 * tile]) != 0; // the stencil wraps
 
-				this->loaded_triangles.push_back(dst_triangle);
+		for (int y = tile_y * kTileSize; y < std::min((tile_y + 1) * kTileSize, height); ++y)
+		{
+			for (int x = tile_x * kTileSize; x < std::min((tile_x + 1) * kTileSize, width); ++x)
+			{
+				no_misclassified_pixels += ((stencils[0][size_t(y) * width + x] != 0) != shadowed) ? 1 : 0;
 			}
 		}
 	}
 
-}
-void Rasterizer::initSurface() {
+	printf("Tile test: %zu tiles differ from the CPU port, %zu pixels of lit or shadowed tiles differ from the per pixel stencil.\n",
+		no_different_tiles, no_misclassified_pixels);
 
-	const int no_vertices = loadedVertices.size();
-	
-	const int vertex_stride = sizeof(Vertex);
+	hierarchical_volumes = hierarchical;
+	shadow_volume_path = path;
 
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
+	// the marked tiles hold kTileMarkBit, a pixel is shadowed if any other bit is set
+	size_t no_different_pixels = 0;
 
-	glGenBuffers(1, &vbo); // generate vertex buffer object (one of OpenGL objects) and get the unique ID corresponding to that buffer
-	glBindBuffer(GL_ARRAY_BUFFER, vbo); // bind the newly created buffer to the GL_ARRAY_BUFFER target
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * no_vertices, loadedVertices.data(), GL_STATIC_DRAW); // copies the previously defined vertex data into the buffer's memory
-	// vertex position
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, vertex_stride, (void*)(offsetof(Vertex, position)));
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, vertex_stride, (void*)(offsetof(Vertex, normal)));
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, vertex_stride, (void*)(offsetof(Vertex, tangent)));
-	glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, vertex_stride, (void*)(offsetof(Vertex, texture_coord)));
-	glVertexAttribIPointer(4, 1, GL_INT, vertex_stride, (void*)(offsetof(Vertex, material_index)));
+	for (size_t i = 0; i < stencils[0].size(); ++i)
+	{
+		no_different_pixels += ((stencils[0][i] != 0) != ((stencils[1][i] & ~kTileMarkBit) != 0)) ? 1 : 0;
+	}
 
-	glEnableVertexAttribArray(0);
-	glEnableVertexAttribArray(1);
-	glEnableVertexAttribArray(2);
-	glEnableVertexAttribArray(3);
-	glEnableVertexAttribArray(4);
+	printf("Hierarchical volume comparison: %zu of %zu pixels differ.\n", no_different_pixels, stencils[0].size());
 
-	glBindVertexArray(0);
+	return (no_different_pixels == 0 && no_misclassified_pixels == 0) ? S_OK : S_FALSE;
 }
-void Rasterizer::initSurfaceEnvMap() {
-	if (loadedVerticesMap.size() > 0) {
-		const int no_vertices_map = loadedVerticesMap.size();
+int Rasterizer::compareShadowVolumePaths() {
+	const ShadowVolumePath path = shadow_volume_path;
+	const bool hierarchical = hierarchical_volumes;
 
-		const int vertex_stride = sizeof(Vertex);
+	// the tile marks would differ from the geometry shader path
+	hierarchical_volumes = false;
+	camera.Update();
 
-		glGenVertexArrays(1, &vao_env);
-		glBindVertexArray(vao_env);
+	// the lighting passes do not write the stencil buffer, so it still holds the volumes after the frame
+	shadow_volume_path = ShadowVolumePath::kGeometryShader;
+	renderFrame();
+	const std::vector<GLubyte> reference = captureStencil();
 
-		glGenBuffers(1, &vbo_env); // generate vertex buffer object (one of OpenGL objects) and get the unique ID corresponding to that buffer
-		glBindBuffer(GL_ARRAY_BUFFER, vbo_env); // bind the newly created buffer to the GL_ARRAY_BUFFER target
-		glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * no_vertices_map, loadedVerticesMap.data(), GL_STATIC_DRAW); // copies the previously defined vertex data into the buffer's memory
-		
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, vertex_stride, (void*)(offsetof(Vertex, position)));
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, vertex_stride, (void*)(offsetof(Vertex, normal)));
-		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, vertex_stride, (void*)(offsetof(Vertex, tangent)));
-		glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, vertex_stride, (void*)(offsetof(Vertex, texture_coord)));
-		glEnableVertexAttribArray(0);
-		glEnableVertexAttribArray(1);
-		glEnableVertexAttribArray(2);
-		glEnableVertexAttribArray(3);
-	}
-	else {
-		printf("Environmental map did not load properly");
+	shadow_volume_path = ShadowVolumePath::kCompute;
+	renderFrame();
+	const std::vector<GLubyte> compute = captureStencil();
+
+	shadow_volume_path = path;
+	hierarchical_volumes = hierarchical;
+
+	size_t no_different_pixels = 0;
+	size_t no_shadowed_pixels = 0;
+
+	for (size_t i = 0; i < reference.size(); ++i)
+	{
+		no_different_pixels += (reference[i] != compute[i]) ? 1 : 0;
+		no_shadowed_pixels += (reference[i] != 0) ? 1 : 0;
 	}
+
+	printf("Shadow volume comparison: %zu of %zu pixels differ (%zu pixels in shadow).\n", no_different_pixels, reference.size(), no_shadowed_pixels);
+
+	return (no_different_pixels == 0) ? S_OK : S_FALSE;
 }
-void Rasterizer::initSurfaceTriangles() {
+/* reads the back buffer into a texture */
+Texture3u Rasterizer::captureFrame() {
+	const int width = camera.getWidth();
+	const int height = camera.getHeight();
 
-	const int no_vertices = loaded_triangles.size() * 6;
+	std::vector<Color3u> pixels(size_t(width) * size_t(height));
 
-	const int vertex_stride = sizeof(Vertex);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadBuffer(GL_BACK);
+	glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
 
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
+	return Texture3u(width, height, sizeof(Color3u), pixels.data());
+}
+int Rasterizer::compareVertexLayouts(const int tolerance) {
+	const VertexLayout layout = vertex_layout;
 
-	glGenBuffers(1, &vbo); // generate vertex buffer object (one of OpenGL objects) and get the unique ID corresponding to that buffer
-	glBindBuffer(GL_ARRAY_BUFFER, vbo); // bind the newly created buffer to the GL_ARRAY_BUFFER target
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * no_vertices, loaded_triangles.data(), GL_STATIC_DRAW); // copies the previously defined vertex data into the buffer's memory
-	
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, vertex_stride, (void*)(offsetof(Vertex, position)));
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, vertex_stride, (void*)(offsetof(Vertex, normal)));
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, vertex_stride, (void*)(offsetof(Vertex, tangent)));
-	glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, vertex_stride, (void*)(offsetof(Vertex, texture_coord)));
-	glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, vertex_stride, (void*)(offsetof(Vertex, color)));
-	glVertexAttribIPointer(5, 1, GL_INT, vertex_stride, (void*)(offsetof(Vertex, material_index)));
+	camera.Update();
 
-	glEnableVertexAttribArray(0);
-	glEnableVertexAttribArray(1);
-	glEnableVertexAttribArray(2);
-	glEnableVertexAttribArray(3);
-	glEnableVertexAttribArray(4);
-	glEnableVertexAttribArray(5);
+	vertex_layout = VertexLayout::kFull;
+	uploadVertexAttributes();
+	renderFrame();
+	const Texture3u reference = captureFrame();
 
-	glBindVertexArray(0);
+	vertex_layout = VertexLayout::kCompact;
+	uploadVertexAttributes();
+	renderFrame();
+	const Texture3u compact = captureFrame();
+
+	vertex_layout = layout;
+	uploadVertexAttributes();
+
+	int max_difference = 0;
+	size_t no_failed_pixels = 0;
+
+	for (int y = 0; y < reference.height(); ++y)
+	{
+		for (int x = 0; x < reference.width(); ++x)
+		{
+			const Color3u a = reference.pixel(x, y);
+			const Color3u b = compact.pixel(x, y);
+
+			int difference = 0;
+			for (int c = 0; c < 3; ++c)
+			{
+				difference = std::max(difference, abs(int(a.data[c]) - int(b.data[c])));
+			}
+
+			max_difference = std::max(max_difference, difference);
+			if (difference > tolerance)
+			{
+				++no_failed_pixels;
+			}
+		}
+	}
+
+	printf("Vertex layout comparison: max difference %d, %zu pixels above tolerance %d.\n", max_difference, no_failed_pixels, tolerance);
+
+	if (no_failed_pixels > 0)
+	{
+		reference.Save("frame_full.png");
+		compact.Save("frame_compact.png");
 
+		return S_FALSE;
+	}
+
+	return S_OK;
 }
 void Rasterizer::initShaders() {
 	// ------------------------- BASIC SHADER -----------------------------------// 
@@ -587,6 +4116,205 @@ void Rasterizer::initShaders() {
 	glAttachShader(stencil_program, fragment_shader_stencil);
 	glLinkProgram(stencil_program);
 
+	geometry_shader_layered = glCreateShader(GL_GEOMETRY_SHADER);
+	if (loadShader("stencil_layered.geom", shader_source) == S_OK)
+	{
+		const char* tmp = static_cast<const char*>(&shader_source[0]);
+		glShaderSource(geometry_shader_layered, 1, &tmp, nullptr);
+		glCompileShader(geometry_shader_layered);
+	}
+	checkShader(geometry_shader_layered);
+
+	layered_program = glCreateProgram();
+	glAttachShader(layered_program, vertex_shader_stencil);
+	glAttachShader(layered_program, geometry_shader_layered);
+	glAttachShader(layered_program, fragment_shader_stencil);
+	glLinkProgram(layered_program);
+
+	fragment_shader_count = glCreateShader(GL_FRAGMENT_SHADER);
+	if (loadShader("stencil_count.frag", shader_source) == S_OK)
+	{
+		const char* tmp = static_cast<const char*>(&shader_source[0]);
+		glShaderSource(fragment_shader_count, 1, &tmp, nullptr);
+		glCompileShader(fragment_shader_count);
+	}
+	checkShader(fragment_shader_count);
+
+	count_program = glCreateProgram();
+	glAttachShader(count_program, vertex_shader_stencil);
+	glAttachShader(count_program, geometry_shader_layered);
+	glAttachShader(count_program, fragment_shader_count);
+	glLinkProgram(count_program);
+
+	// ------------------------- DEFERRED SHADING SHADERS -----------------------------------// 
+
+	fragment_shader_gbuffer = glCreateShader(GL_FRAGMENT_SHADER);
+	if (loadShader("gbuffer.frag", shader_source) == S_OK)
+	{
+		const char* tmp = static_cast<const char*>(&shader_source[0]);
+		glShaderSource(fragment_shader_gbuffer, 1, &tmp, nullptr);
+		glCompileShader(fragment_shader_gbuffer);
+	}
+	checkShader(fragment_shader_gbuffer);
+
+	gbuffer_program = glCreateProgram();
+	glAttachShader(gbuffer_program, vertex_shader);
+	glAttachShader(gbuffer_program, fragment_shader_gbuffer);
+	glLinkProgram(gbuffer_program);
+
+	fragment_shader_deferred = glCreateShader(GL_FRAGMENT_SHADER);
+	if (loadShader("deferred_light.frag", shader_source) == S_OK)
+	{
+		const char* tmp = static_cast<const char*>(&shader_source[0]);
+		glShaderSource(fragment_shader_deferred, 1, &tmp, nullptr);
+		glCompileShader(fragment_shader_deferred);
+	}
+	checkShader(fragment_shader_deferred);
+
+	// ------------------------- EDGE BASED SHADOW VOLUME SHADERS -----------------------------------// 
+
+	geometry_shader_edges = glCreateShader(GL_GEOMETRY_SHADER);
+	if (loadShader("stencil_edges.geom", shader_source) == S_OK)
+	{
+		const char* tmp = static_cast<const char*>(&shader_source[0]);
+		glShaderSource(geometry_shader_edges, 1, &tmp, nullptr);
+		glCompileShader(geometry_shader_edges);
+	}
+	checkShader(geometry_shader_edges);
+
+	edges_program = glCreateProgram();
+	glAttachShader(edges_program, vertex_shader_stencil);
+	glAttachShader(edges_program, geometry_shader_edges);
+	glAttachShader(edges_program, fragment_shader_stencil);
+	glLinkProgram(edges_program);
+
+	vertex_shader_caps = glCreateShader(GL_VERTEX_SHADER);
+	if (loadShader("stencil_caps.vert", shader_source) == S_OK)
+	{
+		const char* tmp = static_cast<const char*>(&shader_source[0]);
+		glShaderSource(vertex_shader_caps, 1, &tmp, nullptr);
+		glCompileShader(vertex_shader_caps);
+	}
+	checkShader(vertex_shader_caps);
+
+	caps_program = glCreateProgram();
+	glAttachShader(caps_program, vertex_shader_caps);
+	glAttachShader(caps_program, fragment_shader_stencil);
+	glLinkProgram(caps_program);
+
+	vertex_shader_near_caps = glCreateShader(GL_VERTEX_SHADER);
+	if (loadShader("stencil_near_caps.vert", shader_source) == S_OK)
+	{
+		const char* tmp = static_cast<const char*>(&shader_source[0]);
+		glShaderSource(vertex_shader_near_caps, 1, &tmp, nullptr);
+		glCompileShader(vertex_shader_near_caps);
+	}
+	checkShader(vertex_shader_near_caps);
+
+	near_caps_program = glCreateProgram();
+	glAttachShader(near_caps_program, vertex_shader_near_caps);
+	glAttachShader(near_caps_program, fragment_shader_stencil);
+	glLinkProgram(near_caps_program);
+
+	// ------------------------- SHADOW VOLUME COMPUTE SHADER -----------------------------------// 
+
+	compute_shader_volume = glCreateShader(GL_COMPUTE_SHADER);
+	if (loadShader("shadow_volume.comp", shader_source) == S_OK)
+	{
+		const char* tmp = static_cast<const char*>(&shader_source[0]);
+		glShaderSource(compute_shader_volume, 1, &tmp, nullptr);
+		glCompileShader(compute_shader_volume);
+	}
+	checkShader(compute_shader_volume);
+
+	volume_compute_program = glCreateProgram();
+	glAttachShader(volume_compute_program, compute_shader_volume);
+	glLinkProgram(volume_compute_program);
+
+	vertex_shader_volume = glCreateShader(GL_VERTEX_SHADER);
+	if (loadShader("shadow_volume.vert", shader_source) == S_OK)
+	{
+		const char* tmp = static_cast<const char*>(&shader_source[0]);
+		glShaderSource(vertex_shader_volume, 1, &tmp, nullptr);
+		glCompileShader(vertex_shader_volume);
+	}
+	checkShader(vertex_shader_volume);
+
+	volume_program = glCreateProgram();
+	glAttachShader(volume_program, vertex_shader_volume);
+	glAttachShader(volume_program, fragment_shader_stencil);
+	glLinkProgram(volume_program);
+
+	// ------------------------- HIERARCHICAL SHADOW VOLUME SHADERS -----------------------------------// 
+
+	compute_shader_depth_tiles = glCreateShader(GL_COMPUTE_SHADER);
+	if (loadShader("depth_tiles.comp", shader_source) == S_OK)
+	{
+		const char* tmp = static_cast<const char*>(&shader_source[0]);
+		glShaderSource(compute_shader_depth_tiles, 1, &tmp, nullptr);
+		glCompileShader(compute_shader_depth_tiles);
+	}
+	checkShader(compute_shader_depth_tiles);
+
+	depth_tiles_program = glCreateProgram();
+	glAttachShader(depth_tiles_program, compute_shader_depth_tiles);
+	glLinkProgram(depth_tiles_program);
+
+	compute_shader_volume_tiles = glCreateShader(GL_COMPUTE_SHADER);
+	if (loadShader("volume_tiles.comp", shader_source) == S_OK)
+	{
+		const char* tmp = static_cast<const char*>(&shader_source[0]);
+		glShaderSource(compute_shader_volume_tiles, 1, &tmp, nullptr);
+		glCompileShader(compute_shader_volume_tiles);
+	}
+	checkShader(compute_shader_volume_tiles);
+
+	volume_tiles_program = glCreateProgram();
+	glAttachShader(volume_tiles_program, compute_shader_volume_tiles);
+	glLinkProgram(volume_tiles_program);
+
+	vertex_shader_tile_mark = glCreateShader(GL_VERTEX_SHADER);
+	if (loadShader("tile_mark.vert", shader_source) == S_OK)
+	{
+		const char* tmp = static_cast<const char*>(&shader_source[0]);
+		glShaderSource(vertex_shader_tile_mark, 1, &tmp, nullptr);
+		glCompileShader(vertex_shader_tile_mark);
+	}
+	checkShader(vertex_shader_tile_mark);
+
+	fragment_shader_tile_mark = glCreateShader(GL_FRAGMENT_SHADER);
+	if (loadShader("tile_mark.frag", shader_source) == S_OK)
+	{
+		const char* tmp = static_cast<const char*>(&shader_source[0]);
+		glShaderSource(fragment_shader_tile_mark, 1, &tmp, nullptr);
+		glCompileShader(fragment_shader_tile_mark);
+	}
+	checkShader(fragment_shader_tile_mark);
+
+	tile_mark_program = glCreateProgram();
+	glAttachShader(tile_mark_program, vertex_shader_tile_mark);
+	glAttachShader(tile_mark_program, fragment_shader_tile_mark);
+	glLinkProgram(tile_mark_program);
+
+	// the full screen triangle of tile_mark.vert over the G-buffer
+	deferred_program = glCreateProgram();
+	glAttachShader(deferred_program, vertex_shader_tile_mark);
+	glAttachShader(deferred_program, fragment_shader_deferred);
+	glLinkProgram(deferred_program);
+
+	fragment_shader_resolve_mask = glCreateShader(GL_FRAGMENT_SHADER);
+	if (loadShader("resolve_mask.frag", shader_source) == S_OK)
+	{
+		const char* tmp = static_cast<const char*>(&shader_source[0]);
+		glShaderSource(fragment_shader_resolve_mask, 1, &tmp, nullptr);
+		glCompileShader(fragment_shader_resolve_mask);
+	}
+	checkShader(fragment_shader_resolve_mask);
+
+	resolve_mask_program = glCreateProgram();
+	glAttachShader(resolve_mask_program, vertex_shader_tile_mark);
+	glAttachShader(resolve_mask_program, fragment_shader_resolve_mask);
+	glLinkProgram(resolve_mask_program);
 }
 /* load shader code from the text file */
 int Rasterizer::loadShader(const std::string& file_name, std::vector<char>& shader)
@@ -664,7 +4392,27 @@ GLint Rasterizer::checkShader(const GLenum shader)
 void Rasterizer::initCamera(int width, int height, float FOV_y, Vector3 view_from, Vector3 view_at) {
 	camera = Camera(width, height, FOV_y, view_from, view_at);
 }
-void Rasterizer::initLight(Vector3 position, float intensity, bool move){
-	light = Light(position, intensity, move);
+void Rasterizer::initLight(Vector3 position, float intensity, bool move, float range){
+	lights.assign(1, Light(position, intensity, move, range));
+}
+int Rasterizer::addLight(Vector3 position, float intensity, bool move, float range){
+	lights.push_back(Light(position, intensity, move, range));
+
+	return int(lights.size()) - 1;
+}
+const std::vector<LightStats>& Rasterizer::getLightStats() const {
+	return light_stats;
+}
+void Rasterizer::printLightStats() const {
+	printf("Lights: %zu visible, %zu shadowed, shadow budget %.2f ms\n", light_order.size(), no_shadowed_lights, shadow_budget_ms);
+
+	for (size_t i = 0; i < light_stats.size(); ++i)
+	{
+		const LightStats& stats = light_stats[i];
+		const char* state = !stats.bounds.visible ? "outside" : (stats.shadowed ? "shadowed" : "unshadowed");
+
+		printf("  light %zu: %-10s priority %.4f, shadow pass %.3f ms, lighting pass %.3f ms\n", i, state, stats.priority,
+			std::max(stats.shadow_ms, 0.0), std::max(stats.lighting_ms, 0.0));
+	}
 }
 
@@ -7,6 +7,16 @@
 #include "light.h"
 #include "vector2.h"
 #include "objloader.h"
+#include "scene.h"
+#include "volume_builder.h"
+#include "volume_culling.h"
+#include "mesh_cache.h"
+
+// GL_EXT_depth_bounds_test is not part of the glad profile, the entry point is loaded at runtime where available
+#ifndef GL_DEPTH_BOUNDS_TEST_EXT
+#define GL_DEPTH_BOUNDS_TEST_EXT 0x8890
+typedef void (APIENTRYP PFNGLDEPTHBOUNDSEXTPROC)(GLclampd zmin, GLclampd zmax);
+#endif
 
 struct Vertex
 {
@@ -14,15 +24,134 @@ struct Vertex
 	Vector3 normal; /* vertex normal */
 	Vector3 tangent; /* vertex tangent */
 	Vector2 texture_coord; /* vertex texture coordinate */
-	Vector3 color; /* vertex color */
 	int material_index {0}; /* material index */
 };
 
-struct TriangleWithAdjacency
+/* everything but the position, the lighting pass is the only one reading these */
+struct VertexAttributes
+{
+	Vector3 normal; /* vertex normal */
+	Vector3 tangent; /* vertex tangent */
+	Vector2 texture_coord; /* vertex texture coordinate */
+	int material_index {0}; /* material index into the material table */
+};
+
+/* the attributes read by the lighting pass quantized, 12 instead of 36 bytes per vertex, the tangent is not used by any shader */
+struct CompactVertexAttributes
+{
+	GLshort normal[2]; /* octahedral encoded normal, snorm16 */
+	GLushort texture_coord[2]; /* half float texture coordinate */
+	GLushort material_index; /* material index into the material table */
+	GLushort padding;
+};
+
+/* one entry of the material table of the lighting pass, std430 layout of Material in basic_shader.frag */
+struct GpuMaterial
+{
+	GLfloat diffuse[3];
+	GLfloat shininess;
+	GLfloat specular[3];
+	GLfloat roughness;
+	GLfloat emission[3];
+	GLfloat metallic;
+	GLfloat ambient[3];
+	GLfloat ior;
+};
+
+/* layout of the attribute stream, selected at load time */
+enum class VertexLayout { kFull, kCompact };
+
+/* how the stencil pass builds the shadow volumes, switched at runtime with the V key */
+enum class ShadowVolumePath { kGeometryShader, kCompute, kCpu, kEdges };
+
+/* how the stencil pass counts, per caster from the occlusion pyramid, z-fail everywhere or ZP+ (z-pass after the near caps), switched with the Z key,
+the compute and CPU paths always use z-fail */
+enum class StencilMode { kAutomatic, kZFail, kZPassPlus };
+
+/* regions of the persistently mapped CPU volume buffers, the CPU fills one while the GPU may still draw the others, every shadowed light
+of a frame builds into its own region so the fence of a region is kVolumeFramesInFlight frames old when it is reused */
+static const int kVolumeFramesInFlight = 3;
+static const int kMaxShadowedLights = 4; // default of max_shadowed_lights, more shadowed lights per frame wait for the GPU on the CPU path
+static const int kVolumeRegions = kVolumeFramesInFlight * kMaxShadowedLights;
+
+/* hierarchical shadow volumes, screen tiles of kTileSize x kTileSize pixels (the work group of depth_tiles.comp) are classified as lit,
+fully shadowed or boundary and only the boundary tiles are counted per pixel */
+static const int kTileSize = 16;
+
+/* stencil bit of the tiles classified as lit or fully shadowed, the stencil pass skips them and counts in the other bits */
+static const GLuint kTileMarkBit = 0x80;
+
+/* lights whose volumes one draw of stencil_layered.geom extrudes, its invocation count and the layers of the layered depth-stencil target */
+static const int kMaxLayeredLights = 4;
+
+/* material id bit of the G-buffer samples of shadow receivers */
+static const GLuint kReceiverBit = 0x80000000u;
+
+/* layers of the R8 shadow mask array, shadowed lights without a free layer are drawn unshadowed */
+static const int kMaxShadowMasks = 8;
+
+/* lights of one batched shading pass, lights beyond are not drawn by it */
+static const int kMaxBatchedLights = 32;
+
+/* std140 uniform block of the batched shading pass of basic_shader.frag and deferred_light.frag, binding 1 */
+struct BatchedLights
+{
+	GLfloat positions[kMaxBatchedLights][4]; /* xyz, w - range */
+	GLfloat params[kMaxBatchedLights][4]; /* x - intensity, y - mask slot or -1 */
+	GLint no_lights;
+	GLint padding[3];
+};
+
+/* std140 uniform block of stencil_layered.geom, binding 0 */
+struct LayeredLights
+{
+	GLfloat light_positions[kMaxLayeredLights][4];
+	GLint no_lights;
+	GLint padding[3];
+};
+
+/* screen space bounds of the sphere of influence of a light, only these pixels are cleared, counted and lit */
+struct LightBounds
+{
+	GLint x, y; /* scissor rectangle */
+	GLsizei width, height;
+	GLclampd min_depth, max_depth; /* window space range of the stored depth for GL_EXT_depth_bounds_test */
+	bool visible; /* false if the sphere is outside of the view */
+};
+
+/* per light state of the scheduler, the GPU times are those of the last passes whose timer queries have completed */
+struct LightStats
+{
+	LightBounds bounds;
+	float priority{ 0.0f }; /* fraction of the screen covered by the bounds times the intensity */
+	bool shadowed{ false }; /* stencil shadows in the last frame */
+	double shadow_ms{ -1.0 }; /* stencil pass, negative until measured */
+	double lighting_ms{ -1.0 }; /* additive lit pass */
+	GLuint queries[2]{}; /* GL_TIME_ELAPSED of both passes */
+	bool pending[2]{}; /* the query has been issued and not yet read back */
+	int mask_slot{ -1 }; /* layer of the shadow mask array, -1 - none */
+	bool mask_valid{ false }; /* the layer holds the mask of the light and view below */
+	Vector3 mask_light_position;
+	float mask_light_range{ 0.0f };
+	Matrix4x4 mask_MVP;
+	ReceiverGrid receiver_grid; /* CC volume receivers around the light in the view below */
+	bool grid_valid{ false };
+	Vector3 grid_light_position;
+	Matrix4x4 grid_MVP;
+};
+
+/* glDrawElementsIndirect command filled by shadow_volume.comp, followed by its vertex counter */
+struct VolumeCommand
 {
-	std::array<Vertex, 6> vertices;
+	GLuint count;
+	GLuint instance_count;
+	GLuint first_index;
+	GLint base_vertex;
+	GLuint base_instance;
+	GLuint no_vertices; /* not part of the indirect command */
 };
 
+
 class Rasterizer{
 public:
 
@@ -32,12 +161,21 @@ public:
 	void initSurface();
 	void initSurfaceEnvMap();
 	void initSurfaceTriangles();
+	void initMaterials();
+	void initShadowVolumes();
 	void initShaders();
 	void initCamera(int width, int height, float FOV_y, Vector3 view_from, Vector3 view_at);
-	void initLight(Vector3 position, float intensity, bool move = true);
+	void initLight(Vector3 position, float intensity, bool move = true, float range = std::numeric_limits<float>::infinity());
+
+	/* appends a light to the list whose first entry has been set by initLight, returns its index */
+	int addLight(Vector3 position, float intensity, bool move = true, float range = std::numeric_limits<float>::infinity());
+
+	/* scheduler state and GPU times of the last frame per entry of the light list */
+	const std::vector<LightStats>& getLightStats() const;
+	void printLightStats() const;
 
 	void loadMesh(const std::string& file_name, const std::string model);
-	void loadMesh_triangles(const std::string& file_name);
+	void loadMesh_triangles(const std::string& file_name, const VertexLayout layout = VertexLayout::kFull);
 	int loadShader(const std::string& file_name, std::vector<char>& shader);
 	GLint checkShader(const GLenum shader);
 	
@@ -45,9 +183,91 @@ public:
 	int SetEnvMap();
 
 	int mainLoop();
+	void renderFrame();
+
+	/* renders the current frame with both vertex layouts and compares them per channel */
+	int compareVertexLayouts(const int tolerance = 2);
+
+	/* renders the current frame with both shadow volume paths and compares the stencil buffers bit by bit */
+	int compareShadowVolumePaths();
+
+	/* renders the stencil pass with z-fail and with ZP+, compares the shadowed pixels and prints the rasterized samples and the GPU time of both */
+	int compareStencilModes(const int no_frames = 10);
+
+	/* renders the stencil pass of the compute path with and without the tile classification, compares the shadowed pixels and prints the rasterized samples,
+	the GPU time and the lit, fully shadowed and boundary tiles, the samples and time include the depth copy of the classification */
+	int compareHierarchicalVolumes(const int no_frames = 10);
+
+	/* renders the stencil pass of every light with infinite and with CC volumes, compares the shadowed pixels and prints the rasterized samples and
+	the GPU time of both per light */
+	int compareCCVolumes(const int no_frames = 10);
+
+	/* copies the loaded objects to a no_rows x no_columns grid spacing apart on a generated ground plane receiver, call before initSurfaceTriangles */
+	void generateGridScene(const int no_rows, const int no_columns, const float spacing);
+
+	/* times the stencil pass of the geometry shader and the CPU path for a growing number of caster triangles and CPU threads,
+	then the geometry shader work of the triangle and the edge based volumes */
+	int benchmarkShadowVolumes(const int no_frames = 10);
+
+	/* rewrites one entry of the material table after its Material has been edited, the geometry stays as it is */
+	void updateMaterial(const int material_id);
 private:
+	int loadMeshCache(const std::string& file_name);
+	void buildVertexPool(const std::string& file_name);
+	void uploadVertexAttributes();
+	void drawObjects(const GLuint program, const uint8_t mask, const uint8_t value);
+	void extractShadowVolumes(const GLfloat* light_position);
+	std::vector<VolumeCaster> gatherCasters(const size_t max_triangles = std::numeric_limits<size_t>::max()) const;
+	void buildCpuShadowVolumes(const Vector3& light_position, const std::vector<VolumeCaster>& casters, const int no_threads = 0, const SimdLevel level = DetectSimdLevel());
+	void drawCpuShadowVolumes();
+	void reserveCpuShadowVolumes(const size_t no_vertices, const size_t no_indices);
+	void setStencilPassState(const bool z_pass = false);
+	void renderShadowPass(const std::vector<float>& light_position_ws, LightStats* stats = nullptr);
+	LightBounds computeLightBounds(const Light& light);
+	void setLightBounds(const LightBounds& bounds);
+	void clearLightBounds();
+	void scheduleLights();
+	void collectLightTimings();
+	bool beginLightTimer(LightStats& stats, const int pass);
+	void endLightTimer(LightStats& stats, const int pass);
+	void cullCasters(const Vector3& light_position);
+	void clampCasters(const Vector3& light_position, LightStats* stats);
+	void buildReceiverGrid(const Vector3& light_position, ReceiverGrid& target);
+	void initHierarchicalVolumes();
+	void classifyTiles();
+	void markTiles();
+	void initLayeredVolumes();
+	void uploadLayeredLights(const std::vector<int>& batch);
+	void renderLayeredShadowPass(const std::vector<int>& batch);
+	void initCountingVolumes();
+	void renderCountingPass(const std::vector<int>& batch);
+	void checkCountOverflows();
+	void initDeferredShading();
+	void renderGBuffer();
+	void drawDeferredPass(const int receivers, const int layer, const int lane = -1);
+	void initShadowMasks();
+	void assignShadowMasks();
+	bool shadowMaskCurrent(const Light& light, const LightStats& stats);
+	void resolveShadowMask(const int slot, const int layer, const int lane = -1);
+	void drawBatchedLights();
+	void classifyCasters(const Vector3& light_position, const StencilMode mode);
+	void drawNearCaps(const GLfloat* light_position);
+	void drawObjectEdges(const GLuint program, const uint8_t mask, const uint8_t value);
+	void drawEdgeVolumes(const GLfloat* light_position);
+	void buildEdges();
+	const VertexAttributes& poolAttributes(const size_t vertex) const;
+	std::vector<GLubyte> captureStencil();
+	void measureShadowPass(const std::vector<float>& light_position_ws, const int no_frames, GLuint64& no_samples, double& gpu_ms, std::vector<GLubyte>& stencil);
+	Texture3u captureFrame();
+
 	Camera camera;
-	Light light;
+	std::vector<Light> lights; // the first one is also used by the ambient pass, the benchmarks and the comparisons
+	std::vector<LightStats> light_stats;
+	std::vector<int> light_order; // visible lights by decreasing priority
+	size_t no_shadowed_lights{ 0 }; // of the last frame
+	int max_shadowed_lights{ kMaxShadowedLights };
+	double shadow_budget_ms{ 1.0 }; // estimated GPU time of all stencil passes of a frame
+	float ambient_intensity{ 0.05f }; // of the ambient pass, scales the ambient times the diffuse color of the materials
 
 	GLFWwindow* window;
 	GLuint shader_program;
@@ -64,11 +284,105 @@ private:
 	GLuint fragment_shader_stencil;
 	GLuint stencil_program{ 0 };
 
+	GLuint geometry_shader_edges;
+	GLuint edges_program{ 0 }; // silhouette quads of the unique edges
+	GLuint vertex_shader_caps;
+	GLuint caps_program{ 0 }; // front and back caps for the edge based volumes, no geometry shader
+	GLuint vertex_shader_near_caps;
+	GLuint near_caps_program{ 0 }; // ZP+ caps projected onto the near plane
+
+	GLuint compute_shader_volume;
+	GLuint volume_compute_program{ 0 }; // silhouette and cap extraction
+	GLuint vertex_shader_volume;
+	GLuint volume_program{ 0 }; // draws the extracted volumes, shares stencil_shader.frag
+
+	GLuint compute_shader_depth_tiles;
+	GLuint depth_tiles_program{ 0 }; // min/max depth per tile
+	GLuint compute_shader_volume_tiles;
+	GLuint volume_tiles_program{ 0 }; // tests the extracted volumes against the tiles
+	GLuint vertex_shader_tile_mark;
+	GLuint fragment_shader_tile_mark;
+	GLuint tile_mark_program{ 0 }; // writes kTileMarkBit into the lit and fully shadowed tiles
+	GLuint geometry_shader_layered;
+	GLuint layered_program{ 0 }; // volumes of up to kMaxLayeredLights lights per draw
+	GLuint fragment_shader_count;
+	GLuint count_program{ 0 }; // the same volumes counted with image atomics
+	GLuint fragment_shader_gbuffer;
+	GLuint gbuffer_program{ 0 }; // basic_shader.vert writing the G-buffer
+	GLuint fragment_shader_deferred;
+	GLuint deferred_program{ 0 }; // full screen lighting of the G-buffer samples
+	GLuint fragment_shader_resolve_mask;
+	GLuint resolve_mask_program{ 0 }; // lit fraction of the samples of a stencil into a mask layer
+
 	GLuint vbo_env{ 0 };
 	GLuint vao_env{ 0 };
 
-	GLuint vbo{ 0 };
-	GLuint vao{ 0 };
+	GLuint vbo{ 0 }; // vertex attributes without positions
+	GLuint vao{ 0 }; // positions + attributes for the lighting pass
+	GLuint vbo_positions{ 0 }; // tightly packed positions
+	GLuint vao_positions{ 0 }; // positions only for the depth and stencil passes
+	GLuint ebo{ 0 }; // GL_TRIANGLES_ADJACENCY indices, shared by both vaos
+	GLuint ebo_edges{ 0 }; // GL_LINES_ADJACENCY indices of the unique edges
+	GLuint vao_edges{ 0 }; // positions + edge indices
+	GLuint ssbo_face_normals{ 0 }; // unnormalized object space normal per triangle of the ebo
+	GLuint vao_caps{ 0 }; // no attributes, stencil_caps.vert pulls its vertices
+	GLuint ssbo_materials{ 0 }; // GpuMaterial per entry of scene.materials
+	GLuint ssbo_volume_vertices{ 0 }; // 6 vec4 per light facing caster triangle
+	GLuint ssbo_volume_indices{ 0 }; // up to 23 strip indices per light facing caster triangle
+	GLuint volume_command{ 0 }; // VolumeCommand, also the GL_DRAW_INDIRECT_BUFFER
+	GLuint vao_volumes{ 0 };
+
+	GLuint fbo_tile_depth{ 0 }; // depth-only repetition of the depth pass, the default framebuffer cannot be sampled
+	GLuint tex_tile_depth{ 0 }; // multisampled like the default framebuffer
+	GLint no_depth_samples{ 1 };
+	GLuint tex_depth_tiles{ 0 }; // GL_RG32F (min, max) window depth per tile
+	GLuint ssbo_tiles{ 0 }; // (z-fail count, boundary) per tile
+	GLint no_tiles_x{ 0 };
+	GLint no_tiles_y{ 0 };
+
+	GLuint tex_layered_depth_stencil{ 0 }; // kMaxLayeredLights layers multisampled like the default framebuffer, sampled as stencil
+	GLuint fbo_layered{ 0 }; // all layers, gl_Layer selects one
+	GLuint fbo_layered_copy{ 0 }; // one layer at a time as the target of the depth blit
+	GLuint ubo_layered_lights{ 0 }; // LayeredLights
+	bool layered_supported{ false }; // the depth blit needs the same depth-stencil format as the default framebuffer
+	GLuint layered_query{ 0 }; // GL_TIME_ELAPSED of the layered or counting pass, split among its lights
+	bool layered_pending{ false };
+	std::vector<int> layered_timed_lights;
+
+	GLuint tex_shadow_counts{ 0 }; // GL_R32I array, z-fail count per pixel and light, or 8 bit lanes of all lights in layer 0
+	GLuint tex_count_depth{ 0 }; // one sample of the depth per pixel
+	GLuint fbo_count{ 0 };
+	GLuint acb_count_overflows{ 0 }; // atomic counter of the packed texels whose lanes carried, read one frame later
+	bool counting_supported{ false };
+
+	GLuint tex_gbuffer_normals{ 0 }; // GL_RG16_SNORM octahedral encoded world space normal, 12 B per sample with the material and depth
+	GLuint tex_gbuffer_materials{ 0 }; // GL_R32UI material id | kReceiverBit
+	GLuint tex_gbuffer_depths{ 0 }; // GL_R32F window depth, 1 - no geometry
+	GLuint tex_deferred_color{ 0 }; // GL_RGBA8 sum of the lighting passes, blitted into the default framebuffer
+	GLuint tex_deferred_depth_stencil{ 0 }; // shared by both framebuffers, the shadow passes count in its stencil
+	GLuint fbo_gbuffer{ 0 };
+	GLuint fbo_deferred{ 0 }; // color, the environment, shadow and lighting passes
+	bool deferred_supported{ false }; // the final blit needs the same formats as the default framebuffer
+	GLuint frame_fbo{ 0 }; // framebuffer of the frame in progress, passes that bind their own return to it
+
+	GLuint tex_shadow_masks{ 0 }; // GL_R8 array of kMaxShadowMasks layers, lit fraction per pixel
+	GLuint fbo_shadow_masks{ 0 }; // one layer at a time
+	GLuint tex_mask_stencil{ 0 }; // copy of the stencil of the default framebuffer, the deferred path reads its own
+	GLuint fbo_mask_stencil{ 0 };
+	GLuint ubo_batched_lights{ 0 }; // BatchedLights
+	bool masks_supported{ false }; // the stencil copy needs the same depth-stencil format as the default framebuffer
+
+	VolumeBuilder volume_builder; // CPU path
+	GLuint vbo_volumes_cpu{ 0 }; // kVolumeRegions regions of volume_vertex_capacity vec4, allocated by the first CPU build
+	GLuint ebo_volumes_cpu{ 0 }; // kVolumeRegions regions of volume_index_capacity indices, grown with the output of the builds
+	GLuint vao_volumes_cpu{ 0 };
+	GLfloat* mapped_volume_vertices{ nullptr };
+	GLuint* mapped_volume_indices{ nullptr };
+	GLsync volume_fences[kVolumeRegions]{};
+	size_t volume_vertex_capacity{ 0 };
+	size_t volume_index_capacity{ 0 };
+	int volume_region{ 0 }; // region written by the last build
+	size_t volume_no_indices{ 0 };
 
 	GLuint tex_irradiance_map{ 0 };
 	GLuint tex_normal_map{ 0 };
@@ -87,8 +401,36 @@ private:
 
 	std::vector<Vertex> loadedVerticesMap;
 	std::vector<Vertex> loadedVertices;
-	std::vector<TriangleWithAdjacency> loaded_triangles;
+	std::vector<Vector3> pool_positions; // deduplicated vertices shared by all triangles, split into two streams
+	std::vector<VertexAttributes> pool_attributes; // of the vertices after the first no_cached_vertices
+	MeshCache mesh_cache; // stays mapped, its attributes are uploaded straight from the file
+	size_t no_cached_vertices{ 0 }; // leading vertices of the pool whose attributes are read from mesh_cache
+	VertexLayout vertex_layout{ VertexLayout::kFull };
+	ShadowVolumePath shadow_volume_path{ ShadowVolumePath::kGeometryShader };
+	StencilMode stencil_mode{ StencilMode::kAutomatic };
+	PFNGLDEPTHBOUNDSEXTPROC depth_bounds_ext{ nullptr }; // nullptr without GL_EXT_depth_bounds_test
+	size_t no_zpass_casters{ 0 }; // of the last frame
+	size_t no_zfail_casters{ 0 };
+	size_t no_culled_casters{ 0 };
+	SphereBatch caster_spheres; // world space bounding spheres of the casters, refilled every frame
+	std::vector<ObjectHandle> caster_handles; // object of every sphere
+	std::vector<uint8_t> caster_visibility;
+	bool cc_volumes{ true }; // culls the casters that shadow no receiver and clamps the volumes of the others
+	size_t no_cc_culled_casters{ 0 }; // of no_culled_casters
+	ReceiverGrid receiver_grid; // of the shadow passes without light stats, rebuilt every time
+	bool hierarchical_volumes{ false }; // tile classification of the compute path volumes
+	bool tiles_marked{ false }; // the stencil of the last shadow pass holds kTileMarkBit in the lit and fully shadowed tiles
+	bool layered_volumes{ false }; // the shadowed lights share one draw of the layered volumes and the lighting reads their layers
+	bool deferred_shading{ false }; // one G-buffer pass and full screen lighting passes instead of redrawing the objects per light
+	bool atomic_counting{ false }; // the batched lights count in tex_shadow_counts instead of the layered stencil
+	bool packed_counts{ false }; // one 8 bit lane per light in a single texel instead of one texel per light, exact up to 255 volumes
+	// over a pixel per light, beyond that the readers shadow the pixel and checkCountOverflows falls back to 32 bit counts
+	bool batched_shading{ false }; // shadow masks per light, cached for unchanged lights and views, and one shading pass for all lights
+	std::vector<GLuint> adjacency_indices; // 6 indices per triangle (v0, adj01, v1, adj12, v2, adj20)
+	std::vector<GLuint> edge_indices; // 4 indices per unique edge (o1, a, b, o2)
+	std::vector<Vector3> face_normals; // cross(v1 - v0, v2 - v0) per triangle of adjacency_indices
 
 	MaterialLibrary materials_;
+	Scene scene; // objects drawn from ranges of adjacency_indices
 };
 
@@ -0,0 +1,48 @@
+#version 460 core
+
+// lit fraction of the samples of one pixel, the shadow mask of a light written into a layer of the R8 mask array
+layout ( location = 0 ) out float mask;
+
+layout ( binding = 14 ) uniform usampler2DMS stencil_source; // stencil of the frame
+layout ( binding = 9 ) uniform usampler2DMSArray shadow_masks; // stencil of the layered shadow volumes
+layout ( binding = 15 ) uniform isampler2DArray shadow_counts; // z-fail counts of stencil_count.frag
+
+// uniform variables
+uniform int source_layer = -1; // layer of shadow_masks, -1 - stencil_source
+uniform int no_samples;
+uniform int stencil_mask; // without kTileMarkBit after the tile classification
+uniform int count_lane = -1; // light of shadow_counts, takes precedence over source_layer
+uniform bool packed_counts = false; // 8 bit lanes in layer 0, the sum of all lanes in layer 1
+layout ( binding = 0, offset = 0 ) uniform atomic_uint no_count_overflows; // packed texels whose lanes carried, see Rasterizer::checkCountOverflows
+
+// lane of the packed counts, -1 (shadowed) and counted in no_count_overflows if a lane of the texel has carried into the next one
+int packed_count( ivec2 pixel, int lane ) {
+	int lanes = texelFetch( shadow_counts, ivec3( pixel, 0 ), 0 ).r;
+	int total = texelFetch( shadow_counts, ivec3( pixel, 1 ), 0 ).r;
+	if ( ( lanes & 0xFF ) + ( ( lanes >> 8 ) & 0xFF ) + ( ( lanes >> 16 ) & 0xFF ) + ( ( lanes >> 24 ) & 0xFF ) != total ) {
+		atomicCounterIncrement( no_count_overflows );
+		return -1;
+	}
+	return ( lanes >> ( 8 * lane ) ) & 0xFF;
+}
+
+void main( void )
+{
+	ivec2 pixel = ivec2( gl_FragCoord.xy );
+
+	if ( count_lane >= 0 ) {
+		// the counts are per pixel, the mask is either lit or shadowed
+		int count = packed_counts ? packed_count( pixel, count_lane ) : texelFetch( shadow_counts, ivec3( pixel, count_lane ), 0 ).r;
+		mask = count == 0 ? 1.0f : 0.0f;
+		return;
+	}
+
+	int no_lit = 0;
+
+	for ( int i = 0; i < no_samples; ++i ) {
+		uint stencil = source_layer < 0 ? texelFetch( stencil_source, pixel, i ).r : texelFetch( shadow_masks, ivec3( pixel, source_layer ), i ).r;
+		no_lit += ( int( stencil ) & stencil_mask ) == 0 ? 1 : 0;
+	}
+
+	mask = float( no_lit ) / float( no_samples );
+}
@@ -0,0 +1,141 @@
+#include "pch.h"
+#include "scene.h"
+
+ObjectHandle Scene::Add(const std::string& name, const GLuint first_index, const GLuint no_indices, const int material_id, const uint8_t flags)
+{
+	const ObjectHandle object = ObjectHandle(size());
+
+	transforms.push_back(Matrix4x4());
+	normal_transforms.push_back(Matrix4x4());
+	bounds_min.push_back(Vector3());
+	bounds_max.push_back(Vector3());
+	sphere_centers.push_back(Vector3());
+	sphere_radii.push_back(0.0f);
+	first_indices.push_back(first_index);
+	this->no_indices.push_back(no_indices);
+	first_edge_indices.push_back(0);
+	no_edge_indices.push_back(0);
+	material_ids.push_back(material_id);
+	this->flags.push_back(flags);
+	extrusion_distances.push_back(0.0f);
+	names.push_back(name);
+
+	handles_.emplace(name, object); // the first object of the name wins
+
+	return object;
+}
+
+ObjectHandle Scene::Find(const std::string& name) const
+{
+	const auto handle = handles_.find(name);
+
+	return (handle != handles_.end()) ? handle->second : kInvalidObject;
+}
+
+void Scene::UpdateBounds(const ObjectHandle object, const Vector3* positions, const GLuint* indices)
+{
+	const GLuint* first = indices + first_indices[object];
+	const GLuint* last = first + no_indices[object];
+
+	Vector3 lower(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+	Vector3 upper = -lower;
+
+	// only the even slots are triangle corners, the odd ones are adjacent vertices of other triangles or the null vertex
+	for (const GLuint* index = first; index < last; index += 2)
+	{
+		const Vector3& p = positions[*index];
+
+		lower = Vector3(std::min(lower.x, p.x), std::min(lower.y, p.y), std::min(lower.z, p.z));
+		upper = Vector3(std::max(upper.x, p.x), std::max(upper.y, p.y), std::max(upper.z, p.z));
+	}
+
+	if (first == last)
+	{
+		lower = upper = Vector3();
+	}
+
+	const Vector3 center = (lower + upper) * 0.5f;
+	float radius_sqr = 0.0f;
+
+	for (const GLuint* index = first; index < last; index += 2)
+	{
+		radius_sqr = std::max(radius_sqr, (positions[*index] - center).SqrL2Norm());
+	}
+
+	bounds_min[object] = lower;
+	bounds_max[object] = upper;
+	sphere_centers[object] = center;
+	sphere_radii[object] = sqrtf(radius_sqr);
+}
+
+void Scene::SetMaterials(const MaterialLibrary& library)
+{
+	materials.clear();
+	materials.reserve(library.size());
+
+	for (const auto& material : library)
+	{
+		materials.push_back(material.second);
+	}
+}
+
+void Scene::UpdateNormalTransforms()
+{
+	normal_transforms.resize(transforms.size());
+
+	for (size_t i = 0; i < transforms.size(); ++i)
+	{
+		const Matrix4x4& T = transforms[i];
+		Matrix4x4& N = normal_transforms[i];
+
+		// the inverse transpose is the cofactor matrix over the determinant, the translation does not apply to normals
+		float cofactors[3][3];
+
+		for (int r = 0; r < 3; ++r)
+		{
+			for (int c = 0; c < 3; ++c)
+			{
+				cofactors[r][c] = T.get((r + 1) % 3, (c + 1) % 3) * T.get((r + 2) % 3, (c + 2) % 3) -
+					T.get((r + 1) % 3, (c + 2) % 3) * T.get((r + 2) % 3, (c + 1) % 3);
+			}
+		}
+
+		const float det = T.get(0, 0) * cofactors[0][0] + T.get(0, 1) * cofactors[0][1] + T.get(0, 2) * cofactors[0][2];
+
+		N = Matrix4x4();
+
+		// a degenerate (zero scale) transform has no inverse, its normals are left untransformed instead of inf or NaN
+		if (fabsf(det) < 1e-12f)
+		{
+			continue;
+		}
+
+		for (int r = 0; r < 3; ++r)
+		{
+			for (int c = 0; c < 3; ++c)
+			{
+				N.set(r, c, cofactors[r][c] / det);
+			}
+		}
+	}
+}
+
+void Scene::Clear()
+{
+	transforms.clear();
+	normal_transforms.clear();
+	bounds_min.clear();
+	bounds_max.clear();
+	sphere_centers.clear();
+	sphere_radii.clear();
+	first_indices.clear();
+	no_indices.clear();
+	first_edge_indices.clear();
+	no_edge_indices.clear();
+	material_ids.clear();
+	flags.clear();
+	extrusion_distances.clear();
+	names.clear();
+	materials.clear();
+	handles_.clear();
+}
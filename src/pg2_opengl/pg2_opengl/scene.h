@@ -0,0 +1,67 @@
+#ifndef SCENE_H_
+#define SCENE_H_
+
+#include "pch.h"
+#include "vector3.h"
+#include "matrix4x4.h"
+#include "objloader.h"
+
+/* dense handle of a scene object, index into the arrays of Scene */
+typedef uint32_t ObjectHandle;
+
+static const ObjectHandle kInvalidObject = std::numeric_limits<ObjectHandle>::max();
+
+enum ObjectFlags : uint8_t
+{
+	kCaster = 1 << 0, /* casts shadows, drawn in the stencil pass */
+	kReceiver = 1 << 1, /* receives shadows, lit only where the stencil is zero */
+	kCasterReceiver = kCaster | kReceiver,
+	kZFail = 1 << 2, /* set per frame, the near plane may be inside the shadow volume of the caster */
+	kCulled = 1 << 3 /* set per frame, the shadow volume of the caster misses the view */
+};
+
+/* flat scene storage, the i-th entry of every array belongs to the object with handle i */
+class Scene
+{
+public:
+	/* appends an object drawn from the adjacency indices [first_index, first_index + no_indices) */
+	ObjectHandle Add(const std::string& name, const GLuint first_index, const GLuint no_indices, const int material_id, const uint8_t flags = kCasterReceiver);
+
+	/* name lookup, meant for load time only */
+	ObjectHandle Find(const std::string& name) const;
+
+	/* object space bounds of the triangle corners of the object */
+	void UpdateBounds(const ObjectHandle object, const Vector3* positions, const GLuint* indices);
+
+	/* recomputes normal_transforms, has to be called after transforms change */
+	void UpdateNormalTransforms();
+
+	/* dense material table, material ids are positions in the library */
+	void SetMaterials(const MaterialLibrary& materials);
+
+	void Clear();
+
+	size_t size() const { return first_indices.size(); }
+
+	std::vector<Matrix4x4> transforms; /* object to world space */
+	std::vector<Matrix4x4> normal_transforms; /* inverse transpose of the linear part of transforms */
+	std::vector<Vector3> bounds_min; /* object space AABB */
+	std::vector<Vector3> bounds_max;
+	std::vector<Vector3> sphere_centers; /* object space bounding sphere */
+	std::vector<float> sphere_radii;
+	std::vector<GLuint> first_indices; /* range in the adjacency index buffer */
+	std::vector<GLuint> no_indices;
+	std::vector<GLuint> first_edge_indices; /* range in the GL_LINES_ADJACENCY edge index buffer, see BuildEdgeList */
+	std::vector<GLuint> no_edge_indices;
+	std::vector<int> material_ids; /* material of most of the triangles, vertices carry their own material index */
+	std::vector<uint8_t> flags; /* ObjectFlags */
+	std::vector<float> extrusion_distances; /* set per frame, distance from the light at which the CC shadow volume of the caster ends, 0 - infinity */
+
+	std::vector<std::string> names; /* diagnostics only */
+	std::vector<std::shared_ptr<Material>> materials; /* indexed by material id */
+
+private:
+	std::unordered_map<std::string, ObjectHandle> handles_;
+};
+
+#endif
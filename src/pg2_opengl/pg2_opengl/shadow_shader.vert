@@ -4,8 +4,9 @@ layout ( location = 0 ) in vec4 in_position_ms;
 
 // uniform variables
 uniform mat4 mlp; // Projection (P_l)*Light (V_l)*Model (M) matrix
+uniform mat4 object_transform; // object to world space
 
 void main( void )
 {
-	gl_Position = mlp * in_position_ms;
+	gl_Position = mlp * object_transform * in_position_ms;
 }
\ No newline at end of file
@@ -0,0 +1,14 @@
+#version 460 core
+
+// vertex attributes
+layout ( location = 0 ) in vec4 in_position_ws; // written by shadow_volume.comp, w = 0 for vertices in infinity
+
+// uniform variables
+uniform mat4 MVP; // (Model) View Projection matrix
+
+out vec3 fColor;
+
+void main( void ) {
+	fColor = vec3(1.0f, 1.0f, 1.0f);
+	gl_Position = MVP * in_position_ws;
+}
@@ -0,0 +1,82 @@
+#version 460 core
+
+// front and back caps of the light facing triangles without a geometry shader, the silhouette quads are drawn by stencil_edges.geom
+// drawn with glDrawArraysInstanced as a plain triangle list over the adjacency index buffer, instance 0 is the front cap and instance 1 the back cap,
+// a base instance of 1 draws the back cap only
+
+// vbo_positions, tightly packed vec3
+layout ( std430, binding = 1 ) readonly buffer Positions
+{
+	float positions[];
+};
+
+// ebo, 6 indices per triangle (v0, adj01, v1, adj12, v2, adj20)
+layout ( std430, binding = 2 ) readonly buffer Indices
+{
+	uint indices[];
+};
+
+// unnormalized object space normal cross( V2-V0, V4-V0 ) of every triangle in the ebo, tightly packed vec3
+layout ( std430, binding = 6 ) readonly buffer FaceNormals
+{
+	float face_normals[];
+};
+
+// uniform variables
+uniform mat4 MVP; // (Model) View Projection matrix
+uniform mat4 object_transform; // object to world space
+uniform vec3 light_position; 
+uniform float extrusion_distance = 0.0f; // CC volumes end this far from the light, 0 - at infinity
+
+out vec3 fColor;
+
+vec3 fetch_position( uint i )
+{
+	uint v = indices[i];
+	return ( object_transform * vec4( positions[3 * v], positions[3 * v + 1], positions[3 * v + 2], 1.0f ) ).xyz;
+}
+
+// far end of the volume behind V, the same as extrude() of stencil_shader.geom
+vec4 extrude( vec3 V ) {
+	if ( extrusion_distance > 0.0f ) {
+		return vec4( light_position + normalize( V - light_position ) * extrusion_distance, 1.0f );
+	}
+	return vec4( V - light_position, 0.0f );
+}
+
+void main( void ) {
+	uint triangle = uint( gl_VertexID ) / 3u;
+	uint corner = uint( gl_VertexID ) % 3u;
+	int cap = gl_InstanceID + gl_BaseInstance;
+
+	// the front cap is wound V0, V4, V2 and the back cap V0, V2, V4 as in stencil_shader.geom
+	if ( cap == 0 ) {
+		corner = ( 3u - corner ) % 3u;
+	}
+
+	// cofactor matrix of the linear part, transforms normals without an inverse and keeps the orientation of mirroring transforms
+	mat3 A = mat3( object_transform );
+	vec3 N = mat3( cross( A[1], A[2] ), cross( A[2], A[0] ), cross( A[0], A[1] ) ) *
+		vec3( face_normals[3 * triangle], face_normals[3 * triangle + 1], face_normals[3 * triangle + 2] );
+
+	// all three vertices test against the first corner so that they agree on the triangle
+	vec3 V0 = fetch_position( 6u * triangle );
+
+	// Handle only light facing triangles (CCW), the others collapse to a point outside of the clip volume
+	if ( !( dot( light_position - V0, N ) > 0 ) ) {
+		fColor = vec3(0.0f,0.0f,0.0f);
+		gl_Position = vec4(2.0f, 2.0f, 2.0f, 1.0f);
+		return;
+	}
+
+	vec3 V = fetch_position( 6u * triangle + 2u * corner );
+
+	if ( cap == 0 ) { // FRONT CAP
+		fColor = vec3(0.0f,1.0f,0.0f);
+		gl_Position = MVP * vec4(V + normalize(V - light_position) * 0.01f, 1.0f);
+	}
+	else { // BACK CAP
+		fColor = vec3(0.0f,0.0f,1.0f);
+		gl_Position = MVP * extrude(V);
+	}
+}
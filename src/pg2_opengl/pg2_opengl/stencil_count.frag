@@ -0,0 +1,27 @@
+#version 460 core
+
+// the volumes of stencil_layered.geom counted with image atomics instead of the stencil, the depth test runs before the shader
+// with the comparison of the z-fail test inverted, so only the volume fragments behind the scene are counted
+layout ( early_fragment_tests ) in;
+
+layout ( binding = 1, r32i ) uniform coherent iimage2DArray shadow_counts;
+
+// uniform variables
+uniform bool packed_counts = false; // 8 bit lane gl_Layer in layer 0 instead of a whole texel in layer gl_Layer, the sum of all lanes in layer 1
+
+void main( void )
+{
+	// back faces increment and front faces decrement as the z-fail stencil ops, the sum does not depend on the order
+	int delta = gl_FrontFacing ? -1 : 1;
+	ivec2 pixel = ivec2( gl_FragCoord.xy );
+
+	if ( packed_counts ) {
+		// the carries and borrows of the lanes cancel out while every final count is below 256, a final count of 256 or more
+		// carries into the next lane, which the readers detect as lanes that do not add up to the plain sum of layer 1
+		imageAtomicAdd( shadow_counts, ivec3( pixel, 0 ), delta * ( 1 << ( 8 * gl_Layer ) ) );
+		imageAtomicAdd( shadow_counts, ivec3( pixel, 1 ), delta );
+	}
+	else {
+		imageAtomicAdd( shadow_counts, ivec3( pixel, gl_Layer ), delta );
+	}
+}
@@ -0,0 +1,75 @@
+#version 460 core
+
+// ZP+ near caps, the light facing triangles projected from the light onto the near plane of the camera, drawn like stencil_caps.vert
+// with glDrawArrays over the adjacency index buffer, every near plane point is covered once per light facing triangle between it and the light
+
+// vbo_positions, tightly packed vec3
+layout ( std430, binding = 1 ) readonly buffer Positions
+{
+	float positions[];
+};
+
+// ebo, 6 indices per triangle (v0, adj01, v1, adj12, v2, adj20)
+layout ( std430, binding = 2 ) readonly buffer Indices
+{
+	uint indices[];
+};
+
+// unnormalized object space normal cross( V2-V0, V4-V0 ) of every triangle in the ebo, tightly packed vec3
+layout ( std430, binding = 6 ) readonly buffer FaceNormals
+{
+	float face_normals[];
+};
+
+// uniform variables
+uniform mat4 MVP; // (Model) View Projection matrix
+uniform mat4 object_transform; // object to world space
+uniform vec3 light_position; 
+uniform vec4 near_plane; // world space, dot( near_plane.xyz, X ) = near_plane.w, the normal points along the view direction
+
+out vec3 fColor;
+
+vec3 fetch_position( uint i )
+{
+	uint v = indices[i];
+	return ( object_transform * vec4( positions[3 * v], positions[3 * v + 1], positions[3 * v + 2], 1.0f ) ).xyz;
+}
+
+void main( void ) {
+	uint triangle = uint( gl_VertexID ) / 3u;
+	uint corner = uint( gl_VertexID ) % 3u;
+
+	mat3 A = mat3( object_transform );
+	vec3 N = mat3( cross( A[1], A[2] ), cross( A[2], A[0] ), cross( A[0], A[1] ) ) *
+		vec3( face_normals[3 * triangle], face_normals[3 * triangle + 1], face_normals[3 * triangle + 2] );
+
+	vec3 V0 = fetch_position( 6u * triangle );
+
+	fColor = vec3(1.0f,0.0f,1.0f);
+	gl_ClipDistance[0] = -1.0f;
+	gl_ClipDistance[1] = -1.0f;
+
+	if ( !( dot( light_position - V0, N ) > 0 ) ) {
+		gl_Position = vec4(2.0f, 2.0f, 2.0f, 1.0f);
+		return;
+	}
+
+	// the shift along the ray from the light does not move the projection, only the clipping below
+	vec3 V = fetch_position( 6u * triangle + 2u * corner );
+	V += normalize(V - light_position) * 0.01f;
+
+	// only the part of the triangle in the slab between the light and the near plane occludes near plane points
+	float light_distance = dot( near_plane.xyz, light_position ) - near_plane.w;
+	float s = ( light_distance > 0 ) ? 1.0f : -1.0f;
+	float v_distance = dot( near_plane.xyz, V ) - near_plane.w;
+
+	gl_ClipDistance[0] = s * v_distance;
+	gl_ClipDistance[1] = s * ( light_distance - v_distance );
+
+	// central projection L + t (V - L) with t = -light_distance / dot( n, V - L ) in homogeneous coordinates, linear in V so that the clipping
+	// interpolates like in world space, the sign keeps w positive inside of the slab
+	float w = dot( near_plane.xyz, V - light_position );
+	vec4 Q = vec4( w * light_position - light_distance * ( V - light_position ), w ) * -s;
+
+	gl_Position = MVP * Q;
+}
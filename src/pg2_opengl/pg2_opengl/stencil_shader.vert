@@ -3,7 +3,10 @@
 // vertex attributes
 layout ( location = 0 ) in vec4 in_position_ms;
 
+// uniform variables
+uniform mat4 object_transform; // object to world space, the volumes are extruded in world space
+
 void main( void ) {
-	gl_Position = in_position_ms;
+	gl_Position = object_transform * in_position_ms;
 }
 
@@ -0,0 +1,22 @@
+#version 460 core
+
+// keeps the fragments of the lit or of the fully shadowed tiles classified by volume_tiles.comp, the stencil is written by glStencilOp only
+layout ( std430, binding = 7 ) readonly buffer Tiles
+{
+	ivec2 tiles[];
+};
+
+// uniform variables
+uniform int tile_size;
+uniform int no_tiles_x;
+uniform bool shadowed; // marks the fully shadowed tiles instead of the lit ones
+
+void main( void )
+{
+	ivec2 tile = ivec2( gl_FragCoord.xy ) / tile_size;
+	ivec2 classification = tiles[tile.y * no_tiles_x + tile.x];
+
+	if ( classification.y != 0 || ( classification.x != 0 ) != shadowed ) {
+		discard;
+	}
+}
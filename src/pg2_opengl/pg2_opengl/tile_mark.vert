@@ -0,0 +1,7 @@
+#version 460 core
+
+// one triangle over the whole viewport, no vertex attributes
+void main( void ) {
+	vec2 P = vec2( ( gl_VertexID << 1 ) & 2, gl_VertexID & 2 );
+	gl_Position = vec4( P * 2.0f - 1.0f, 0.0f, 1.0f );
+}
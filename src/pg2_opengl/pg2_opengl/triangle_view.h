@@ -0,0 +1,109 @@
+#ifndef TRIANGLE_VIEW_H_
+#define TRIANGLE_VIEW_H_
+
+#include "pch.h"
+#include "objloader.h"
+
+/* non-owning view of one face of a patch, same accessors as Triangle3i but nothing is copied or allocated */
+class TriangleView
+{
+public:
+	TriangleView(const Face3i& face, const VertexBuffer4f& vertex_buffer) : face_(&face), vertex_buffer_(&vertex_buffer) {}
+
+	int position_index(const int i) const { return face_->vertices[i].position_index; }
+	int texture_coord_index(const int i) const { return face_->vertices[i].texture_coord_index; }
+	int normal_index(const int i) const { return face_->vertices[i].normal_index; }
+	int tangent_index(const int i) const { return normal_index(i); } // normal and tangent share the same index
+
+	const Vector3& position(const int i) const { return vertex_buffer_->positions[position_index(i)]; }
+	const Vector3& texture_coord(const int i) const { return vertex_buffer_->texture_coords[texture_coord_index(i)]; }
+	const Vector3& normal(const int i) const { return vertex_buffer_->normals[normal_index(i)]; }
+	const Vector3& tangent(const int i) const { return vertex_buffer_->tangents[tangent_index(i)]; }
+
+	/* position index of the vertex adjacent to the i-th edge or -1 */
+	int adjacency(const int edge) const { return face_->adjacent_vertices[edge]; }
+
+	/* position of the vertex adjacent to the i-th edge */
+	std::optional<Vector3> adjacent_vertex_position(const int i) const
+	{
+		if (adjacency(i) < 0)
+		{
+			return {}; // adjacent vertex does not exist
+		}
+
+		return vertex_buffer_->positions[adjacency(i)];
+	}
+
+private:
+	const Face3i* face_;
+	const VertexBuffer4f* vertex_buffer_;
+};
+
+/* contiguous faces of one patch together with the dense index of its material in the material library */
+class PatchView
+{
+public:
+	class iterator
+	{
+	public:
+		iterator(const Face3i* face, const VertexBuffer4f* vertex_buffer) : face_(face), vertex_buffer_(vertex_buffer) {}
+
+		TriangleView operator*() const { return TriangleView(*face_, *vertex_buffer_); }
+		iterator& operator++() { ++face_; return *this; }
+		bool operator!=(const iterator& rhs) const { return face_ != rhs.face_; }
+
+	private:
+		const Face3i* face_;
+		const VertexBuffer4f* vertex_buffer_;
+	};
+
+	PatchView(Material* material, const int material_index, const Patch& patch, const VertexBuffer4f& vertex_buffer) :
+		material_(material), material_index_(material_index), faces_(patch.data()), no_faces_(patch.size()), vertex_buffer_(&vertex_buffer) {}
+
+	Material* material() const { return material_; }
+	int material_index() const { return material_index_; }
+	size_t size() const { return no_faces_; }
+
+	TriangleView operator[](const size_t i) const { return TriangleView(faces_[i], *vertex_buffer_); }
+
+	iterator begin() const { return iterator(faces_, vertex_buffer_); }
+	iterator end() const { return iterator(faces_ + no_faces_, vertex_buffer_); }
+
+private:
+	Material* material_;
+	int material_index_;
+	const Face3i* faces_;
+	size_t no_faces_;
+	const VertexBuffer4f* vertex_buffer_;
+};
+
+/* patches of a mesh, the material lookup is done once per patch instead of once per triangle */
+class MeshView
+{
+public:
+	MeshView(Mesh& mesh, const MaterialLibrary& materials)
+	{
+		const VertexBuffer4f& vertex_buffer = mesh.vertex_buffer();
+
+		for (const auto& patch : mesh.patches())
+		{
+			// a material missing from the library falls back to the first entry of the material table
+			const auto material = materials.find(patch.first->name());
+			const int material_index = (material != materials.end()) ? int(std::distance(std::begin(materials), material)) : 0;
+
+			patches_.emplace_back(patch.first.get(), material_index, patch.second, vertex_buffer);
+			size_ += patch.second.size();
+		}
+	}
+
+	const std::vector<PatchView>& patches() const { return patches_; }
+
+	/* number of triangles */
+	size_t size() const { return size_; }
+
+private:
+	std::vector<PatchView> patches_;
+	size_t size_{ 0 };
+};
+
+#endif
@@ -10,7 +10,7 @@
 #include "objloader.h"
 
 /* create a window and initialize OpenGL context */
-int tutorial_1( const int width, const int height )
+int tutorial_1( const int width, const int height, const bool compare_layouts )
 {
 	Rasterizer rasterizer = Rasterizer();
 	rasterizer.initOpenGl(width, height);
@@ -20,20 +20,37 @@ int tutorial_1( const int width, const int height )
 	//rasterizer.loadMesh_triangles("../../../data/deer2.obj");
 	//rasterizer.loadMesh_triangles("../../../data/test.obj");
 	rasterizer.loadMesh_triangles("../../../data/panda_test.obj");
+	//rasterizer.generateGridScene(32, 32, 2.0f); // large scene of the loaded objects on a ground plane for compareCCVolumes
+	//rasterizer.loadMesh_triangles("../../../data/panda_test.obj", VertexLayout::kCompact);
 	rasterizer.initShaders();
 
 	rasterizer.initCamera(width, height, deg2rad(45.0), Vector3(0.374, 7.928, 5.02), Vector3(0, 0, 0)); // (x, z, y)
 	rasterizer.initLight(Vector3(50.0f, 0.0f, 70.0f), 1.0f, true);
+	//for (int i = 0; i < 24; ++i) rasterizer.addLight(Vector3(8.0f * cosf(i * 0.2618f), 8.0f * sinf(i * 0.2618f), 3.0f), 0.25f, false, 6.0f); // ring of bounded lights, L prints the scheduler
 	
 	rasterizer.initSurface();
 	rasterizer.initSurfaceEnvMap();
 	rasterizer.initSurfaceTriangles();
+	rasterizer.initMaterials();
+	rasterizer.initShadowVolumes();
 
 	//rasterizer.InitEnvMap("../../../data/pref_env_2048.exr");
 	//rasterizer.InitEnvMap("../../../data/pref_env_2048_nature.exr"); 
 	rasterizer.InitEnvMap("../../../data/hdr_nature_map.exr"); 
 	rasterizer.SetEnvMap();
 
+	if ( compare_layouts )
+	{
+		// renders the first frame with both layouts, saves both frames if they differ
+		return ( rasterizer.compareVertexLayouts( 2 ) == S_OK ) ? 0 : 1;
+	}
+
+	//rasterizer.compareShadowVolumePaths(); // with shadow_volume_test.obj, the stencil buffers of both paths have to be identical
+	//rasterizer.benchmarkShadowVolumes(); // geometry shader vs CPU volumes by caster triangles and threads
+	//rasterizer.compareStencilModes(); // z-fail vs ZP+, shadowed pixels, rasterized samples and GPU time of the stencil pass
+	//rasterizer.compareCCVolumes(); // with test.obj or the grid scene, infinite vs CC volumes, shadowed pixels, rasterized samples and GPU time
+	//rasterizer.compareHierarchicalVolumes(); // per pixel vs tile classified compute path volumes, shadowed pixels, rasterized samples, GPU time and tiles
+
 	rasterizer.mainLoop();
 
 	return 0;
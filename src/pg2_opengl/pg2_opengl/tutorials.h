@@ -12,7 +12,7 @@ int LoadShader( const std::string & file_name, std::vector<char> & shader );
 std::string LoadAsciiFile( const std::string & file_name );
 GLint CheckShader( const GLenum shader );
 
-int tutorial_1( const int width = 640, const int height = 480 );
+int tutorial_1( const int width = 640, const int height = 480, const bool compare_layouts = false );
 
 
 #endif
@@ -0,0 +1,442 @@
+#include "pch.h"
+#include "volume_builder.h"
+#include "parallel.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define VOLUME_BUILDER_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC compiles intrinsics of any instruction set, gcc and clang need the target of every function using them
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+static const uint8_t kFacing = 1 << 0;
+static const uint8_t kSilhouette02 = 1 << 1; // edge V0-V2, adjacent vertex V1
+static const uint8_t kSilhouette24 = 1 << 2; // edge V2-V4, adjacent vertex V3
+static const uint8_t kSilhouette40 = 1 << 3; // edge V4-V0, adjacent vertex V5
+
+static const GLuint kRestartIndex = 0xFFFFFFFF;
+
+SimdLevel DetectSimdLevel()
+{
+#ifdef VOLUME_BUILDER_X86
+#ifdef _MSC_VER
+	int info[4] = { 0 };
+	__cpuid(info, 0);
+	if (info[0] >= 7)
+	{
+		__cpuidex(info, 7, 0);
+		const bool avx2 = (info[1] & (1 << 5)) != 0;
+
+		__cpuid(info, 1);
+		const bool os_saves_ymm = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+
+		if (avx2 && os_saves_ymm)
+		{
+			return SimdLevel::kAVX2;
+		}
+	}
+#else
+	if (__builtin_cpu_supports("avx2"))
+	{
+		return SimdLevel::kAVX2;
+	}
+#endif
+	return SimdLevel::kSSE2; // part of every x86-64 CPU
+#else
+	return SimdLevel::kScalar;
+#endif
+}
+
+const char* SimdLevelName(const SimdLevel level)
+{
+	switch (level)
+	{
+	case SimdLevel::kAVX2: return "AVX2";
+	case SimdLevel::kSSE2: return "SSE2";
+	default: return "scalar";
+	}
+}
+
+void VolumeBuilder::SetPositions(const std::vector<Vector3>& positions)
+{
+	x_.resize(positions.size());
+	y_.resize(positions.size());
+	z_.resize(positions.size());
+
+	for (size_t i = 0; i < positions.size(); ++i)
+	{
+		x_[i] = positions[i].x;
+		y_[i] = positions[i].y;
+		z_[i] = positions[i].z;
+	}
+}
+
+/* light position in object space and the sign of the determinant, a mirroring transform swaps the front and back side of all faces */
+static void LightToObjectSpace(const Matrix4x4& m, const Vector3& light_ws, Vector3& light_os, float& orientation)
+{
+	const float a = m.get(0, 0), b = m.get(0, 1), c = m.get(0, 2);
+	const float d = m.get(1, 0), e = m.get(1, 1), f = m.get(1, 2);
+	const float g = m.get(2, 0), h = m.get(2, 1), i = m.get(2, 2);
+
+	const float det = a * (e * i - f * h) - b * (d * i - f * g) + c * (d * h - e * g);
+	const float inv_det = (det != 0.0f) ? 1.0f / det : 0.0f;
+
+	const float x = light_ws.x - m.get(0, 3);
+	const float y = light_ws.y - m.get(1, 3);
+	const float z = light_ws.z - m.get(2, 3);
+
+	// inverse of the 3x3 part by the adjugate
+	light_os.x = ((e * i - f * h) * x + (c * h - b * i) * y + (b * f - c * e) * z) * inv_det;
+	light_os.y = ((f * g - d * i) * x + (a * i - c * g) * y + (c * d - a * f) * z) * inv_det;
+	light_os.z = ((d * h - e * g) * x + (b * g - a * h) * y + (a * e - b * d) * z) * inv_det;
+
+	orientation = (det < 0.0f) ? -1.0f : 1.0f;
+}
+
+/* dot(L - A, cross(B - A, C - A)), positive if the light is in front of the triangle ABC, the same terms as stencil_shader.geom */
+static inline float PlaneSide(const float ax, const float ay, const float az, const float bx, const float by, const float bz,
+	const float cx, const float cy, const float cz, const float lx, const float ly, const float lz)
+{
+	const float ux = bx - ax, uy = by - ay, uz = bz - az;
+	const float vx = cx - ax, vy = cy - ay, vz = cz - az;
+
+	const float nx = uy * vz - uz * vy;
+	const float ny = uz * vx - ux * vz;
+	const float nz = ux * vy - uy * vx;
+
+	return (lx - ax) * nx + (ly - ay) * ny + (lz - az) * nz;
+}
+
+/* mask of one triangle from the four plane sides, an edge is a silhouette unless the neighbour faces the light as well */
+static inline uint8_t TriangleMask(const bool facing, const bool back_02, const bool back_24, const bool back_40)
+{
+	if (!facing)
+	{
+		return 0;
+	}
+
+	return kFacing | (back_02 ? kSilhouette02 : 0) | (back_24 ? kSilhouette24 : 0) | (back_40 ? kSilhouette40 : 0);
+}
+
+/* classifies the triangles [first, last) of the adjacency indices, masks[t - first] receives the bits of triangle t */
+static void ClassifyScalar(const GLuint* indices, const size_t first, const size_t last, const float* x, const float* y, const float* z,
+	const Vector3& l, const float orientation, uint8_t* masks)
+{
+	for (size_t t = first; t < last; ++t)
+	{
+		const GLuint* p = indices + 6 * t;
+		float vx[6], vy[6], vz[6];
+
+		for (int k = 0; k < 6; ++k)
+		{
+			vx[k] = x[p[k]];
+			vy[k] = y[p[k]];
+			vz[k] = z[p[k]];
+		}
+
+		const float side_042 = orientation * PlaneSide(vx[0], vy[0], vz[0], vx[2], vy[2], vz[2], vx[4], vy[4], vz[4], l.x, l.y, l.z);
+		const float side_012 = orientation * PlaneSide(vx[0], vy[0], vz[0], vx[1], vy[1], vz[1], vx[2], vy[2], vz[2], l.x, l.y, l.z);
+		const float side_234 = orientation * PlaneSide(vx[2], vy[2], vz[2], vx[3], vy[3], vz[3], vx[4], vy[4], vz[4], l.x, l.y, l.z);
+		const float side_450 = orientation * PlaneSide(vx[4], vy[4], vz[4], vx[5], vy[5], vz[5], vx[0], vy[0], vz[0], l.x, l.y, l.z);
+
+		masks[t - first] = TriangleMask(side_042 > 0.0f, !(side_012 > 0.0f), !(side_234 > 0.0f), !(side_450 > 0.0f));
+	}
+}
+
+#ifdef VOLUME_BUILDER_X86
+static inline __m128 PlaneSideSSE(const __m128 ax, const __m128 ay, const __m128 az, const __m128 bx, const __m128 by, const __m128 bz,
+	const __m128 cx, const __m128 cy, const __m128 cz, const __m128 lx, const __m128 ly, const __m128 lz)
+{
+	const __m128 ux = _mm_sub_ps(bx, ax), uy = _mm_sub_ps(by, ay), uz = _mm_sub_ps(bz, az);
+	const __m128 vx = _mm_sub_ps(cx, ax), vy = _mm_sub_ps(cy, ay), vz = _mm_sub_ps(cz, az);
+
+	const __m128 nx = _mm_sub_ps(_mm_mul_ps(uy, vz), _mm_mul_ps(uz, vy));
+	const __m128 ny = _mm_sub_ps(_mm_mul_ps(uz, vx), _mm_mul_ps(ux, vz));
+	const __m128 nz = _mm_sub_ps(_mm_mul_ps(ux, vy), _mm_mul_ps(uy, vx));
+
+	return _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(lx, ax), nx), _mm_mul_ps(_mm_sub_ps(ly, ay), ny)), _mm_mul_ps(_mm_sub_ps(lz, az), nz));
+}
+
+/* 4 triangles per iteration, SSE2 has no gather so the lanes are loaded one by one */
+static void ClassifySSE2(const GLuint* indices, const size_t first, const size_t last, const float* x, const float* y, const float* z,
+	const Vector3& l, const float orientation, uint8_t* masks)
+{
+	const __m128 lx = _mm_set1_ps(l.x), ly = _mm_set1_ps(l.y), lz = _mm_set1_ps(l.z);
+	const __m128 o = _mm_set1_ps(orientation);
+	const __m128 zero = _mm_setzero_ps();
+
+	size_t t = first;
+
+	for (; t + 4 <= last; t += 4)
+	{
+		const GLuint* p = indices + 6 * t;
+		__m128 vx[6], vy[6], vz[6];
+
+		for (int k = 0; k < 6; ++k)
+		{
+			const GLuint i0 = p[k], i1 = p[6 + k], i2 = p[12 + k], i3 = p[18 + k];
+
+			vx[k] = _mm_setr_ps(x[i0], x[i1], x[i2], x[i3]);
+			vy[k] = _mm_setr_ps(y[i0], y[i1], y[i2], y[i3]);
+			vz[k] = _mm_setr_ps(z[i0], z[i1], z[i2], z[i3]);
+		}
+
+		const __m128 side_042 = _mm_mul_ps(o, PlaneSideSSE(vx[0], vy[0], vz[0], vx[2], vy[2], vz[2], vx[4], vy[4], vz[4], lx, ly, lz));
+		const __m128 side_012 = _mm_mul_ps(o, PlaneSideSSE(vx[0], vy[0], vz[0], vx[1], vy[1], vz[1], vx[2], vy[2], vz[2], lx, ly, lz));
+		const __m128 side_234 = _mm_mul_ps(o, PlaneSideSSE(vx[2], vy[2], vz[2], vx[3], vy[3], vz[3], vx[4], vy[4], vz[4], lx, ly, lz));
+		const __m128 side_450 = _mm_mul_ps(o, PlaneSideSSE(vx[4], vy[4], vz[4], vx[5], vy[5], vz[5], vx[0], vy[0], vz[0], lx, ly, lz));
+
+		const int facing = _mm_movemask_ps(_mm_cmpgt_ps(side_042, zero));
+		const int back_02 = _mm_movemask_ps(_mm_cmpngt_ps(side_012, zero));
+		const int back_24 = _mm_movemask_ps(_mm_cmpngt_ps(side_234, zero));
+		const int back_40 = _mm_movemask_ps(_mm_cmpngt_ps(side_450, zero));
+
+		for (int j = 0; j < 4; ++j)
+		{
+			masks[t - first + j] = TriangleMask((facing >> j) & 1, (back_02 >> j) & 1, (back_24 >> j) & 1, (back_40 >> j) & 1);
+		}
+	}
+
+	ClassifyScalar(indices, t, last, x, y, z, l, orientation, masks + (t - first));
+}
+
+TARGET_AVX2 static inline __m256 PlaneSideAVX2(const __m256 ax, const __m256 ay, const __m256 az, const __m256 bx, const __m256 by, const __m256 bz,
+	const __m256 cx, const __m256 cy, const __m256 cz, const __m256 lx, const __m256 ly, const __m256 lz)
+{
+	const __m256 ux = _mm256_sub_ps(bx, ax), uy = _mm256_sub_ps(by, ay), uz = _mm256_sub_ps(bz, az);
+	const __m256 vx = _mm256_sub_ps(cx, ax), vy = _mm256_sub_ps(cy, ay), vz = _mm256_sub_ps(cz, az);
+
+	const __m256 nx = _mm256_sub_ps(_mm256_mul_ps(uy, vz), _mm256_mul_ps(uz, vy));
+	const __m256 ny = _mm256_sub_ps(_mm256_mul_ps(uz, vx), _mm256_mul_ps(ux, vz));
+	const __m256 nz = _mm256_sub_ps(_mm256_mul_ps(ux, vy), _mm256_mul_ps(uy, vx));
+
+	return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(lx, ax), nx), _mm256_mul_ps(_mm256_sub_ps(ly, ay), ny)),
+		_mm256_mul_ps(_mm256_sub_ps(lz, az), nz));
+}
+
+/* 8 triangles per iteration, the vertex indices and positions are gathered */
+TARGET_AVX2 static void ClassifyAVX2(const GLuint* indices, const size_t first, const size_t last, const float* x, const float* y, const float* z,
+	const Vector3& l, const float orientation, uint8_t* masks)
+{
+	const __m256 lx = _mm256_set1_ps(l.x), ly = _mm256_set1_ps(l.y), lz = _mm256_set1_ps(l.z);
+	const __m256 o = _mm256_set1_ps(orientation);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256i primitive_stride = _mm256_setr_epi32(0, 6, 12, 18, 24, 30, 36, 42);
+
+	size_t t = first;
+
+	for (; t + 8 <= last; t += 8)
+	{
+		const int* p = reinterpret_cast<const int*>(indices + 6 * t);
+		__m256 vx[6], vy[6], vz[6];
+
+		for (int k = 0; k < 6; ++k)
+		{
+			const __m256i v = _mm256_i32gather_epi32(p + k, primitive_stride, 4);
+
+			vx[k] = _mm256_i32gather_ps(x, v, 4);
+			vy[k] = _mm256_i32gather_ps(y, v, 4);
+			vz[k] = _mm256_i32gather_ps(z, v, 4);
+		}
+
+		const __m256 side_042 = _mm256_mul_ps(o, PlaneSideAVX2(vx[0], vy[0], vz[0], vx[2], vy[2], vz[2], vx[4], vy[4], vz[4], lx, ly, lz));
+		const __m256 side_012 = _mm256_mul_ps(o, PlaneSideAVX2(vx[0], vy[0], vz[0], vx[1], vy[1], vz[1], vx[2], vy[2], vz[2], lx, ly, lz));
+		const __m256 side_234 = _mm256_mul_ps(o, PlaneSideAVX2(vx[2], vy[2], vz[2], vx[3], vy[3], vz[3], vx[4], vy[4], vz[4], lx, ly, lz));
+		const __m256 side_450 = _mm256_mul_ps(o, PlaneSideAVX2(vx[4], vy[4], vz[4], vx[5], vy[5], vz[5], vx[0], vy[0], vz[0], lx, ly, lz));
+
+		const int facing = _mm256_movemask_ps(_mm256_cmp_ps(side_042, zero, _CMP_GT_OQ));
+		const int back_02 = _mm256_movemask_ps(_mm256_cmp_ps(side_012, zero, _CMP_NGT_UQ));
+		const int back_24 = _mm256_movemask_ps(_mm256_cmp_ps(side_234, zero, _CMP_NGT_UQ));
+		const int back_40 = _mm256_movemask_ps(_mm256_cmp_ps(side_450, zero, _CMP_NGT_UQ));
+
+		for (int j = 0; j < 8; ++j)
+		{
+			masks[t - first + j] = TriangleMask((facing >> j) & 1, (back_02 >> j) & 1, (back_24 >> j) & 1, (back_40 >> j) & 1);
+		}
+	}
+
+	ClassifyScalar(indices, t, last, x, y, z, l, orientation, masks + (t - first));
+}
+#endif
+
+static void Classify(const SimdLevel level, const GLuint* indices, const size_t first, const size_t last, const float* x, const float* y, const float* z,
+	const Vector3& l, const float orientation, uint8_t* masks)
+{
+#ifdef VOLUME_BUILDER_X86
+	if (level == SimdLevel::kAVX2)
+	{
+		ClassifyAVX2(indices, first, last, x, y, z, l, orientation, masks);
+		return;
+	}
+	if (level == SimdLevel::kSSE2)
+	{
+		ClassifySSE2(indices, first, last, x, y, z, l, orientation, masks);
+		return;
+	}
+#endif
+	ClassifyScalar(indices, first, last, x, y, z, l, orientation, masks);
+}
+
+static inline Vector3 TransformPoint(const Matrix4x4& m, const Vector3& p)
+{
+	return Vector3(m.get(0, 0) * p.x + m.get(0, 1) * p.y + m.get(0, 2) * p.z + m.get(0, 3),
+		m.get(1, 0) * p.x + m.get(1, 1) * p.y + m.get(1, 2) * p.z + m.get(1, 3),
+		m.get(2, 0) * p.x + m.get(2, 1) * p.y + m.get(2, 2) * p.z + m.get(2, 3));
+}
+
+static inline size_t VolumeIndexCount(const uint8_t mask)
+{
+	if ((mask & kFacing) == 0)
+	{
+		return 0;
+	}
+
+	return 8 + 5 * (((mask & kSilhouette02) ? 1 : 0) + ((mask & kSilhouette24) ? 1 : 0) + ((mask & kSilhouette40) ? 1 : 0));
+}
+
+void VolumeBuilder::Build(const GLuint* indices, const std::vector<VolumeCaster>& casters, const Vector3& light_position,
+	const std::function<void(const size_t no_vertices, const size_t no_indices, GLfloat*& vertices, GLuint*& volume_indices)>& output,
+	size_t& no_vertices, size_t& no_indices, int no_threads, const SimdLevel level)
+{
+	// casters are concatenated into one range of triangles which is split across the threads
+	std::vector<size_t> first_triangles(casters.size() + 1, 0);
+	std::vector<Vector3> lights_os(casters.size());
+	std::vector<float> orientations(casters.size());
+
+	for (size_t c = 0; c < casters.size(); ++c)
+	{
+		first_triangles[c + 1] = first_triangles[c] + casters[c].no_indices / 6;
+		LightToObjectSpace(casters[c].transform, light_position, lights_os[c], orientations[c]);
+	}
+
+	const size_t no_triangles = first_triangles.back();
+
+	masks_.resize(no_triangles);
+
+	if (no_threads < 1)
+	{
+		no_threads = std::max(1, int(std::thread::hardware_concurrency()));
+	}
+	no_threads = int(std::max<size_t>(1, std::min<size_t>(no_threads, no_triangles / 4096 + 1)));
+
+	// calls task(caster, first, last) for the caster triangles [first, last) within the global range [begin, end)
+	auto for_each_caster = [&](const size_t begin, const size_t end, const std::function<void(size_t, size_t, size_t)>& task) {
+		size_t c = std::upper_bound(first_triangles.begin(), first_triangles.end(), begin) - first_triangles.begin() - 1;
+
+		for (; c < casters.size() && first_triangles[c] < end; ++c)
+		{
+			const size_t first = std::max(begin, first_triangles[c]);
+			const size_t last = std::min(end, first_triangles[c + 1]);
+
+			if (first < last)
+			{
+				task(c, first - first_triangles[c], last - first_triangles[c]);
+			}
+		}
+	};
+
+	// 1) classify and count the output of every thread
+	std::vector<size_t> thread_vertices(size_t(no_threads) + 1, 0);
+	std::vector<size_t> thread_indices(size_t(no_threads) + 1, 0);
+
+	ParallelFor(no_threads, no_triangles, [&](const int t, const size_t begin, const size_t end) {
+		for_each_caster(begin, end, [&](const size_t c, const size_t first, const size_t last) {
+			Classify(level, indices + casters[c].first_index, first, last, x_.data(), y_.data(), z_.data(), lights_os[c], orientations[c],
+				masks_.data() + first_triangles[c] + first);
+		});
+
+		for (size_t i = begin; i < end; ++i)
+		{
+			thread_vertices[t + 1] += (masks_[i] & kFacing) ? kVolumeVerticesPerTriangle : 0;
+			thread_indices[t + 1] += VolumeIndexCount(masks_[i]);
+		}
+	});
+
+	for (int t = 0; t < no_threads; ++t)
+	{
+		thread_vertices[t + 1] += thread_vertices[t];
+		thread_indices[t + 1] += thread_indices[t];
+	}
+
+	no_vertices = thread_vertices[no_threads];
+	no_indices = thread_indices[no_threads];
+
+	GLfloat* vertices = nullptr;
+	GLuint* volume_indices = nullptr;
+	output(no_vertices, no_indices, vertices, volume_indices);
+
+	// 2) every thread writes the caps and quads of its triangles behind the output of the previous threads
+	ParallelFor(no_threads, no_triangles, [&](const int t, const size_t begin, const size_t end) {
+		size_t v = thread_vertices[t];
+		size_t i = thread_indices[t];
+
+		for_each_caster(begin, end, [&](const size_t c, const size_t first, const size_t last) {
+			const GLuint* caster_indices = indices + casters[c].first_index;
+			const uint8_t* masks = masks_.data() + first_triangles[c];
+
+			for (size_t triangle = first; triangle < last; ++triangle)
+			{
+				const uint8_t mask = masks[triangle];
+
+				if ((mask & kFacing) == 0)
+				{
+					continue;
+				}
+
+				const GLuint* p = caster_indices + 6 * triangle;
+				Vector3 corners[3];
+
+				for (int k = 0; k < 3; ++k)
+				{
+					corners[k] = TransformPoint(casters[c].transform, Vector3(x_[p[2 * k]], y_[p[2 * k]], z_[p[2 * k]]));
+				}
+
+				Vector3 offset = corners[0] - light_position;
+				offset.Normalize();
+				offset *= 0.01f;
+
+				GLfloat* dst = vertices + 4 * v;
+
+				for (int k = 0; k < 3; ++k)
+				{
+					const Vector3 shifted = corners[k] + offset;
+					const Vector3 infinite = corners[k] - light_position;
+
+					dst[4 * k + 0] = shifted.x; dst[4 * k + 1] = shifted.y; dst[4 * k + 2] = shifted.z; dst[4 * k + 3] = 1.0f;
+					dst[4 * k + 12] = infinite.x; dst[4 * k + 13] = infinite.y; dst[4 * k + 14] = infinite.z; dst[4 * k + 15] = 0.0f;
+				}
+
+				const GLuint base = GLuint(v);
+				GLuint* out = volume_indices + i;
+
+				// FRONT CAP and BACK CAP
+				*out++ = base + 0; *out++ = base + 2; *out++ = base + 1; *out++ = kRestartIndex;
+				*out++ = base + 3; *out++ = base + 4; *out++ = base + 5; *out++ = kRestartIndex;
+
+				if (mask & kSilhouette02)
+				{
+					*out++ = base + 0; *out++ = base + 1; *out++ = base + 3; *out++ = base + 4; *out++ = kRestartIndex;
+				}
+				if (mask & kSilhouette24)
+				{
+					*out++ = base + 1; *out++ = base + 2; *out++ = base + 4; *out++ = base + 5; *out++ = kRestartIndex;
+				}
+				if (mask & kSilhouette40)
+				{
+					*out++ = base + 2; *out++ = base + 0; *out++ = base + 5; *out++ = base + 3; *out++ = kRestartIndex;
+				}
+
+				v += kVolumeVerticesPerTriangle;
+				i = size_t(out - volume_indices);
+			}
+		});
+	});
+}
@@ -0,0 +1,49 @@
+#ifndef VOLUME_BUILDER_H_
+#define VOLUME_BUILDER_H_
+
+#include "pch.h"
+#include "vector3.h"
+#include "matrix4x4.h"
+
+/* instruction set of the classification kernel */
+enum class SimdLevel { kScalar, kSSE2, kAVX2 };
+
+/* best level supported by the running CPU */
+SimdLevel DetectSimdLevel();
+
+const char* SimdLevelName(const SimdLevel level);
+
+/* adjacency index range of one shadow caster */
+struct VolumeCaster
+{
+	GLuint first_index;
+	GLuint no_indices;
+	Matrix4x4 transform; /* object to world space, affine */
+};
+
+/* output per light facing triangle, the same vertices and strips as written by shadow_volume.comp */
+static const size_t kVolumeVerticesPerTriangle = 6;
+static const size_t kVolumeIndicesPerTriangle = 8 + 3 * 5; /* worst case of both caps and three silhouette quads */
+
+/* CPU backend of the shadow volumes for machines with a weak or no GPU, light facing triangles and silhouette edges
+are classified by SIMD kernels over SoA positions and the caps and extruded quads are written in parallel */
+class VolumeBuilder
+{
+public:
+	/* copies the vertex pool into the SoA arrays read by the kernels */
+	void SetPositions(const std::vector<Vector3>& positions);
+
+	/* classifies all caster triangles against the world space light and writes xyzw vertices and GL_TRIANGLE_STRIP indices
+	separated by the restart index 0xFFFFFFFF, output is called with the counted sizes and returns buffers of at least that size (0 threads - all cores) */
+	void Build(const GLuint* indices, const std::vector<VolumeCaster>& casters, const Vector3& light_position,
+		const std::function<void(const size_t no_vertices, const size_t no_indices, GLfloat*& vertices, GLuint*& volume_indices)>& output,
+		size_t& no_vertices, size_t& no_indices, int no_threads = 0, const SimdLevel level = DetectSimdLevel());
+
+private:
+	std::vector<float> x_;
+	std::vector<float> y_;
+	std::vector<float> z_;
+	std::vector<uint8_t> masks_; // kFacing and kSilhouette* bits of every caster triangle
+};
+
+#endif
@@ -0,0 +1,312 @@
+#include "pch.h"
+#include "volume_culling.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define VOLUME_CULLING_SSE2
+#include <emmintrin.h>
+#endif
+
+void TransformBounds(const Matrix4x4& transform, const Vector3& bounds_min, const Vector3& bounds_max, Vector3& world_min, Vector3& world_max)
+{
+	// Arvo, each row of the linear part adds the smaller and the larger of its products with the extents
+	const float lower[3] = { bounds_min.x, bounds_min.y, bounds_min.z };
+	const float upper[3] = { bounds_max.x, bounds_max.y, bounds_max.z };
+	float result_min[3], result_max[3];
+
+	for (int r = 0; r < 3; ++r)
+	{
+		result_min[r] = result_max[r] = transform.get(r, 3);
+
+		for (int c = 0; c < 3; ++c)
+		{
+			const float a = transform.get(r, c) * lower[c];
+			const float b = transform.get(r, c) * upper[c];
+
+			result_min[r] += std::min(a, b);
+			result_max[r] += std::max(a, b);
+		}
+	}
+
+	world_min = Vector3(result_min[0], result_min[1], result_min[2]);
+	world_max = Vector3(result_max[0], result_max[1], result_max[2]);
+}
+
+bool IntersectsOcclusionPyramid(const Vector3& light_position, const Vector3* near_corners, const Vector3& bounds_min, const Vector3& bounds_max)
+{
+	// the axes of the box, i.e. the bounds of the five vertices of the pyramid
+	Vector3 pyramid_min = light_position;
+	Vector3 pyramid_max = light_position;
+
+	for (int i = 0; i < 4; ++i)
+	{
+		const Vector3& c = near_corners[i];
+
+		pyramid_min = Vector3(std::min(pyramid_min.x, c.x), std::min(pyramid_min.y, c.y), std::min(pyramid_min.z, c.z));
+		pyramid_max = Vector3(std::max(pyramid_max.x, c.x), std::max(pyramid_max.y, c.y), std::max(pyramid_max.z, c.z));
+	}
+
+	if (pyramid_min.x > bounds_max.x || pyramid_min.y > bounds_max.y || pyramid_min.z > bounds_max.z ||
+		pyramid_max.x < bounds_min.x || pyramid_max.y < bounds_min.y || pyramid_max.z < bounds_min.z)
+	{
+		return false;
+	}
+
+	// the near plane and the four planes through the light and the edges of the quad bound the pyramid
+	Vector3 normals[5];
+	Vector3 points[5];
+
+	normals[0] = (near_corners[1] - near_corners[0]).CrossProduct(near_corners[2] - near_corners[0]);
+	points[0] = near_corners[0];
+
+	for (int i = 0; i < 4; ++i)
+	{
+		normals[i + 1] = (near_corners[i] - light_position).CrossProduct(near_corners[(i + 1) % 4] - light_position);
+		points[i + 1] = light_position;
+	}
+
+	// a point strictly inside of a non-degenerate pyramid orients all planes outwards
+	const Vector3 inside = (light_position + near_corners[0] + near_corners[1] + near_corners[2] + near_corners[3]) * 0.2f;
+
+	for (int p = 0; p < 5; ++p)
+	{
+		const float side = normals[p].DotProduct(inside - points[p]);
+
+		if (!(std::abs(side) > 1e-12f))
+		{
+			return true; // the light is in the near plane
+		}
+		if (side > 0.0f)
+		{
+			normals[p] *= -1.0f;
+		}
+	}
+
+	for (int p = 0; p < 5; ++p)
+	{
+		// the box corner furthest along -normal, the box is outside if even this one is in front of the plane
+		const Vector3& n = normals[p];
+		const Vector3 corner((n.x > 0.0f) ? bounds_min.x : bounds_max.x, (n.y > 0.0f) ? bounds_min.y : bounds_max.y, (n.z > 0.0f) ? bounds_min.z : bounds_max.z);
+
+		if (n.DotProduct(corner - points[p]) > 0.0f)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void ExtractSidePlanes(const Matrix4x4& view_projection, float planes[4][4])
+{
+	// Gribb and Hartmann, w +- x >= 0 and w +- y >= 0 in clip space
+	for (int p = 0; p < 4; ++p)
+	{
+		const int row = p / 2;
+		const float sign = (p % 2 == 0) ? 1.0f : -1.0f;
+
+		for (int c = 0; c < 4; ++c)
+		{
+			planes[p][c] = view_projection.get(3, c) + sign * view_projection.get(row, c);
+		}
+
+		const float length = sqrtf(planes[p][0] * planes[p][0] + planes[p][1] * planes[p][1] + planes[p][2] * planes[p][2]);
+
+		for (int c = 0; c < 4; ++c)
+		{
+			planes[p][c] /= length;
+		}
+	}
+}
+
+void CullExtrudedSpheres(const float planes[4][4], const Vector3& light_position, const SphereBatch& spheres, uint8_t* visible)
+{
+	// a sphere with center c and radius r is outside of the plane n.x + d >= 0 with its extrusion x + t (x - L) if both n.c + d < -r
+	// and n.(c - L) <= -r, the latter keeps every point of the sphere from moving towards the inside
+	float light_distances[4];
+
+	for (int p = 0; p < 4; ++p)
+	{
+		light_distances[p] = planes[p][0] * light_position.x + planes[p][1] * light_position.y + planes[p][2] * light_position.z;
+	}
+
+	const size_t n = spheres.size();
+	size_t i = 0;
+
+#ifdef VOLUME_CULLING_SSE2
+	for (; i + 4 <= n; i += 4)
+	{
+		const __m128 x = _mm_loadu_ps(&spheres.x[i]);
+		const __m128 y = _mm_loadu_ps(&spheres.y[i]);
+		const __m128 z = _mm_loadu_ps(&spheres.z[i]);
+		const __m128 minus_r = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&spheres.r[i]));
+		__m128 culled = _mm_setzero_ps();
+
+		for (int p = 0; p < 4; ++p)
+		{
+			const __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes[p][0]), x), _mm_mul_ps(_mm_set1_ps(planes[p][1]), y)),
+				_mm_mul_ps(_mm_set1_ps(planes[p][2]), z));
+			const __m128 outside = _mm_cmplt_ps(_mm_add_ps(dot, _mm_set1_ps(planes[p][3])), minus_r);
+			const __m128 away = _mm_cmple_ps(_mm_sub_ps(dot, _mm_set1_ps(light_distances[p])), minus_r);
+
+			culled = _mm_or_ps(culled, _mm_and_ps(outside, away));
+		}
+
+		const int mask = _mm_movemask_ps(culled);
+
+		for (int k = 0; k < 4; ++k)
+		{
+			visible[i + k] = ((mask >> k) & 1) ? 0 : 1;
+		}
+	}
+#endif
+
+	// the same operations in the same order as the SSE2 loop
+	for (; i < n; ++i)
+	{
+		bool culled = false;
+
+		for (int p = 0; p < 4; ++p)
+		{
+			const float dot = (planes[p][0] * spheres.x[i] + planes[p][1] * spheres.y[i]) + planes[p][2] * spheres.z[i];
+
+			culled |= (dot + planes[p][3] < -spheres.r[i]) && (dot - light_distances[p] <= -spheres.r[i]);
+		}
+
+		visible[i] = culled ? 0 : 1;
+	}
+}
+
+void ReceiverGrid::Reset(const Vector3& light_position, const int no_columns)
+{
+	light_position_ = light_position;
+	no_columns_ = std::max(no_columns, 2);
+	no_rows_ = no_columns_ / 2;
+	max_distances_.assign(size_t(no_columns_) * size_t(no_rows_), 0.0f);
+}
+
+template<typename F> void ReceiverGrid::ForEachCell(const Vector3& direction, const float half_angle, F f) const
+{
+	const float theta = acosf(std::max(-1.0f, std::min(1.0f, direction.z)));
+	const float theta_min = theta - half_angle;
+	const float theta_max = theta + half_angle;
+
+	const int first_row = std::max(0, int(floorf(theta_min / float(M_PI) * no_rows_)));
+	const int last_row = std::min(no_rows_ - 1, int(floorf(theta_max / float(M_PI) * no_rows_)));
+
+	// a cap around a pole or wider than a hemisphere spans all longitudes, otherwise the longitudes within asin(sin a / sin theta)
+	int first_column = 0;
+	int last_column = no_columns_ - 1;
+
+	if (half_angle < float(M_PI_2) && theta_min > 0.0f && theta_max < float(M_PI))
+	{
+		const float phi = atan2f(direction.y, direction.x);
+		const float half_width = asinf(std::min(1.0f, sinf(half_angle) / sinf(theta)));
+
+		first_column = int(floorf((phi - half_width + float(M_PI)) / float(2.0 * M_PI) * no_columns_));
+		last_column = int(floorf((phi + half_width + float(M_PI)) / float(2.0 * M_PI) * no_columns_));
+
+		if (last_column - first_column + 1 >= no_columns_)
+		{
+			first_column = 0;
+			last_column = no_columns_ - 1;
+		}
+	}
+
+	for (int row = first_row; row <= last_row; ++row)
+	{
+		for (int column = first_column; column <= last_column; ++column)
+		{
+			// the longitudes wrap around at -pi
+			const int wrapped = (column % no_columns_ + no_columns_) % no_columns_;
+
+			f(size_t(row) * size_t(no_columns_) + size_t(wrapped));
+		}
+	}
+}
+
+void ReceiverGrid::AddSphere(const Vector3& center, const float radius)
+{
+	Vector3 direction = center - light_position_;
+	const float distance = direction.L2Norm();
+	const float far_distance = distance + radius;
+	// a light inside of the sphere sees it everywhere
+	const float half_angle = (distance > radius) ? asinf(radius / distance) + cell_angle() * 1e-3f : float(M_PI);
+
+	if (distance > 0.0f)
+	{
+		direction *= 1.0f / distance;
+	}
+
+	ForEachCell(direction, half_angle, [&](const size_t cell) {
+		max_distances_[cell] = std::max(max_distances_[cell], far_distance);
+	});
+}
+
+void ReceiverGrid::AddTriangle(const Vector3& a, const Vector3& b, const Vector3& c)
+{
+	const Vector3 corners[3] = { a - light_position_, b - light_position_, c - light_position_ };
+	Vector3 directions[3];
+	float far_distance = 0.0f;
+	bool touches_light = false;
+
+	for (int i = 0; i < 3; ++i)
+	{
+		const float distance = corners[i].L2Norm();
+
+		touches_light |= !(distance > 0.0f);
+		directions[i] = corners[i] * ((distance > 0.0f) ? 1.0f / distance : 0.0f);
+		far_distance = std::max(far_distance, distance); // the distance is convex, so the corners bound the whole triangle
+	}
+
+	// the cone around the mean direction through the farthest corner direction contains all their positive combinations
+	Vector3 axis = directions[0] + directions[1] + directions[2];
+	const float length = axis.L2Norm();
+	float half_angle = float(M_PI);
+
+	if (!touches_light && length > 1e-3f)
+	{
+		axis *= 1.0f / length;
+		float min_cos = 1.0f;
+
+		for (int i = 0; i < 3; ++i)
+		{
+			min_cos = std::min(min_cos, axis.DotProduct(directions[i]));
+		}
+		// only a cone narrower than a hemisphere is convex
+		if (min_cos > 0.0f)
+		{
+			half_angle = acosf(std::min(1.0f, min_cos)) + cell_angle() * 1e-3f;
+		}
+	}
+
+	ForEachCell(axis, half_angle, [&](const size_t cell) {
+		max_distances_[cell] = std::max(max_distances_[cell], far_distance);
+	});
+}
+
+void ReceiverGrid::Merge(const ReceiverGrid& other)
+{
+	for (size_t i = 0; i < max_distances_.size(); ++i)
+	{
+		max_distances_[i] = std::max(max_distances_[i], other.max_distances_[i]);
+	}
+}
+
+float ReceiverGrid::MaxDistance(const Vector3& center, const float radius) const
+{
+	Vector3 direction = center - light_position_;
+	const float distance = direction.L2Norm();
+	const float half_angle = (distance > radius) ? asinf(radius / distance) + cell_angle() * 1e-3f : float(M_PI);
+	float max_distance = 0.0f;
+
+	if (distance > 0.0f)
+	{
+		direction *= 1.0f / distance;
+	}
+
+	ForEachCell(direction, half_angle, [&](const size_t cell) {
+		max_distance = std::max(max_distance, max_distances_[cell]);
+	});
+
+	return max_distance;
+}
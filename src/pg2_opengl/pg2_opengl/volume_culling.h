@@ -0,0 +1,72 @@
+#ifndef VOLUME_CULLING_H_
+#define VOLUME_CULLING_H_
+
+#include "pch.h"
+#include "vector3.h"
+#include "matrix4x4.h"
+
+/* world space AABB of an object space AABB under an affine transform */
+void TransformBounds(const Matrix4x4& transform, const Vector3& bounds_min, const Vector3& bounds_max, Vector3& world_min, Vector3& world_max);
+
+/* false if the AABB is separated from the occlusion pyramid, the convex hull of the light and the near plane quad (corners in order around the quad),
+then no shadow volume of anything in the box contains a point of the near plane and z-pass counts correctly, conservative (true) for a degenerate pyramid */
+bool IntersectsOcclusionPyramid(const Vector3& light_position, const Vector3* near_corners, const Vector3& bounds_min, const Vector3& bounds_max);
+
+/* normalized planes (a, b, c, d), a x + b y + c z + d >= 0 inside, of the left, right, bottom and top side of the clip space of a view projection matrix,
+the near and far planes clip nothing in the stencil pass rendered with GL_DEPTH_CLAMP */
+void ExtractSidePlanes(const Matrix4x4& view_projection, float planes[4][4]);
+
+/* world space bounding spheres of the casters in SoA layout, filled once per frame */
+struct SphereBatch
+{
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> z;
+	std::vector<float> r;
+
+	void Resize(const size_t n) { x.resize(n); y.resize(n); z.resize(n); r.resize(n); }
+	size_t size() const { return x.size(); }
+};
+
+/* visible[i] = 0 if the sphere i and its extrusion away from the light to infinity lie outside of one of the planes, i.e. the shadow volume of
+anything in the sphere misses the view, four spheres per SSE2 iteration */
+void CullExtrudedSpheres(const float planes[4][4], const Vector3& light_position, const SphereBatch& spheres, uint8_t* visible);
+
+
+/* light space receiver occupancy of CC shadow volumes, a latitude-longitude grid of the directions around a point light where every cell keeps
+the largest distance from the light of the receivers it may contain, casters whose cells hold nothing behind them shadow nothing and the
+volumes of the rest may end at the last receiver instead of infinity */
+class ReceiverGrid
+{
+public:
+	/* empties the grid around the light, no_columns cells in longitude and no_columns / 2 in latitude */
+	void Reset(const Vector3& light_position, const int no_columns = 128);
+
+	/* every cell the sphere may cover gets its far side */
+	void AddSphere(const Vector3& center, const float radius);
+
+	/* every cell of the bounding cone of the triangle gets its farthest corner, large receivers are added per triangle */
+	void AddTriangle(const Vector3& a, const Vector3& b, const Vector3& c);
+
+	/* the larger distance per cell of two grids around the same light */
+	void Merge(const ReceiverGrid& other);
+
+	/* largest receiver distance in the cells the sphere may cover, 0 if there is none */
+	float MaxDistance(const Vector3& center, const float radius) const;
+
+	/* angular size of a cell in radians */
+	float cell_angle() const { return float(M_PI) / no_rows_; }
+
+	const Vector3& light_position() const { return light_position_; }
+
+private:
+	/* calls f(cell) for the cells of the cone around the unit direction, all of them for a half angle of pi / 2 or more */
+	template<typename F> void ForEachCell(const Vector3& direction, const float half_angle, F f) const;
+
+	Vector3 light_position_;
+	int no_columns_{ 0 };
+	int no_rows_{ 0 };
+	std::vector<float> max_distances_; // row major, row 0 around +z
+};
+
+#endif